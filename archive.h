@@ -0,0 +1,341 @@
+#ifndef BRAINWIRE_ARCHIVE_H
+#define BRAINWIRE_ARCHIVE_H
+
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <unordered_map>
+#include <cstdint>
+
+#include "common.h"
+#include "wav.h"
+#include "format.h"
+#include "codec.h"
+#include "parallel.h"
+#include "hash.h"
+
+// Solid multi-recording archives.
+//
+// All recordings are encoded as one job: blocks of every recording are
+// modelled in parallel, and the table reuse pass runs over all of them in
+// order, so a recording whose statistics match an earlier one codes with
+// that recording's tables instead of sending its own. Tables live in one
+// shared section; blocks refer to them by index (TABLE_SHARED).
+//
+// Layout (little-endian):
+//
+//   magic "BRWA", version byte
+//   recording streams, back to back (.brainwire stream bodies, see
+//     writeBrainwireStream)
+//   shared tables: varint count, then each table (see writeEntropyTables)
+//   directory: varint entry count, then per recording: varint name length,
+//     name, varint stream offset, varint stream size, varint sample count
+//   trailer: uint64 shared tables offset, uint64 directory offset, "BRWA"
+//
+// Everything needed to find a recording sits at the end: listing reads the
+// trailer and the directory, extracting one recording reads the shared
+// tables and its stream, whatever the archive size.
+//
+// Duplicate content is stored once. Recordings and blocks are hashed over
+// their raw PCM; a recording identical to an earlier one (header included)
+// gets a directory entry pointing at the earlier stream, and a block
+// identical to an earlier block becomes a CODEC_DUPLICATE record holding
+// the earlier record's archive offset (one extra read when extracting).
+
+const char ARCHIVE_MAGIC[4] = {'B', 'R', 'W', 'A'};
+const uint8_t ARCHIVE_VERSION = 1;
+const size_t ARCHIVE_TRAILER_SIZE = 2 * sizeof(uint64_t) + sizeof(ARCHIVE_MAGIC);
+
+struct Recording {
+    std::string name;
+    WavHeader header;
+    std::vector<int16_t> audioData;
+    bool planes = false; // audioData holds sample planes (see pcm.h)
+};
+
+struct ArchiveEntry {
+    std::string name;
+    uint64_t offset;
+    uint64_t size;
+    uint64_t samples;
+};
+
+struct ArchiveIndex {
+    uint64_t tablesOffset = 0;
+    uint64_t directoryOffset = 0;
+    std::vector<ArchiveEntry> entries;
+};
+
+struct ArchiveStats {
+    EncodeStats encode;
+    size_t sharedTables = 0;
+    size_t sharedTableBytes = 0;
+    size_t directoryBytes = 0;
+    size_t duplicateRecordings = 0;
+    size_t duplicateBlocks = 0;
+    size_t dedupSavedBytes = 0; // encoded bytes not written thanks to dedup
+    size_t hashedBytes = 0;
+    double hashSeconds = 0;
+};
+
+// Content hash -> earlier items with that hash, kept for the whole batch
+template <typename T>
+using DedupIndex = std::unordered_map<uint64_t, std::vector<T>>;
+
+inline bool sameRecording(const Recording &a, const Recording &b) {
+    return memcmp(&a.header, &b.header, sizeof(WavHeader)) == 0 && a.audioData == b.audioData;
+}
+
+inline bool sameBlock(const PreparedBlock &a, const PreparedBlock &b) {
+    return a.sampleCount == b.sampleCount && memcmp(a.samples, b.samples, a.sampleCount * sizeof(int16_t)) == 0;
+}
+
+inline std::vector<uint8_t> buildArchive(const std::vector<Recording> &recordings, const EncodeOptions &options, ArchiveStats &stats) {
+    using Clock = std::chrono::steady_clock;
+
+    // Whole recordings first; copies are not segmented or encoded at all
+    Clock::time_point hashStart = Clock::now();
+    std::vector<uint64_t> recordingHashes(recordings.size());
+    parallelFor(recordings.size(), options.threads, [&](size_t r) {
+        recordingHashes[r] = hashBytes(recordings[r].audioData.data(), recordings[r].audioData.size() * sizeof(int16_t));
+    });
+    stats.hashSeconds += std::chrono::duration<double>(Clock::now() - hashStart).count();
+    std::vector<size_t> original(recordings.size());
+    DedupIndex<size_t> recordingIndex;
+    for (size_t r = 0; r < recordings.size(); ++r) {
+        stats.hashedBytes += recordings[r].audioData.size() * sizeof(int16_t);
+        original[r] = r;
+        std::vector<size_t> &candidates = recordingIndex[recordingHashes[r]];
+        for (size_t c : candidates) {
+            if (sameRecording(recordings[c], recordings[r])) {
+                original[r] = c;
+                break;
+            }
+        }
+        if (original[r] == r) {
+            candidates.push_back(r);
+        } else {
+            stats.duplicateRecordings++;
+        }
+    }
+
+    std::vector<std::vector<Segment>> segments(recordings.size());
+    parallelFor(recordings.size(), options.threads, [&](size_t r) {
+        if (original[r] == r) {
+            segments[r] = chooseBlockSegments(options, recordings[r].audioData);
+        }
+    });
+
+    // One flat job list across recordings, so small recordings still fill
+    // every worker
+    std::vector<std::vector<PreparedBlock>> blocks(recordings.size());
+    std::vector<PreparedBlock*> order;
+    for (size_t r = 0; r < recordings.size(); ++r) {
+        blocks[r].resize(segments[r].size());
+        for (PreparedBlock &block : blocks[r]) order.push_back(&block);
+    }
+    std::vector<std::pair<size_t, size_t>> jobs;
+    for (size_t r = 0; r < recordings.size(); ++r) {
+        for (size_t b = 0; b < segments[r].size(); ++b) {
+            jobs.push_back({r, b});
+            blocks[r][b].samples = recordings[r].audioData.data() + segments[r][b].first;
+            blocks[r][b].sampleCount = segments[r][b].count;
+        }
+    }
+
+    // Then blocks: a block repeating an earlier one (in any recording) is
+    // written as a reference to it
+    hashStart = Clock::now();
+    std::vector<uint64_t> blockHashes(order.size());
+    parallelFor(order.size(), options.threads, [&](size_t b) {
+        blockHashes[b] = hashBytes(order[b]->samples, order[b]->sampleCount * sizeof(int16_t));
+    });
+    stats.hashSeconds += std::chrono::duration<double>(Clock::now() - hashStart).count();
+    DedupIndex<const PreparedBlock*> blockIndex;
+    for (size_t b = 0; b < order.size(); ++b) {
+        PreparedBlock &block = *order[b];
+        stats.hashedBytes += block.sampleCount * sizeof(int16_t);
+        std::vector<const PreparedBlock*> &candidates = blockIndex[blockHashes[b]];
+        for (const PreparedBlock *candidate : candidates) {
+            if (sameBlock(*candidate, block)) {
+                block.duplicateOf = candidate;
+                break;
+            }
+        }
+        if (!block.duplicateOf) {
+            candidates.push_back(&block);
+        } else {
+            block.stats.codec = CODEC_DUPLICATE;
+            block.stats.samples = block.sampleCount;
+            stats.duplicateBlocks++;
+        }
+    }
+
+    parallelFor(jobs.size(), options.threads, [&](size_t j) {
+        size_t r = jobs[j].first, b = jobs[j].second;
+        if (!blocks[r][b].duplicateOf) {
+            blocks[r][b] = prepareBlock(options, blocks[r][b].samples, blocks[r][b].sampleCount);
+        }
+    });
+    std::vector<const EntropyTables*> shared;
+    chooseBlockTables(order, &shared);
+    parallelFor(order.size(), options.threads, [&](size_t b) {
+        finishBlock(*order[b]);
+    });
+
+    std::vector<uint8_t> out(ARCHIVE_MAGIC, ARCHIVE_MAGIC + sizeof(ARCHIVE_MAGIC));
+    out.push_back(ARCHIVE_VERSION);
+    std::vector<ArchiveEntry> entries;
+    for (size_t r = 0; r < recordings.size(); ++r) {
+        if (original[r] != r) {
+            ArchiveEntry entry = entries[original[r]];
+            entry.name = recordings[r].name;
+            entries.push_back(entry);
+            stats.dedupSavedBytes += entry.size;
+            continue;
+        }
+        size_t offset = out.size();
+        writeBrainwireStream(out, recordings[r].header, recordings[r].audioData.size(), blocks[r], recordings[r].planes);
+        entries.push_back({recordings[r].name, offset, out.size() - offset, recordings[r].audioData.size()});
+    }
+    for (const PreparedBlock *block : order) {
+        if (block->duplicateOf && block->duplicateOf->payload.size() > block->payload.size()) {
+            stats.dedupSavedBytes += block->duplicateOf->payload.size() - block->payload.size();
+        }
+    }
+
+    uint64_t tablesOffset = out.size();
+    putVarint(out, shared.size());
+    for (const EntropyTables *tables : shared) {
+        writeEntropyTables(out, *tables);
+    }
+
+    uint64_t directoryOffset = out.size();
+    putVarint(out, entries.size());
+    for (const ArchiveEntry &entry : entries) {
+        putVarint(out, entry.name.size());
+        out.insert(out.end(), entry.name.begin(), entry.name.end());
+        putVarint(out, entry.offset);
+        putVarint(out, entry.size);
+        putVarint(out, entry.samples);
+    }
+    putValue(out, tablesOffset);
+    putValue(out, directoryOffset);
+    out.insert(out.end(), ARCHIVE_MAGIC, ARCHIVE_MAGIC + sizeof(ARCHIVE_MAGIC));
+
+    stats.encode.blocks.clear();
+    for (const PreparedBlock *block : order) stats.encode.blocks.push_back(block->stats);
+    stats.encode.outputBytes = out.size();
+    stats.sharedTables = shared.size();
+    stats.sharedTableBytes = directoryOffset - tablesOffset;
+    stats.directoryBytes = out.size() - directoryOffset;
+    return out;
+}
+
+// Recording names are bare file names (pack stores the input's file name),
+// so one can never point outside the directory it is extracted to
+inline bool safeRecordingName(const std::string &name) {
+    return !name.empty() && name != "." && name != ".." && name.find_first_of(std::string("/\\\0", 3)) == std::string::npos;
+}
+
+inline ArchiveIndex readArchiveIndex(std::ifstream &file) {
+    file.seekg(0, std::ios::end);
+    uint64_t fileSize = static_cast<uint64_t>(file.tellg());
+    if (fileSize < sizeof(ARCHIVE_MAGIC) + 1 + ARCHIVE_TRAILER_SIZE) {
+        fatal("Not a brainwire archive");
+    }
+    std::vector<uint8_t> head = readFileRange(file, 0, sizeof(ARCHIVE_MAGIC) + 1);
+    std::vector<uint8_t> trailer = readFileRange(file, fileSize - ARCHIVE_TRAILER_SIZE, ARCHIVE_TRAILER_SIZE);
+    if (memcmp(head.data(), ARCHIVE_MAGIC, sizeof(ARCHIVE_MAGIC)) != 0 ||
+        memcmp(trailer.data() + 2 * sizeof(uint64_t), ARCHIVE_MAGIC, sizeof(ARCHIVE_MAGIC)) != 0) {
+        fatal("Not a brainwire archive");
+    }
+    if (head[sizeof(ARCHIVE_MAGIC)] != ARCHIVE_VERSION) {
+        fatal("Unsupported archive version " + std::to_string(head[sizeof(ARCHIVE_MAGIC)]));
+    }
+
+    ArchiveIndex index;
+    ByteReader in(trailer.data(), trailer.size());
+    index.tablesOffset = in.value<uint64_t>();
+    index.directoryOffset = in.value<uint64_t>();
+    uint64_t directoryEnd = fileSize - ARCHIVE_TRAILER_SIZE;
+    if (index.tablesOffset > index.directoryOffset || index.directoryOffset > directoryEnd) {
+        fatal("Corrupt archive: bad trailer");
+    }
+
+    std::vector<uint8_t> directory = readFileRange(file, index.directoryOffset, directoryEnd - index.directoryOffset);
+    ByteReader entries(directory.data(), directory.size());
+    uint64_t count = entries.varint();
+    if (count > directory.size()) {
+        fatal("Corrupt archive: bad directory");
+    }
+    for (uint64_t e = 0; e < count; ++e) {
+        ArchiveEntry entry;
+        uint64_t nameLength = entries.varint();
+        const uint8_t *name = entries.bytes(nameLength);
+        entry.name.assign(name, name + nameLength);
+        if (!safeRecordingName(entry.name)) {
+            fatal("Corrupt archive: bad recording name");
+        }
+        entry.offset = entries.varint();
+        entry.size = entries.varint();
+        entry.samples = entries.varint();
+        if (entry.offset > index.tablesOffset || entry.size > index.tablesOffset - entry.offset) {
+            fatal("Corrupt archive: recording outside the stream area");
+        }
+        index.entries.push_back(entry);
+    }
+    return index;
+}
+
+// Decoders for all shared tables, built in parallel
+inline std::vector<std::shared_ptr<const HuffmanDecoder>> readSharedTables(std::ifstream &file, const ArchiveIndex &index, int threads) {
+    std::vector<uint8_t> bytes = readFileRange(file, index.tablesOffset, index.directoryOffset - index.tablesOffset);
+    ByteReader in(bytes.data(), bytes.size());
+    uint64_t count = in.varint();
+    if (count > bytes.size()) {
+        fatal("Corrupt archive: bad shared table count");
+    }
+    std::vector<EntropyTables> tables;
+    for (uint64_t t = 0; t < count; ++t) {
+        tables.push_back(readEntropyTables(in));
+    }
+    std::vector<std::shared_ptr<const HuffmanDecoder>> decoders(count);
+    parallelFor(count, threads, [&](size_t t) {
+        decoders[t] = std::make_shared<const HuffmanDecoder>(buildHuffmanDecoder(tables[t]));
+    });
+    return decoders;
+}
+
+inline void extractRecording(std::ifstream &file, const ArchiveIndex &index, const ArchiveEntry &entry,
+                             const std::vector<std::shared_ptr<const HuffmanDecoder>> &shared,
+                             WavHeader &header, std::vector<int16_t> &audioData, int threads) {
+    std::vector<uint8_t> stream = readFileRange(file, entry.offset, entry.size);
+
+    // Duplicate blocks: read the record they point at (codec byte and two
+    // varints, then the payload)
+    std::vector<std::vector<uint8_t>> originals;
+    DuplicateResolver resolve = [&](uint64_t offset) {
+        const uint64_t maxRecordHead = 1 + 2 * 10;
+        if (offset >= index.tablesOffset) {
+            fatal("Corrupt archive: duplicate block offset out of range");
+        }
+        std::vector<uint8_t> head = readFileRange(file, offset, std::min(maxRecordHead, index.tablesOffset - offset));
+        ByteReader in(head.data(), head.size());
+        in.value<uint8_t>();
+        in.varint();
+        uint64_t size = in.varint();
+        if (size > index.tablesOffset - offset - in.pos) {
+            fatal("Corrupt archive: duplicate block offset out of range");
+        }
+        originals.push_back(readFileRange(file, offset, in.pos + size));
+        ByteReader record(originals.back().data(), originals.back().size());
+        return readBlockRecord(record);
+    };
+    ByteReader in(stream.data(), stream.size());
+    decodeBrainwireStream(in, header, audioData, threads, &shared, &resolve);
+}
+
+#endif
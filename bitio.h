@@ -0,0 +1,80 @@
+#ifndef BRAINWIRE_BITIO_H
+#define BRAINWIRE_BITIO_H
+
+#include <vector>
+#include <cstdint>
+#include <cstring>
+
+// Bit-level I/O for the entropy coded streams. Bits are packed MSB-first so
+// the reader can peek the next few bits as an integer and index a lookup
+// table with them.
+struct BitWriter {
+    std::vector<uint8_t> bytes;
+    uint64_t buffer = 0;
+    int bitCount = 0;
+
+    // Append the low `count` bits of value (count <= 32)
+    void write(uint32_t value, int count) {
+        buffer = (buffer << count) | value;
+        bitCount += count;
+        while (bitCount >= 8) {
+            bitCount -= 8;
+            bytes.push_back(static_cast<uint8_t>(buffer >> bitCount));
+        }
+    }
+
+    // Pad the final partial byte with zero bits
+    void flush() {
+        if (bitCount > 0) {
+            bytes.push_back(static_cast<uint8_t>(buffer << (8 - bitCount)));
+            bitCount = 0;
+        }
+    }
+};
+
+struct BitReader {
+    const uint8_t *next;
+    const uint8_t *end;
+    uint64_t buffer = 0; // left-aligned, bitCount valid bits
+    int bitCount = 0;
+
+    BitReader(const uint8_t *data, size_t size) : next(data), end(data + size) {
+        refill();
+    }
+
+    // Top up the buffer to at least 56 bits. Reading past the end yields
+    // zero bits; callers bound the number of symbols they decode.
+    void refill() {
+        if (end - next >= 8) {
+            uint64_t word;
+            memcpy(&word, next, sizeof(word));
+            buffer |= __builtin_bswap64(word) >> bitCount;
+            next += (63 - bitCount) >> 3;
+            bitCount |= 56;
+        } else {
+            while (bitCount <= 56) {
+                uint64_t byte = next < end ? *next++ : 0;
+                buffer |= byte << (56 - bitCount);
+                bitCount += 8;
+            }
+        }
+    }
+
+    // Next `count` bits without consuming them (1 <= count <= bitCount)
+    uint32_t peek(int count) const {
+        return static_cast<uint32_t>(buffer >> (64 - count));
+    }
+
+    void consume(int count) {
+        buffer <<= count;
+        bitCount -= count;
+    }
+
+    uint32_t read(int count) {
+        uint32_t value = peek(count);
+        consume(count);
+        return value;
+    }
+};
+
+#endif
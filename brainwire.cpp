@@ -0,0 +1,394 @@
+#include <iostream>
+#include <fstream>
+#include <filesystem>
+#include <vector>
+#include <string>
+#include <set>
+#include <mutex>
+#include <chrono>
+#include <cstdint>
+
+#include "common.h"
+#include "wav.h"
+#include "codec.h"
+#include "archive.h"
+#include "container.h"
+#include "edit.h"
+#include "query.h"
+#include "legacy.h"
+#include "cli.h"
+
+// Multi-command tool for working with .brainwire files and archives:
+//
+//   brainwire pack [--stats] [encoder options] <archive> <wav>...
+//   brainwire list <archive>
+//   brainwire unpack [--threads N] <archive> <output_dir> [name]...
+//   brainwire cut [--stats] [encoder options] --range FIRST:LAST <in> <out>
+//   brainwire cat [--stats] <out> <in>...
+//   brainwire query [--threads N] [--above X] [--below X] [--outside X] [--min-rms R] <in>
+//   brainwire features <sidecar>
+//   brainwire transcode [--jobs N] [encoder options] <output_dir> <legacy>...
+
+int usage() {
+    std::cerr << "Usage: brainwire pack [--stats] " << ENCODE_OPTIONS_USAGE << "\n"
+              << "                      <archive> <wav>...\n"
+              << "       brainwire list <archive>\n"
+              << "       brainwire unpack [--threads N] <archive> <output_dir> [name]...\n"
+              << "       brainwire cut [--stats] [encoder options] --range FIRST:LAST <in.brainwire> <out.brainwire>\n"
+              << "       brainwire cat [--stats] <out.brainwire> <in.brainwire>...\n"
+              << "       brainwire query [--threads N] [--above X] [--below X] [--outside X] [--min-rms R] <in.brainwire>\n"
+              << "       brainwire features <sidecar>\n"
+              << "       brainwire transcode [--jobs N] [encoder options] <output_dir> <legacy_file>..." << std::endl;
+    return 1;
+}
+
+int pack(int argc, char* argv[]) {
+    bool showStats = false;
+    EncodeOptions options;
+    std::vector<std::string> paths;
+    for (int i = 2; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--stats") {
+            showStats = true;
+        } else if (!parseEncodeOption(argc, argv, i, options)) {
+            paths.push_back(arg);
+        }
+    }
+    if (paths.size() < 2) {
+        return usage();
+    }
+
+    std::vector<Recording> recordings(paths.size() - 1);
+    std::set<std::string> names;
+    for (size_t r = 0; r < recordings.size(); ++r) {
+        recordings[r].name = std::filesystem::path(paths[r + 1]).filename().string();
+        if (!names.insert(recordings[r].name).second) {
+            fatal("Duplicate recording name: " + recordings[r].name);
+        }
+    }
+    parallelFor(recordings.size(), options.threads, [&](size_t r) {
+        recordings[r].audioData = readWavFile(paths[r + 1], recordings[r].header);
+        if (usesSamplePlanes(recordings[r].header, recordings[r].audioData.size())) {
+            recordings[r].audioData = splitSamplePlanes(recordings[r].header, recordings[r].audioData);
+            recordings[r].planes = true;
+        }
+    });
+
+    ArchiveStats stats;
+    std::vector<uint8_t> archive = buildArchive(recordings, options, stats);
+    writeFileBytes(paths[0], archive);
+
+    if (showStats) {
+        size_t sampleCount = 0;
+        for (const Recording &recording : recordings) sampleCount += recording.audioData.size();
+        printStats(stats.encode, sampleCount);
+        std::cout << "Recordings: " << recordings.size() << ", shared tables " << stats.sharedTables << " (" << stats.sharedTableBytes
+                  << " bytes), directory " << stats.directoryBytes << " bytes" << std::endl;
+        std::cout << "Dedup: " << stats.duplicateRecordings << " duplicate recordings, " << stats.duplicateBlocks << " duplicate blocks, "
+                  << stats.dedupSavedBytes << " bytes saved; hashed " << stats.hashedBytes << " bytes";
+        if (stats.hashSeconds > 0) {
+            std::cout << " at " << stats.hashedBytes / stats.hashSeconds / 1e6 << " MB/s";
+        }
+        std::cout << std::endl;
+    }
+    std::cout << "Packed " << recordings.size() << " recordings." << std::endl;
+    return 0;
+}
+
+int list(int argc, char* argv[]) {
+    if (argc != 3) {
+        return usage();
+    }
+    std::ifstream file(argv[2], std::ios::binary);
+    if (!file) {
+        fatal(std::string("Error opening file: ") + argv[2]);
+    }
+    ArchiveIndex index = readArchiveIndex(file);
+    for (const ArchiveEntry &entry : index.entries) {
+        std::cout << entry.name << "\t" << entry.samples << " samples\t" << entry.size << " bytes" << std::endl;
+    }
+    return 0;
+}
+
+int unpack(int argc, char* argv[]) {
+    int threads = defaultThreadCount();
+    std::vector<std::string> paths;
+    for (int i = 2; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--threads" && i + 1 < argc) {
+            threads = std::stoi(argv[++i]);
+        } else {
+            paths.push_back(arg);
+        }
+    }
+    if (paths.size() < 2) {
+        return usage();
+    }
+
+    std::ifstream file(paths[0], std::ios::binary);
+    if (!file) {
+        fatal("Error opening file: " + paths[0]);
+    }
+    ArchiveIndex index = readArchiveIndex(file);
+    std::vector<std::shared_ptr<const HuffmanDecoder>> shared = readSharedTables(file, index, threads);
+
+    std::vector<const ArchiveEntry*> selected;
+    std::set<std::string> wanted(paths.begin() + 2, paths.end());
+    bool all = wanted.empty();
+    for (const ArchiveEntry &entry : index.entries) {
+        if (all || wanted.erase(entry.name)) selected.push_back(&entry);
+    }
+    if (!wanted.empty()) {
+        fatal("No recording named " + *wanted.begin() + " in " + paths[0]);
+    }
+
+    // One recording per worker, each with its own file handle. Names are
+    // checked when the directory is read; the joined path is checked again
+    // so nothing is written outside the output directory.
+    std::error_code error;
+    std::filesystem::create_directories(paths[1], error);
+    if (error) {
+        fatal("Cannot create output directory " + paths[1] + ": " + error.message());
+    }
+    std::filesystem::path directory = std::filesystem::absolute(paths[1]).lexically_normal();
+    if (directory.filename().empty()) {
+        directory = directory.parent_path(); // "out/" names "out"
+    }
+    std::vector<std::filesystem::path> outputs;
+    for (const ArchiveEntry *entry : selected) {
+        std::filesystem::path output = (directory / entry->name).lexically_normal();
+        if (output.parent_path() != directory || output.filename() != entry->name) {
+            fatal("Recording name escapes the output directory: " + entry->name);
+        }
+        outputs.push_back(output);
+    }
+    parallelFor(selected.size(), threads, [&](size_t s) {
+        std::ifstream worker(paths[0], std::ios::binary);
+        WavHeader header;
+        std::vector<int16_t> audioData;
+        extractRecording(worker, index, *selected[s], shared, header, audioData, 1);
+        saveWavFile(outputs[s].string(), header, audioData);
+    });
+    std::cout << "Extracted " << selected.size() << " recordings." << std::endl;
+    return 0;
+}
+
+void printEditStats(const EditStats &stats) {
+    std::cout << "Copied " << stats.copiedBlocks << " blocks (" << stats.copiedBytes << " bytes), re-encoded " << stats.reencodedBlocks
+              << " blocks (" << stats.reencodedSamples << " samples); " << stats.relinkedTables << " table references renumbered, "
+              << stats.inlinedTables << " tables inlined" << std::endl;
+}
+
+// Samples [FIRST, LAST) of one file; LAST may be left out for the end
+int cut(int argc, char* argv[]) {
+    bool showStats = false;
+    std::string range;
+    EncodeOptions options;
+    std::vector<std::string> paths;
+    for (int i = 2; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--stats") {
+            showStats = true;
+        } else if (arg == "--range" && i + 1 < argc) {
+            range = argv[++i];
+        } else if (!parseEncodeOption(argc, argv, i, options)) {
+            paths.push_back(arg);
+        }
+    }
+    size_t colon = range.find(':');
+    if (paths.size() != 2 || colon == std::string::npos) {
+        return usage();
+    }
+
+    BrainwireSource source = openBrainwireSource(paths[0]);
+    uint64_t first = std::stoull(range.substr(0, colon));
+    uint64_t last = colon + 1 < range.size() ? std::stoull(range.substr(colon + 1)) : source.index.sampleCount;
+    EditStats stats;
+    writeFileBytes(paths[1], cutBrainwire(source, first, last, options, stats));
+    if (showStats) {
+        printEditStats(stats);
+    }
+    std::cout << "Cut " << last - first << " samples." << std::endl;
+    return 0;
+}
+
+int cat(int argc, char* argv[]) {
+    bool showStats = false;
+    std::vector<std::string> paths;
+    for (int i = 2; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--stats") {
+            showStats = true;
+        } else {
+            paths.push_back(arg);
+        }
+    }
+    if (paths.size() < 2) {
+        return usage();
+    }
+
+    std::vector<BrainwireSource> sources;
+    for (size_t p = 1; p < paths.size(); ++p) sources.push_back(openBrainwireSource(paths[p]));
+    EditStats stats;
+    writeFileBytes(paths[0], concatBrainwire(sources, stats));
+    if (showStats) {
+        printEditStats(stats);
+    }
+    std::cout << "Concatenated " << sources.size() << " recordings." << std::endl;
+    return 0;
+}
+
+// Print the sample ranges beyond the thresholds (raw sample units);
+// --outside X is --above X --below -X
+int query(int argc, char* argv[]) {
+    int threads = defaultThreadCount();
+    ZoneQuery query;
+    std::vector<std::string> paths;
+    for (int i = 2; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--threads" && i + 1 < argc) {
+            threads = std::stoi(argv[++i]);
+        } else if (arg == "--above" && i + 1 < argc) {
+            query.above = std::stoi(argv[++i]);
+        } else if (arg == "--below" && i + 1 < argc) {
+            query.below = std::stoi(argv[++i]);
+        } else if (arg == "--outside" && i + 1 < argc) {
+            query.above = std::stoi(argv[++i]);
+            query.below = -query.above;
+        } else if (arg == "--min-rms" && i + 1 < argc) {
+            query.minRms = static_cast<uint32_t>(std::stoul(argv[++i]));
+        } else {
+            paths.push_back(arg);
+        }
+    }
+    if (paths.size() != 1) {
+        return usage();
+    }
+
+    BrainwireSource source = openBrainwireSource(paths[0]);
+    QueryStats stats;
+    for (const QueryMatch &match : queryBrainwire(source, query, threads, stats)) {
+        std::cout << match.first << "\t" << match.last << "\t" << match.peak << std::endl;
+    }
+    std::cerr << "Skipped " << stats.skippedBlocks << " of " << stats.blocks << " blocks (" << stats.skippedSamples << " of "
+              << stats.samples << " samples, " << stats.skippedBytes << " of " << stats.bytes << " bytes)" << std::endl;
+    return 0;
+}
+
+// A feature sidecar as a table: window start, band powers, crossing counts
+int features(int argc, char* argv[]) {
+    if (argc != 3) {
+        return usage();
+    }
+    FeatureSet features = readFeatureSidecar(readFileBytes(argv[2]));
+    const FeatureOptions &options = features.options;
+    std::cout << "first_sample";
+    for (const auto &band : options.bands) std::cout << "\tpower_" << band.first << "_" << band.second << "Hz";
+    for (int16_t threshold : options.thresholds) std::cout << "\tcrossings_" << threshold;
+    std::cout << std::endl;
+    for (size_t w = 0; w < features.windowCount(); ++w) {
+        std::cout << w * options.window;
+        for (size_t b = 0; b < options.bands.size(); ++b) std::cout << "\t" << features.power[w * options.bands.size() + b];
+        for (size_t t = 0; t < options.thresholds.size(); ++t) std::cout << "\t" << features.crossings[w * options.thresholds.size() + t];
+        std::cout << std::endl;
+    }
+    return 0;
+}
+
+// Samples a transcode job decodes and encodes at a time
+const size_t TRANSCODE_CHUNK_SAMPLES = 1 << 20;
+
+// Re-encode files from before the container (see legacy.h) as .brainwire
+// files, streaming each through the legacy decoder into the encoder a
+// chunk at a time so memory stays bounded whatever the file size. Files are
+// spread over --jobs workers (default: one per thread), the encoder's
+// threads split among them.
+int transcode(int argc, char* argv[]) {
+    EncodeOptions options;
+    int jobs = 0;
+    std::vector<std::string> paths;
+    for (int i = 2; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--jobs" && i + 1 < argc) {
+            jobs = std::stoi(argv[++i]);
+        } else if (!parseEncodeOption(argc, argv, i, options)) {
+            paths.push_back(arg);
+        }
+    }
+    if (paths.size() < 2) {
+        return usage();
+    }
+
+    std::vector<std::string> inputs(paths.begin() + 1, paths.end());
+    std::vector<std::string> outputs;
+    std::set<std::string> names;
+    for (const std::string &input : inputs) {
+        std::string name = std::filesystem::path(input).stem().string() + ".brainwire";
+        if (!names.insert(name).second) {
+            fatal("Duplicate output name: " + name);
+        }
+        outputs.push_back((std::filesystem::path(paths[0]) / name).string());
+    }
+    if (jobs <= 0) {
+        jobs = static_cast<int>(std::min<size_t>(inputs.size(), static_cast<size_t>(options.threads)));
+    }
+    EncodeOptions jobOptions = options;
+    jobOptions.threads = std::max(1, options.threads / jobs);
+
+    using Clock = std::chrono::steady_clock;
+    Clock::time_point start = Clock::now();
+    std::error_code error;
+    std::filesystem::create_directories(paths[0], error);
+    if (error) {
+        fatal("Cannot create output directory " + paths[0] + ": " + error.message());
+    }
+    std::mutex reportLock;
+    uint64_t totalSamples = 0, totalInput = 0, totalOutput = 0;
+    parallelFor(inputs.size(), jobs, [&](size_t f) {
+        LegacyReader reader;
+        openLegacyReader(reader, inputs[f]);
+        BrainwireWriter writer;
+        openBrainwireWriter(writer, outputs[f], reader.stream.header, jobOptions);
+        std::vector<int16_t> chunk(TRANSCODE_CHUNK_SAMPLES);
+        while (size_t count = readLegacySamples(reader, chunk.data(), chunk.size())) {
+            chunk.resize(count); // short only at the end
+            writeBrainwireSamples(writer, chunk);
+        }
+        closeBrainwireWriter(writer);
+
+        std::error_code sizeError;
+        uint64_t inputBytes = std::filesystem::file_size(inputs[f], sizeError);
+        if (sizeError) {
+            fatal("Cannot read the size of " + inputs[f] + ": " + sizeError.message());
+        }
+        std::lock_guard<std::mutex> lock(reportLock);
+        totalSamples += reader.samples;
+        totalInput += inputBytes;
+        totalOutput += writer.stats.outputBytes;
+        std::cout << inputs[f] << " -> " << outputs[f] << ": " << reader.samples << " samples, " << inputBytes << " -> "
+                  << writer.stats.outputBytes << " bytes" << std::endl;
+    });
+
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    std::cout << "Transcoded " << inputs.size() << " files, " << totalSamples << " samples: " << totalInput << " -> " << totalOutput
+              << " bytes (" << (totalOutput > 0 ? static_cast<double>(totalInput) / totalOutput : 0.0) << "x smaller) in " << seconds
+              << " s, " << (seconds > 0 ? totalSamples * sizeof(int16_t) / seconds / 1e6 : 0.0) << " MB/s of samples, "
+              << (seconds > 0 ? inputs.size() / seconds : 0.0) << " files/s with " << jobs << " jobs" << std::endl;
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        return usage();
+    }
+    std::string command = argv[1];
+    if (command == "pack") return pack(argc, argv);
+    if (command == "list") return list(argc, argv);
+    if (command == "unpack") return unpack(argc, argv);
+    if (command == "cut") return cut(argc, argv);
+    if (command == "cat") return cat(argc, argv);
+    if (command == "query") return query(argc, argv);
+    if (command == "features") return features(argc, argv);
+    if (command == "transcode") return transcode(argc, argv);
+    return usage();
+}
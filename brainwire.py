@@ -0,0 +1,220 @@
+"""Python binding for the brainwire codec (libbrainwire.h), standard library only.
+
+Build the library next to this file (or point BRAINWIRE_LIB at it):
+
+    g++ -O2 -std=c++17 -pthread -shared -fPIC -fvisibility=hidden libbrainwire.cpp -o libbrainwire.so
+
+Samples are decoded by the library straight into the array that is returned
+(a NumPy array if NumPy is installed, else an array.array), or into any
+writable buffer passed as `out`, such as a preallocated NumPy array: no
+temporary file and no intermediate copy. ctypes releases the GIL for every
+library call, so a multi-threaded decode runs while other Python threads do.
+
+    import brainwire
+    samples = brainwire.decode("recording.brainwire", dtype="float32", scale=0.195)
+    with brainwire.Reader("recording.brainwire") as reader:
+        reader.seek(30000)
+        chunk = reader.read(4096)
+"""
+
+import array
+import ctypes
+import os
+
+try:
+    import numpy
+except ImportError:
+    numpy = None
+
+API_VERSION = 1
+
+# dtype: (library format, array.array type code, bytes per sample)
+_FORMATS = {"int16": (0, "h", 2), "int32": (1, "i", 4), "float32": (2, "f", 4)}
+_CODECS = {"huffman": 1, "cm": 2}
+
+
+class BrainwireError(Exception):
+    pass
+
+
+class _Info(ctypes.Structure):
+    _fields_ = [
+        ("sample_count", ctypes.c_uint64),
+        ("sample_rate", ctypes.c_uint32),
+        ("channels", ctypes.c_uint16),
+        ("bits_per_sample", ctypes.c_uint16),
+    ]
+
+
+def _load():
+    path = os.environ.get("BRAINWIRE_LIB") or os.path.join(os.path.dirname(os.path.abspath(__file__)), "libbrainwire.so")
+    lib = ctypes.CDLL(path)
+    signatures = {
+        "brainwire_api_version": (ctypes.c_int, []),
+        "brainwire_last_error": (ctypes.c_char_p, []),
+        "brainwire_info_buffer": (ctypes.c_int, [ctypes.c_void_p, ctypes.c_size_t, ctypes.POINTER(_Info)]),
+        "brainwire_info_file": (ctypes.c_int, [ctypes.c_char_p, ctypes.POINTER(_Info)]),
+        "brainwire_decode_buffer": (ctypes.c_int, [ctypes.c_void_p, ctypes.c_size_t, ctypes.c_int, ctypes.c_float, ctypes.c_int,
+                                                   ctypes.c_void_p, ctypes.c_size_t, ctypes.c_int]),
+        "brainwire_decode_file": (ctypes.c_int, [ctypes.c_char_p, ctypes.c_int, ctypes.c_float, ctypes.c_int,
+                                                 ctypes.c_void_p, ctypes.c_size_t, ctypes.c_int]),
+        "brainwire_encode_file": (ctypes.c_int, [ctypes.c_void_p, ctypes.c_uint64, ctypes.c_uint32, ctypes.c_uint16, ctypes.c_int,
+                                                 ctypes.c_int, ctypes.c_int, ctypes.c_char_p]),
+        "brainwire_open": (ctypes.c_void_p, [ctypes.c_char_p, ctypes.c_int]),
+        "brainwire_open_buffer": (ctypes.c_void_p, [ctypes.c_void_p, ctypes.c_size_t, ctypes.c_int]),
+        "brainwire_reader_info": (ctypes.c_int, [ctypes.c_void_p, ctypes.POINTER(_Info)]),
+        "brainwire_read": (ctypes.c_int64, [ctypes.c_void_p, ctypes.c_int, ctypes.c_float, ctypes.c_void_p, ctypes.c_uint64]),
+        "brainwire_seek": (ctypes.c_int, [ctypes.c_void_p, ctypes.c_uint64]),
+        "brainwire_tell": (ctypes.c_uint64, [ctypes.c_void_p]),
+        "brainwire_close": (None, [ctypes.c_void_p]),
+    }
+    for name, (restype, argtypes) in signatures.items():
+        function = getattr(lib, name)
+        function.restype = restype
+        function.argtypes = argtypes
+    if lib.brainwire_api_version() != API_VERSION:
+        raise BrainwireError("libbrainwire API version %d, expected %d" % (lib.brainwire_api_version(), API_VERSION))
+    return lib
+
+
+_lib = _load()
+
+
+def _check(status):
+    if status < 0:
+        raise BrainwireError(_lib.brainwire_last_error().decode("utf-8", "replace"))
+    return status
+
+
+def _path(path):
+    return os.fsencode(path)
+
+
+class _Buffer:
+    """Address and size of a buffer, without copying it. Read-only buffers
+    other than bytes are copied once, since ctypes cannot point into them."""
+
+    def __init__(self, data, writable=False):
+        view = memoryview(data)
+        if not view.c_contiguous:
+            raise BrainwireError("buffer must be contiguous")
+        self.size = view.nbytes
+        if isinstance(data, bytes) and not writable:
+            self.keep = data
+            self.address = ctypes.cast(ctypes.c_char_p(data), ctypes.c_void_p).value
+        elif not view.readonly:
+            self.keep = (ctypes.c_char * self.size).from_buffer(view.cast("B"))
+            self.address = ctypes.addressof(self.keep)
+        elif writable:
+            raise BrainwireError("output buffer is read-only")
+        else:
+            self.keep = ctypes.create_string_buffer(view.tobytes(), self.size)
+            self.address = ctypes.addressof(self.keep)
+
+
+def _new_array(dtype, count):
+    if numpy is not None:
+        return numpy.empty(count, dtype=dtype)
+    return array.array(_FORMATS[dtype][1], bytes(count * _FORMATS[dtype][2]))
+
+
+def _shape(samples, channels, planar):
+    if numpy is not None and isinstance(samples, numpy.ndarray) and channels > 1 and samples.ndim == 1:
+        return samples.reshape((channels, -1) if planar else (-1, channels))
+    return samples
+
+
+def info(source):
+    """sample_count (all channels), sample_rate, channels, bits_per_sample of
+    a .brainwire path or bytes-like object"""
+    result = _Info()
+    if isinstance(source, (str, os.PathLike)):
+        _check(_lib.brainwire_info_file(_path(source), ctypes.byref(result)))
+    else:
+        buffer = _Buffer(source)
+        _check(_lib.brainwire_info_buffer(buffer.address, buffer.size, ctypes.byref(result)))
+    return {name: getattr(result, name) for name, _ in _Info._fields_}
+
+
+def decode(source, dtype="int16", scale=1.0, planar=False, threads=0, out=None):
+    """Decode a .brainwire path or bytes-like object. Multi-channel results are
+    shaped (frames, channels), or (channels, frames) if planar, when NumPy is
+    available. `out` may be any writable buffer of the right size."""
+    if dtype not in _FORMATS:
+        raise BrainwireError("dtype must be one of " + ", ".join(_FORMATS))
+    details = info(source)
+    if out is None:
+        out = _new_array(dtype, details["sample_count"])
+    target = _Buffer(out, writable=True)
+    code = _FORMATS[dtype][0]
+    if isinstance(source, (str, os.PathLike)):
+        _check(_lib.brainwire_decode_file(_path(source), code, scale, int(planar), target.address, target.size, threads))
+    else:
+        buffer = _Buffer(source)
+        _check(_lib.brainwire_decode_buffer(buffer.address, buffer.size, code, scale, int(planar), target.address, target.size, threads))
+    return _shape(out, details["channels"], planar)
+
+
+def encode(samples, path, sample_rate, channels=1, codec="huffman", level=5, threads=0):
+    """Encode interleaved int16 samples (any buffer of them) to a .brainwire file"""
+    buffer = _Buffer(samples)
+    if buffer.size % 2:
+        raise BrainwireError("samples must be 16-bit")
+    _check(_lib.brainwire_encode_file(buffer.address, buffer.size // 2, sample_rate, channels, _CODECS[codec], level, threads, _path(path)))
+
+
+class Reader:
+    """Pull-based decoding of a .brainwire path or bytes-like object in
+    chunks, with seek; holds only one block per thread decoded at a time."""
+
+    def __init__(self, source, threads=0):
+        if isinstance(source, (str, os.PathLike)):
+            self._source = None
+            self._handle = _lib.brainwire_open(_path(source), threads)
+        else:
+            self._source = _Buffer(source)  # must outlive the reader
+            self._handle = _lib.brainwire_open_buffer(self._source.address, self._source.size, threads)
+        if not self._handle:
+            _check(-1)
+        result = _Info()
+        _lib.brainwire_reader_info(self._handle, ctypes.byref(result))
+        self.info = {name: getattr(result, name) for name, _ in _Info._fields_}
+
+    def read(self, count, dtype="int16", scale=1.0, out=None):
+        """Up to `count` interleaved samples; fewer only at the end"""
+        if out is None:
+            out = _new_array(dtype, count)
+        target = _Buffer(out, writable=True)
+        if dtype not in _FORMATS:
+            raise BrainwireError("dtype must be one of " + ", ".join(_FORMATS))
+        if target.size < count * _FORMATS[dtype][2]:
+            raise BrainwireError("output buffer too small")
+        got = _check(_lib.brainwire_read(self._handle, _FORMATS[dtype][0], scale, target.address, count))
+        return out[:got] if got < count else out
+
+    def seek(self, sample):
+        _check(_lib.brainwire_seek(self._handle, sample))
+
+    def tell(self):
+        return _lib.brainwire_tell(self._handle)
+
+    def chunks(self, size=1 << 16, dtype="int16", scale=1.0):
+        while True:
+            chunk = self.read(size, dtype, scale)
+            if len(chunk) == 0:
+                return
+            yield chunk
+
+    def close(self):
+        if self._handle:
+            _lib.brainwire_close(self._handle)
+            self._handle = None
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exc):
+        self.close()
+
+    def __del__(self):
+        self.close()
@@ -0,0 +1,147 @@
+#ifndef BRAINWIRE_CLI_H
+#define BRAINWIRE_CLI_H
+
+#include <iostream>
+#include <string>
+#include <map>
+#include <cstdint>
+
+#include "codec.h"
+#include "sidecar.h"
+
+// Command-line pieces shared by the encoder and the brainwire tool
+
+// Parse one encoder option at argv[i] (advancing i past its value).
+// Returns false if argv[i] is not an encoder option.
+inline bool parseEncodeOption(int argc, char* argv[], int &i, EncodeOptions &options) {
+    std::string arg = argv[i];
+    if (arg == "--codec" && i + 1 < argc) {
+        std::string codec = argv[++i];
+        if (codec == "huffman") {
+            options.codec = CODEC_HUFFMAN;
+        } else if (codec == "cm") {
+            options.codec = CODEC_CM;
+        } else {
+            fatal("Unknown codec: " + codec);
+        }
+    } else if (arg == "--level" && i + 1 < argc) {
+        options.level = std::stoi(argv[++i]);
+    } else if (arg == "--block-size" && i + 1 < argc) {
+        options.blockSize = std::stoul(argv[++i]);
+    } else if (arg == "--threads" && i + 1 < argc) {
+        options.threads = std::stoi(argv[++i]);
+    } else if (arg == "--spike-templates") {
+        options.spikeTemplates = true;
+    } else if (arg == "--template-budget" && i + 1 < argc) {
+        options.templateBudget = std::stoi(argv[++i]);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// Parse one feature sidecar option (see sidecar.h). The first --feature-band
+// replaces the default band.
+inline bool parseFeatureOption(int argc, char* argv[], int &i, FeatureOptions &options, std::string &path) {
+    std::string arg = argv[i];
+    if (arg == "--features" && i + 1 < argc) {
+        path = argv[++i];
+    } else if (arg == "--feature-window" && i + 1 < argc) {
+        options.window = std::stoul(argv[++i]);
+    } else if (arg == "--feature-band" && i + 1 < argc) {
+        std::string band = argv[++i];
+        size_t colon = band.find(':');
+        if (colon == std::string::npos) {
+            fatal("Feature band must be LOW:HIGH in Hz: " + band);
+        }
+        if (options.bands == FeatureOptions().bands) options.bands.clear();
+        options.bands.push_back({static_cast<uint32_t>(std::stoul(band.substr(0, colon))), static_cast<uint32_t>(std::stoul(band.substr(colon + 1)))});
+    } else if (arg == "--feature-threshold" && i + 1 < argc) {
+        int threshold = std::stoi(argv[++i]);
+        if (threshold < INT16_MIN || threshold > INT16_MAX) {
+            fatal("Feature threshold out of range: " + std::to_string(threshold));
+        }
+        options.thresholds.push_back(static_cast<int16_t>(threshold));
+    } else {
+        return false;
+    }
+    return true;
+}
+
+const char FEATURE_OPTIONS_USAGE[] = "[--features <sidecar> [--feature-window N] [--feature-band LOW:HIGH]...\n"
+                                     "       [--feature-threshold T]...]";
+
+const char ENCODE_OPTIONS_USAGE[] = "[--codec huffman|cm] [--level 0-9] [--block-size N] [--threads N]\n"
+                                    "       [--spike-templates] [--template-budget N]";
+
+inline void printStats(const EncodeStats &stats, size_t sampleCount) {
+    std::map<uint8_t, BlockStats> byCodec;
+    for (const BlockStats &block : stats.blocks) {
+        BlockStats &total = byCodec[block.codec];
+        total.samples += block.samples;
+        total.bytes += block.bytes;
+        total.tableBytes += block.tableBytes;
+        total.contextCount = std::max(total.contextCount, block.contextCount);
+        total.spikes.spikes += block.spikes.spikes;
+        total.spikes.matched += block.spikes.matched;
+        total.spikes.comparisons += block.spikes.comparisons;
+    }
+
+    int minOrder = MAX_LPC_ORDER, maxOrder = 0;
+    size_t mappedBlocks = 0, runs = 0, runSamples = 0, reusedTables = 0, tableBlocks = 0, maxTableBytes = 0;
+    for (const BlockStats &block : stats.blocks) {
+        reusedTables += block.tableReused ? 1 : 0;
+        tableBlocks += block.tableBytes > 0 ? 1 : 0;
+        maxTableBytes = std::max(maxTableBytes, block.tableBytes);
+        minOrder = std::min(minOrder, block.lpcOrder);
+        maxOrder = std::max(maxOrder, block.lpcOrder);
+        mappedBlocks += block.valueMap ? 1 : 0;
+        runs += block.runs;
+        runSamples += block.runSamples;
+    }
+
+    std::cout << "Samples: " << sampleCount << " in " << stats.blocks.size() << " blocks" << std::endl;
+    if (!stats.blocks.empty()) {
+        // Block sizes in order, with repeats collapsed ("4096x3")
+        std::cout << "Block sizes:";
+        for (size_t b = 0; b < stats.blocks.size();) {
+            size_t repeat = 1;
+            while (b + repeat < stats.blocks.size() && stats.blocks[b + repeat].samples == stats.blocks[b].samples) repeat++;
+            std::cout << " " << stats.blocks[b].samples;
+            if (repeat > 1) std::cout << "x" << repeat;
+            b += repeat;
+        }
+        std::cout << std::endl;
+    }
+    if (!stats.blocks.empty()) {
+        std::cout << "LPC order " << minOrder << "-" << maxOrder << ", value map in " << mappedBlocks << " blocks" << std::endl;
+    }
+    if (runs > 0) {
+        std::cout << "Runs: " << runs << " covering " << runSamples << " samples" << std::endl;
+    }
+    for (const auto &pair : byCodec) {
+        const BlockStats &total = pair.second;
+        std::cout << codecName(pair.first) << ": " << total.samples << " samples, " << total.bytes << " bytes";
+        if (total.samples > 0) {
+            std::cout << " (" << total.bytes * 8.0 / total.samples << " bits/sample)";
+        }
+        if (pair.first == CODEC_HUFFMAN) {
+            std::cout << ", table bytes " << total.tableBytes;
+            if (tableBlocks > 0) {
+                std::cout << " (" << total.tableBytes / tableBlocks << " per block, max " << maxTableBytes << ")";
+            }
+            std::cout << ", up to " << total.contextCount << " contexts, tables reused in " << reusedTables << " blocks";
+        }
+        std::cout << std::endl;
+        if (total.spikes.spikes > 0) {
+            std::cout << "  spikes " << total.spikes.spikes << ", matched templates " << total.spikes.matched
+                      << ", comparisons " << total.spikes.comparisons << std::endl;
+        }
+    }
+    if (stats.previewBytes > 0) {
+        std::cout << "Preview layer: " << stats.previewBytes << " bytes" << std::endl;
+    }
+    std::cout << "Output bytes: " << stats.outputBytes << std::endl;
+}
+
+#endif
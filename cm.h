@@ -0,0 +1,285 @@
+#ifndef BRAINWIRE_CM_H
+#define BRAINWIRE_CM_H
+
+#include <vector>
+#include <cstdint>
+#include <cstdlib>
+
+#include "common.h"
+#include "huffman.h"
+
+// Archival codec: adaptive binary arithmetic coding with context mixing.
+//
+// Each residual is binarized into a zero flag, a sign, its bit length in
+// unary and the mantissa bits MSB-first. Every binary decision is predicted
+// by several context models (previous residuals, local activity, distance
+// from the last spike), and their predictions are combined in the logistic
+// domain by an online-trained mixer. This is several times slower than the
+// Huffman codec and only meant for cold storage.
+
+const int CM_MODELS = 6;
+const int CM_INPUTS = CM_MODELS + 1; // plus a bias input
+const int CM_TABLE_BITS = 18;
+const int CM_MIXER_SETS = 40;
+const int CM_COUNTER_LIMIT = 255;
+
+// Logistic helpers over 12-bit probabilities. squash() interpolates a fixed
+// integer table and stretch() inverts it, so the encoder and decoder agree
+// bit for bit on every platform.
+inline int squash(int d) {
+    static const int table[33] = {
+        1, 2, 3, 6, 10, 16, 27, 45, 73, 120, 194, 310, 488, 747, 1101, 1546,
+        2047, 2549, 2994, 3348, 3607, 3785, 3901, 3975, 4024, 4050, 4068, 4079,
+        4085, 4089, 4092, 4093, 4094
+    };
+    if (d > 2047) return 4095;
+    if (d < -2047) return 1;
+    int w = d & 127;
+    d = (d >> 7) + 16;
+    return (table[d] * (128 - w) + table[d + 1] * w + 64) >> 7;
+}
+
+struct StretchTable {
+    int16_t table[4096];
+
+    StretchTable() {
+        int next = 0;
+        for (int x = -2047; x <= 2047; ++x) {
+            int p = squash(x);
+            for (int i = next; i <= p; ++i) table[i] = static_cast<int16_t>(x);
+            next = p + 1;
+        }
+        for (int i = next; i < 4096; ++i) table[i] = 2047;
+    }
+};
+
+inline int stretch(int p) {
+    static const StretchTable stretchTable;
+    return stretchTable.table[p];
+}
+
+// Adaptive probability: 22-bit probability of a one in the high bits and a
+// hit count in the low 10 bits. The learning rate starts at 1/1.5 and
+// decays to 1/limit, so short blocks adapt quickly.
+struct CounterRates {
+    int32_t reciprocal[1024];
+
+    CounterRates() {
+        for (int n = 0; n < 1024; ++n) reciprocal[n] = 65536 * 2 / (2 * n + 3);
+    }
+};
+
+inline int counterP(uint32_t slot) {
+    return slot >> 20;
+}
+
+inline void counterUpdate(uint32_t &slot, int bit, int limit) {
+    static const CounterRates rates;
+    int n = slot & 1023;
+    int64_t p = slot >> 10;
+    int64_t target = bit ? (1 << 22) - 1 : 0;
+    p += ((target - p) * rates.reciprocal[n]) >> 16;
+    if (n < limit) n++;
+    slot = static_cast<uint32_t>(p << 10) | n;
+}
+
+// Carry-less binary arithmetic coder with 12-bit probabilities
+struct ArithmeticEncoder {
+    std::vector<uint8_t> &out;
+    uint32_t x1 = 0;
+    uint32_t x2 = 0xFFFFFFFF;
+
+    explicit ArithmeticEncoder(std::vector<uint8_t> &out) : out(out) {}
+
+    int code(int bit, int p) {
+        uint32_t xmid = x1 + static_cast<uint32_t>((static_cast<uint64_t>(x2 - x1) * p) >> 12);
+        if (bit) x2 = xmid; else x1 = xmid + 1;
+        while (((x1 ^ x2) & 0xFF000000) == 0) {
+            out.push_back(static_cast<uint8_t>(x2 >> 24));
+            x1 <<= 8;
+            x2 = (x2 << 8) | 255;
+        }
+        return bit;
+    }
+
+    void flush() {
+        for (int i = 0; i < 4; ++i) {
+            out.push_back(static_cast<uint8_t>(x1 >> 24));
+            x1 <<= 8;
+        }
+    }
+};
+
+struct ArithmeticDecoder {
+    const uint8_t *next;
+    const uint8_t *end;
+    uint32_t x1 = 0;
+    uint32_t x2 = 0xFFFFFFFF;
+    uint32_t x = 0;
+
+    ArithmeticDecoder(const uint8_t *data, size_t size) : next(data), end(data + size) {
+        for (int i = 0; i < 4; ++i) x = (x << 8) | nextByte();
+    }
+
+    uint8_t nextByte() {
+        return next < end ? *next++ : 0;
+    }
+
+    int code(int, int p) {
+        uint32_t xmid = x1 + static_cast<uint32_t>((static_cast<uint64_t>(x2 - x1) * p) >> 12);
+        int bit = x <= xmid;
+        if (bit) x2 = xmid; else x1 = xmid + 1;
+        while (((x1 ^ x2) & 0xFF000000) == 0) {
+            x1 <<= 8;
+            x2 = (x2 << 8) | 255;
+            x = (x << 8) | nextByte();
+        }
+        return bit;
+    }
+};
+
+inline uint32_t hashContext(uint32_t a, uint32_t b) {
+    uint32_t h = a * 0x9E3779B1u ^ b * 0x85EBCA77u;
+    return h ^ (h >> 15);
+}
+
+// Context models and mixer for one block. The decoder replays exactly the
+// same sequence of predict/update calls as the encoder.
+class ResidualModel {
+public:
+    ResidualModel()
+        : tables(CM_MODELS, std::vector<uint32_t>(1u << CM_TABLE_BITS, 1u << 31)),
+          weights(CM_MIXER_SETS * CM_INPUTS, (1 << 16) / 4) {}
+
+    // Derive this sample's context hashes from the residual history
+    void beginSample() {
+        int b1 = bitLength(std::abs(r1));
+        int b2 = bitLength(std::abs(r2));
+        int activityBits = bitLength(activity >> 4);
+        int spikeAge = sinceSpike < 8 ? sinceSpike : 8 + bitLength(sinceSpike >> 3);
+        contexts[0] = 0;
+        contexts[1] = hashContext(1, b1 << 1 | (r1 < 0));
+        contexts[2] = hashContext(2, b1 << 5 | b2);
+        contexts[3] = hashContext(3, activityBits << 5 | spikeAge);
+        contexts[4] = hashContext(4, static_cast<uint16_t>(r1));
+        contexts[5] = hashContext(hashContext(5, static_cast<uint16_t>(r1)), static_cast<uint16_t>(r2));
+    }
+
+    // Probability (12-bit) that the next decision is a one
+    int predict(uint32_t node, int mixerSet) {
+        for (int m = 0; m < CM_MODELS; ++m) {
+            uint32_t index = hashContext(contexts[m], node) >> (32 - CM_TABLE_BITS);
+            slots[m] = &tables[m][index];
+            inputs[m] = stretch(counterP(*slots[m]));
+        }
+        inputs[CM_MODELS] = 256;
+
+        mixerWeights = &weights[mixerSet * CM_INPUTS];
+        int64_t dot = 0;
+        for (int i = 0; i < CM_INPUTS; ++i) {
+            dot += static_cast<int64_t>(inputs[i]) * mixerWeights[i];
+        }
+        int d = static_cast<int>(dot >> 16);
+        d = d < -2047 ? -2047 : (d > 2047 ? 2047 : d);
+        probability = squash(d);
+        return probability;
+    }
+
+    void update(int bit) {
+        for (int m = 0; m < CM_MODELS; ++m) {
+            counterUpdate(*slots[m], bit, CM_COUNTER_LIMIT);
+        }
+        int err = (bit << 12) - probability;
+        for (int i = 0; i < CM_INPUTS; ++i) {
+            mixerWeights[i] += (inputs[i] * err) >> 12;
+        }
+    }
+
+    void endSample(int16_t r) {
+        int magnitude = std::abs(r);
+        sinceSpike = magnitude > 4 * (activity >> 4) + 16 ? 0 : (sinceSpike < 1023 ? sinceSpike + 1 : sinceSpike);
+        activity += ((magnitude << 4) - activity) >> 4;
+        r2 = r1;
+        r1 = r;
+    }
+
+private:
+    std::vector<std::vector<uint32_t>> tables;
+    std::vector<int32_t> weights;
+    uint32_t contexts[CM_MODELS] = {};
+    uint32_t *slots[CM_MODELS] = {};
+    int inputs[CM_INPUTS] = {};
+    int32_t *mixerWeights = nullptr;
+    int probability = 2048;
+
+    int16_t r1 = 0;
+    int16_t r2 = 0;
+    int activity = 0; // running mean of |r|, x16
+    int sinceSpike = 1023;
+};
+
+template <typename Coder>
+int codeBit(ResidualModel &model, Coder &coder, int bit, uint32_t node, int mixerSet) {
+    int p = model.predict(node, mixerSet);
+    p = p < 1 ? 1 : (p > 4095 ? 4095 : p);
+    bit = coder.code(bit, p);
+    model.update(bit);
+    return bit;
+}
+
+// Code one residual. The encoder passes the value; the decoder passes 0 and
+// gets the decoded value back.
+template <typename Coder>
+int16_t codeResidual(ResidualModel &model, Coder &coder, int16_t r) {
+    model.beginSample();
+    int magnitude = std::abs(static_cast<int>(r));
+
+    if (codeBit(model, coder, magnitude == 0, 0, 0)) {
+        model.endSample(0);
+        return 0;
+    }
+    int negative = codeBit(model, coder, r < 0, 1, 1);
+
+    // Bit length in unary: "length > k" for k = 1..15
+    int expected = bitLength(magnitude);
+    int length = 1;
+    while (length < 16 && codeBit(model, coder, expected > length, 1 + length, 1 + length)) {
+        length++;
+    }
+
+    // Mantissa below the leading one, MSB-first, in the context of the
+    // length and the (top of the) bits seen so far
+    int value = 1;
+    for (int bit = length - 2; bit >= 0; --bit) {
+        int known = length - 2 - bit;
+        uint32_t prefix = known > 8 ? value >> (known - 8) : value;
+        uint32_t node = 32 + (static_cast<uint32_t>(length) << 20 | static_cast<uint32_t>(bit) << 16 | prefix);
+        int mixerSet = 17 + (bit < CM_MIXER_SETS - 18 ? bit : CM_MIXER_SETS - 18);
+        value = value << 1 | codeBit(model, coder, (magnitude >> bit) & 1, node, mixerSet);
+    }
+
+    int16_t result = static_cast<int16_t>(negative ? -value : value);
+    model.endSample(result);
+    return result;
+}
+
+inline std::vector<uint8_t> encodeResidualsCm(const int16_t *residuals, size_t count) {
+    std::vector<uint8_t> out;
+    ResidualModel model;
+    ArithmeticEncoder coder(out);
+    for (size_t i = 0; i < count; ++i) {
+        codeResidual(model, coder, residuals[i]);
+    }
+    coder.flush();
+    return out;
+}
+
+inline void decodeResidualsCm(const uint8_t *data, size_t size, int16_t *out, size_t count) {
+    ResidualModel model;
+    ArithmeticDecoder coder(data, size);
+    for (size_t i = 0; i < count; ++i) {
+        out[i] = codeResidual(model, coder, 0);
+    }
+}
+
+#endif
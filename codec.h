@@ -0,0 +1,714 @@
+#ifndef BRAINWIRE_CODEC_H
+#define BRAINWIRE_CODEC_H
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <functional>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#include "common.h"
+#include "wav.h"
+#include "pcm.h"
+#include "format.h"
+#include "huffman.h"
+#include "cm.h"
+#include "spike.h"
+#include "lpc.h"
+#include "valuemap.h"
+#include "runs.h"
+#include "segment.h"
+#include "zonemap.h"
+#include "convert.h"
+#include "parallel.h"
+
+struct EncodeOptions {
+    uint8_t codec = CODEC_HUFFMAN;
+    int level = DEFAULT_LEVEL; // 0 = no prediction search, 9 = widest
+    size_t blockSize = 0; // fixed block size; 0 = adaptive up to the codec default
+    int threads = defaultThreadCount();
+    bool spikeTemplates = false;
+    int templateBudget = DEFAULT_TEMPLATE_BUDGET;
+    uint32_t previewFactor = 0; // decimation of the preview layer (see preview.h); 0 = none
+};
+
+struct BlockStats {
+    uint8_t codec = 0;
+    size_t samples = 0;
+    size_t bytes = 0;      // payload bytes
+    size_t tableBytes = 0; // Huffman tables only
+    bool tableReused = false;
+    int contextCount = 0;
+    int lpcOrder = 0;
+    bool valueMap = false;
+    size_t runs = 0;
+    size_t runSamples = 0;
+    SpikeStats spikes;
+};
+
+struct EncodeStats {
+    std::vector<BlockStats> blocks;
+    size_t previewBytes = 0;
+    size_t outputBytes = 0;
+};
+
+// Huffman blocks are large so table overhead stays small; CM blocks are
+// smaller so archival encodes and decodes spread over the cores.
+inline size_t defaultBlockSize(uint8_t codec) {
+    return codec == CODEC_CM ? (1 << 16) : (1 << 20);
+}
+
+inline std::string codecName(uint8_t codec) {
+    switch (codec) {
+        case CODEC_HUFFMAN: return "huffman";
+        case CODEC_CM: return "cm";
+        case CODEC_STORED: return "stored";
+        case CODEC_DUPLICATE: return "duplicate";
+        default: return "codec " + std::to_string(codec);
+    }
+}
+
+// Rebuild the prediction domain (samples or ranks) from decoded residuals.
+// Samples inside matched spikes are predicted from their template, all
+// others by the block's LPC predictor.
+inline void reconstructDomain(const int16_t *residuals, size_t count, const LpcPredictor &lpc, const std::vector<SpikeEvent> &events, bool ranks, int32_t *y) {
+    TemplateDictionary dictionary;
+    LpcReconstructKernel reconstruct = lpcReconstructKernel(ranks, lpc.order);
+    size_t i = 0;
+    for (size_t e = 0; e <= events.size(); ++e) {
+        size_t stop = e < events.size() ? events[e].start : count;
+        if (stop < i || stop > count) {
+            fatal("Corrupt spike events: bad offset");
+        }
+        reconstruct(residuals, i, stop, lpc, y);
+        i = stop;
+        if (e == events.size()) {
+            break;
+        }
+
+        const SpikeEvent &event = events[e];
+        if (event.start + SNIPPET_LENGTH > count) {
+            fatal("Corrupt spike events: snippet past end of block");
+        }
+        if (event.slot != TEMPLATE_NEW && event.slot >= dictionary.used) {
+            fatal("Corrupt spike events: unknown template slot");
+        }
+        if (event.slot == TEMPLATE_NEW) {
+            reconstruct(residuals, i, i + SNIPPET_LENGTH, lpc, y);
+        } else {
+            for (int j = 0; j < SNIPPET_LENGTH; ++j) {
+                int64_t value = static_cast<int64_t>(dictionary.snippets[event.slot][j]) + residuals[i + j];
+                y[i + j] = ranks ? RankDomain::unwrap(value) : SampleDomain::unwrap(value);
+            }
+        }
+        i += SNIPPET_LENGTH;
+        dictionary.remember(event.slot, y + event.start);
+    }
+}
+
+// Cheap pre-check before the model search: if neither the samples nor
+// their first differences would code below 16 bits per sample, the block is
+// stored without trying.
+inline bool looksIncompressible(const int16_t *samples, size_t count) {
+    double limit = 16.0 * count;
+    if (estimateCodedBits(samples, count) < limit) {
+        return false;
+    }
+    std::vector<int16_t> differences(count);
+    for (size_t i = 0; i < count; ++i) {
+        differences[i] = static_cast<int16_t>(samples[i] - (i > 0 ? samples[i - 1] : 0));
+    }
+    return estimateCodedBits(differences.data(), count) >= limit;
+}
+
+inline std::vector<uint8_t> storeBlock(const int16_t *samples, size_t count, BlockStats &stats) {
+    stats = BlockStats();
+    stats.codec = CODEC_STORED;
+    stats.samples = count;
+    stats.bytes = count * sizeof(int16_t);
+    const uint8_t *bytes = reinterpret_cast<const uint8_t*>(samples);
+    return std::vector<uint8_t>(bytes, bytes + stats.bytes);
+}
+
+// A block after the prediction stage. CM and stored blocks are complete;
+// Huffman blocks hold their model sections and residuals until the table
+// reuse pass has picked the tables they are coded with.
+struct PreparedBlock {
+    const int16_t *samples = nullptr; // the block's input, for the stored fallback
+    size_t sampleCount = 0;
+    std::vector<uint8_t> payload;
+    std::vector<int16_t> residuals;
+    EntropyTables tables;                     // the block's own tables
+    const EntropyTables *codingTables = nullptr;
+    int tableReference = 0;                   // 0 = own tables, k = k-th most recent, or TABLE_SHARED
+    size_t sharedTable = 0;
+    const PreparedBlock *duplicateOf = nullptr; // archives: identical earlier block
+    uint64_t recordOffset = 0;                  // where the block record was written
+    BlockSummary summary;
+    BlockStats stats;
+};
+
+inline PreparedBlock prepareBlock(const EncodeOptions &options, const int16_t *blockSamples, size_t blockCount) {
+    PreparedBlock block;
+    block.samples = blockSamples;
+    block.sampleCount = blockCount;
+    block.summary = summarizeBlock(blockSamples, blockCount);
+    BlockStats &stats = block.stats;
+    if (looksIncompressible(blockSamples, blockCount)) {
+        block.payload = storeBlock(blockSamples, blockCount, stats);
+        return block;
+    }
+    stats.codec = options.codec;
+    stats.samples = blockCount;
+
+    // Flat and ramping stretches become run tokens; everything below codes
+    // the remaining samples only
+    std::vector<SampleRun> runs = findRuns(blockSamples, blockCount);
+    std::vector<int16_t> rest;
+    const int16_t *samples = blockSamples;
+    size_t count = blockCount;
+    if (!runs.empty()) {
+        rest = removeRuns(blockSamples, blockCount, runs);
+        samples = rest.data();
+        count = rest.size();
+        stats.runs = runs.size();
+        stats.runSamples = blockCount - count;
+    }
+
+    // Prediction domain: the samples, or their ranks when the block only
+    // uses a sparse set of values; whichever predicts to fewer bits
+    std::vector<int32_t> y(samples, samples + count);
+    std::vector<int16_t> &residuals = block.residuals;
+    double bits;
+    LpcPredictor lpc = chooseLpcPredictor(y.data(), count, options.level, residuals, bits);
+
+    ValueMap map;
+    bool ranks = false;
+    if (options.level > 0) {
+        map = buildValueMap(samples, count);
+        if (valueMapIsSparse(map)) {
+            std::vector<uint8_t> mapBytes;
+            writeValueMap(mapBytes, map);
+            std::vector<int32_t> rankDomain = mapToRanks(map, samples, count);
+            std::vector<int16_t> rankResiduals;
+            double rankBits;
+            LpcPredictor rankLpc = chooseLpcPredictor(rankDomain.data(), count, options.level, rankResiduals, rankBits);
+            if (rankBits + mapBytes.size() * 8 < bits) {
+                ranks = true;
+                lpc = rankLpc;
+                y.swap(rankDomain);
+                residuals.swap(rankResiduals);
+            }
+        }
+    }
+
+    std::vector<uint8_t> spikeEvents;
+    if (options.spikeTemplates) {
+        // Keep the templates only if they pay for their event list. The CM
+        // models already learn repeating shapes, so it is judged by a trial
+        // encode; for Huffman the residual estimate is close enough.
+        std::vector<int16_t> matched = residuals;
+        writeSpikeEvents(spikeEvents, matchSpikeTemplates(y.data(), count, options.templateBudget, matched.data(), stats.spikes));
+        auto cost = [&](const std::vector<int16_t> &r) {
+            return options.codec == CODEC_CM ? encodeResidualsCm(r.data(), count).size() * 8.0 : estimateCodedBits(r.data(), count);
+        };
+        if (cost(matched) + spikeEvents.size() * 8 < cost(residuals)) {
+            residuals.swap(matched);
+        } else {
+            spikeEvents.clear();
+            stats.spikes.matched = 0;
+        }
+    }
+
+    uint8_t flags = (ranks ? MODEL_VALUE_MAP : 0) | (lpc.order > 0 ? MODEL_LPC : 0) | (!spikeEvents.empty() ? MODEL_SPIKE_TEMPLATES : 0) |
+                    (!runs.empty() ? MODEL_RUNS : 0);
+    std::vector<uint8_t> &payload = block.payload;
+    payload.push_back(flags);
+    if (flags & MODEL_RUNS) {
+        writeRuns(payload, runs);
+    }
+    if (flags & MODEL_VALUE_MAP) {
+        writeValueMap(payload, map);
+    }
+    if (flags & MODEL_LPC) {
+        writeLpcPredictor(payload, lpc);
+    }
+    payload.insert(payload.end(), spikeEvents.begin(), spikeEvents.end());
+    stats.lpcOrder = lpc.order;
+    stats.valueMap = ranks;
+
+    if (options.codec == CODEC_CM) {
+        std::vector<uint8_t> coded = encodeResidualsCm(residuals.data(), count);
+        payload.insert(payload.end(), coded.begin(), coded.end());
+        residuals.clear();
+        stats.bytes = payload.size();
+        // Never let a block grow past its raw size
+        if (payload.size() >= blockCount * sizeof(int16_t)) {
+            payload = storeBlock(blockSamples, blockCount, stats);
+        }
+    } else {
+        block.tables = buildEntropyTables(residuals.data(), count);
+        stats.contextCount = block.tables.contextCount;
+    }
+    return block;
+}
+
+// Pick the tables for each Huffman block, in file order: its own, or the
+// tables of one of the last TABLE_HISTORY blocks that sent their own,
+// whichever codes the block in fewer bits once the own tables' bytes are
+// counted. Blocks that would still not beat their raw size are stored.
+//
+// With `shared` (archives), tables are not sent inline: a block either
+// adds its own tables to the shared list or reuses one of the last
+// SHARED_TABLE_CANDIDATES entries, and refers to it by index.
+inline void chooseBlockTables(const std::vector<PreparedBlock*> &blocks, std::vector<const EntropyTables*> *shared = nullptr) {
+    std::vector<const EntropyTables*> history; // most recent first
+    for (PreparedBlock *blockPointer : blocks) {
+        PreparedBlock &block = *blockPointer;
+        if (block.stats.codec != CODEC_HUFFMAN) {
+            continue;
+        }
+        size_t count = block.residuals.size();
+        std::vector<uint8_t> tableBytes;
+        writeEntropyTables(tableBytes, block.tables);
+
+        std::vector<const EntropyTables*> candidates = history;
+        if (shared) {
+            size_t first = shared->size() - std::min(shared->size(), SHARED_TABLE_CANDIDATES);
+            candidates.assign(shared->rbegin(), shared->rend() - first);
+        }
+        double bestBits = codedBitsWithTables(block.residuals.data(), count, block.tables) + tableBytes.size() * 8.0;
+        int choice = 0;
+        for (size_t k = 0; k < candidates.size(); ++k) {
+            double bits = codedBitsWithTables(block.residuals.data(), count, *candidates[k]);
+            if (bits < bestBits) {
+                bestBits = bits;
+                choice = static_cast<int>(k) + 1;
+            }
+        }
+
+        size_t size = block.payload.size() + 1 + static_cast<size_t>(std::ceil(bestBits / 8));
+        if (size >= block.sampleCount * sizeof(int16_t)) {
+            block.payload = storeBlock(block.samples, block.sampleCount, block.stats);
+            block.residuals.clear();
+            continue;
+        }
+
+        if (choice == 0) {
+            block.codingTables = &block.tables;
+            block.stats.tableBytes = tableBytes.size();
+        } else {
+            block.codingTables = candidates[choice - 1];
+            block.stats.tableReused = true;
+        }
+        if (shared) {
+            block.tableReference = TABLE_SHARED;
+            if (choice == 0) {
+                shared->push_back(&block.tables);
+            }
+            block.sharedTable = shared->size() - (choice == 0 ? 1 : choice);
+            continue;
+        }
+        block.tableReference = choice;
+        if (choice == 0) {
+            history.insert(history.begin(), &block.tables);
+            if (history.size() > static_cast<size_t>(TABLE_HISTORY)) {
+                history.pop_back();
+            }
+        }
+    }
+}
+
+inline void finishBlock(PreparedBlock &block) {
+    if (block.stats.codec != CODEC_HUFFMAN) {
+        return;
+    }
+    block.payload.push_back(static_cast<uint8_t>(block.tableReference));
+    if (block.tableReference == TABLE_SHARED) {
+        putVarint(block.payload, block.sharedTable);
+    } else if (block.tableReference == 0) {
+        writeEntropyTables(block.payload, block.tables);
+    }
+    encodeResiduals(block.payload, block.residuals.data(), block.residuals.size(), *block.codingTables);
+    block.residuals = std::vector<int16_t>();
+    block.stats.bytes = block.payload.size();
+}
+
+// A block's payload parsed up to its coded residuals
+struct BlockModel {
+    uint8_t flags = 0;
+    std::vector<SampleRun> runs;
+    size_t count = 0; // samples outside the runs
+    ValueMap map;
+    LpcPredictor lpc;
+    std::vector<SpikeEvent> spikeEvents;
+    int tableReference = 0;
+    uint64_t sharedTable = 0;
+    std::shared_ptr<const HuffmanDecoder> huffman; // own tables, or the referenced block's
+    size_t tableOffset = 0; // of the table reference byte
+    size_t dataOffset = 0;
+};
+
+// Without `buildTables`, a block's own tables are skipped rather than turned
+// into a decoder (for tools that only move blocks around)
+inline BlockModel readBlockModel(uint8_t codec, const uint8_t *payload, size_t size, size_t blockCount, bool buildTables = true) {
+    BlockModel model;
+    model.count = blockCount;
+    if (codec == CODEC_STORED) {
+        if (size != blockCount * sizeof(int16_t)) {
+            fatal("Corrupt stored block: size does not match sample count");
+        }
+        return model;
+    }
+    if (codec != CODEC_HUFFMAN && codec != CODEC_CM) {
+        fatal("Unsupported block codec " + std::to_string(codec));
+    }
+
+    ByteReader in(payload, size);
+    model.flags = in.value<uint8_t>();
+    if (model.flags & ~(MODEL_SPIKE_TEMPLATES | MODEL_VALUE_MAP | MODEL_LPC | MODEL_RUNS)) {
+        fatal("Unsupported block model flags " + std::to_string(model.flags));
+    }
+    if (model.flags & MODEL_RUNS) {
+        model.runs = readRuns(in);
+        size_t runSamples = 0;
+        for (const SampleRun &run : model.runs) {
+            runSamples += run.length;
+            if (runSamples > blockCount || static_cast<size_t>(run.start) + run.length > blockCount) {
+                fatal("Corrupt run tokens: runs longer than block");
+            }
+        }
+        model.count = blockCount - runSamples;
+    }
+    if (model.flags & MODEL_VALUE_MAP) {
+        model.map = readValueMap(in);
+    }
+    if (model.flags & MODEL_LPC) {
+        model.lpc = readLpcPredictor(in);
+    }
+    if (model.flags & MODEL_SPIKE_TEMPLATES) {
+        model.spikeEvents = readSpikeEvents(in);
+    }
+    if (codec == CODEC_HUFFMAN) {
+        model.tableOffset = in.pos;
+        model.tableReference = in.value<uint8_t>();
+        if (model.tableReference == TABLE_SHARED) {
+            model.sharedTable = in.varint();
+        } else if (model.tableReference > TABLE_HISTORY) {
+            fatal("Corrupt block: bad table reference");
+        } else if (model.tableReference == 0 && buildTables) {
+            model.huffman = std::make_shared<const HuffmanDecoder>(buildHuffmanDecoder(readEntropyTables(in)));
+        } else if (model.tableReference == 0) {
+            readEntropyTables(in);
+        }
+    }
+    model.dataOffset = in.pos;
+    return model;
+}
+
+// Give every block that reuses tables the decoder of the block (or shared
+// archive table) it refers to. `recent` carries the history of tables over
+// from blocks resolved before these.
+inline void resolveTableReferences(const std::vector<uint8_t> &codecs, std::vector<BlockModel> &models,
+                                   const std::vector<std::shared_ptr<const HuffmanDecoder>> *shared = nullptr,
+                                   std::vector<std::shared_ptr<const HuffmanDecoder>> *recent = nullptr) {
+    std::vector<std::shared_ptr<const HuffmanDecoder>> fresh;
+    std::vector<std::shared_ptr<const HuffmanDecoder>> &history = recent ? *recent : fresh; // most recent first
+    for (size_t b = 0; b < models.size(); ++b) {
+        if (codecs[b] != CODEC_HUFFMAN) {
+            continue;
+        }
+        BlockModel &model = models[b];
+        if (model.tableReference == TABLE_SHARED) {
+            if (!shared || model.sharedTable >= shared->size()) {
+                fatal("Corrupt block: shared table reference outside an archive's tables");
+            }
+            model.huffman = (*shared)[model.sharedTable];
+        } else if (model.tableReference == 0) {
+            history.insert(history.begin(), model.huffman);
+            if (history.size() > static_cast<size_t>(TABLE_HISTORY)) {
+                history.pop_back();
+            }
+        } else if (static_cast<size_t>(model.tableReference) > history.size()) {
+            fatal("Corrupt .brainwire file: table reference before any tables");
+        } else {
+            model.huffman = history[model.tableReference - 1];
+        }
+    }
+}
+
+// How many tables from before a run of blocks its references reach back
+// for: `reference(b)` is block b's table reference, -1 if it has none.
+// Only that many blocks with their own tables need to be found before it.
+template <typename Reference>
+int tableHistoryDepth(size_t count, Reference reference) {
+    int own = 0;
+    int depth = 0;
+    for (size_t b = 0; b < count; ++b) {
+        int r = reference(b);
+        if (r == 0) {
+            own++;
+        } else if (r > own && r <= TABLE_HISTORY) {
+            depth = std::max(depth, r - own);
+        }
+    }
+    return depth;
+}
+
+// Bytes first read of a record whose head is wanted: enough for most block
+// models, while a block with its own tables reads on for them
+const size_t RECORD_HEAD_BYTES = 256;
+
+// Whether the block record of `count` samples at [offset, end) is a Huffman
+// block with its own tables, and if so their serialized bytes. `read(offset,
+// size)` returns file bytes; only the head of the record is read (doubling
+// until the model fits), never its coded residuals.
+template <typename ReadRange>
+bool readRecordTables(ReadRange read, uint64_t offset, uint64_t end, uint64_t count, std::vector<uint8_t> &tables) {
+    uint64_t size = std::min<uint64_t>(end - offset, RECORD_HEAD_BYTES);
+    while (true) {
+        std::vector<uint8_t> bytes = read(offset, size);
+        bool own = false;
+        auto parse = [&]() {
+            ByteReader in(bytes.data(), bytes.size());
+            uint8_t codec = in.value<uint8_t>();
+            uint64_t recordCount = in.varint();
+            uint64_t payloadSize = in.varint();
+            if (recordCount != count || payloadSize > end - offset - in.pos) {
+                fatal("Corrupt .brainwire file: block record does not match index");
+            }
+            if (codec != CODEC_HUFFMAN) {
+                return;
+            }
+            const uint8_t *payload = bytes.data() + in.pos;
+            BlockModel model = readBlockModel(codec, payload, std::min<uint64_t>(payloadSize, in.size - in.pos), count, false);
+            if (model.tableReference == 0) {
+                own = true;
+                tables.assign(payload + model.tableOffset + 1, payload + model.dataOffset);
+            }
+        };
+        if (size == end - offset) {
+            parse(); // the whole record: an error is real
+            return own;
+        }
+        if (tryParse(parse)) {
+            return own;
+        }
+        size = std::min<uint64_t>(size * 2, end - offset);
+    }
+}
+
+inline void decodeBlock(uint8_t codec, const uint8_t *payload, size_t size, const BlockModel &model, int16_t *out, size_t blockCount) {
+    size_t count = model.count;
+    const uint8_t *data = payload + model.dataOffset;
+    size_t dataSize = size - model.dataOffset;
+
+    // Residuals are decoded straight into the output buffer; the samples
+    // outside the runs go to its front and are spread out once the runs are
+    // filled in
+    switch (codec) {
+        case CODEC_STORED:
+            memcpy(out, payload, size);
+            return;
+        case CODEC_HUFFMAN:
+            decodeResiduals(data, dataSize, *model.huffman, out, count);
+            break;
+        case CODEC_CM:
+            decodeResidualsCm(data, dataSize, out, count);
+            break;
+    }
+
+    if (model.flags & (MODEL_SPIKE_TEMPLATES | MODEL_VALUE_MAP | MODEL_LPC)) {
+        bool ranks = (model.flags & MODEL_VALUE_MAP) != 0;
+        std::vector<int32_t> y(count);
+        reconstructDomain(out, count, model.lpc, model.spikeEvents, ranks, y.data());
+        if (ranks) {
+            mapFromRanks(model.map, y.data(), count, out);
+        } else {
+            for (size_t i = 0; i < count; ++i) out[i] = static_cast<int16_t>(y[i]);
+        }
+    }
+    if (model.flags & MODEL_RUNS) {
+        expandRuns(out, blockCount, count, model.runs);
+    }
+}
+
+inline std::vector<Segment> chooseBlockSegments(const EncodeOptions &options, const std::vector<int16_t> &audioData) {
+    return options.blockSize > 0 ? fixedSegments(audioData.size(), options.blockSize)
+                                 : chooseSegments(audioData.data(), audioData.size(), defaultBlockSize(options.codec), options.level);
+}
+
+// Model every block in parallel, choose Huffman tables in order, then
+// entropy code in parallel
+inline std::vector<PreparedBlock> encodeBlocks(const EncodeOptions &options, const std::vector<int16_t> &audioData) {
+    std::vector<Segment> segments = chooseBlockSegments(options, audioData);
+    std::vector<PreparedBlock> blocks(segments.size());
+    parallelFor(blocks.size(), options.threads, [&](size_t b) {
+        blocks[b] = prepareBlock(options, audioData.data() + segments[b].first, segments[b].count);
+    });
+    std::vector<PreparedBlock*> order;
+    for (PreparedBlock &block : blocks) order.push_back(&block);
+    chooseBlockTables(order);
+    parallelFor(blocks.size(), options.threads, [&](size_t b) {
+        finishBlock(blocks[b]);
+    });
+    return blocks;
+}
+
+inline void writeBlockRecord(std::vector<uint8_t> &out, uint8_t codec, uint64_t count, const std::vector<uint8_t> &payload) {
+    out.push_back(codec);
+    putVarint(out, count);
+    putVarint(out, payload.size());
+    out.insert(out.end(), payload.begin(), payload.end());
+}
+
+inline void writeBlockRecord(std::vector<uint8_t> &out, const PreparedBlock &block) {
+    writeBlockRecord(out, block.stats.codec, block.stats.samples, block.payload);
+}
+
+// Stream body (everything after an archive recording's start): sample
+// count, header, then the blocks. Duplicate blocks get their payload here,
+// once the offset of the block they repeat is known. `planes` marks samples
+// split into planes (see pcm.h).
+inline void writeBrainwireStream(std::vector<uint8_t> &out, const WavHeader &header, size_t sampleCount, std::vector<PreparedBlock> &blocks,
+                                 bool planes = false) {
+    putVarint(out, sampleCount);
+    writeCompactHeader(out, header, sampleCount, planes);
+    putVarint(out, blocks.size());
+    for (PreparedBlock &block : blocks) {
+        block.recordOffset = out.size();
+        if (block.duplicateOf) {
+            block.payload.clear();
+            putVarint(block.payload, block.duplicateOf->recordOffset);
+            block.stats.bytes = block.payload.size();
+        }
+        writeBlockRecord(out, block);
+    }
+}
+
+// A block record: codec byte, varint sample count, varint payload size,
+// payload
+struct BlockRecord {
+    uint8_t codec;
+    uint64_t first; // sample offset in the stream
+    uint64_t count;
+    const uint8_t *payload;
+    uint64_t size;
+};
+
+inline BlockRecord readBlockRecord(ByteReader &in) {
+    BlockRecord block;
+    block.codec = in.value<uint8_t>();
+    block.first = 0;
+    block.count = in.varint();
+    block.size = in.varint();
+    block.payload = in.bytes(block.size);
+    return block;
+}
+
+// Looks up the block record at an archive offset, for CODEC_DUPLICATE
+using DuplicateResolver = std::function<BlockRecord(uint64_t offset)>;
+
+// Fill in the sample offsets of walked block records, checking they add up
+// to `sampleCount`
+inline void placeBlockRecords(std::vector<BlockRecord> &blocks, uint64_t sampleCount) {
+    uint64_t position = 0;
+    for (BlockRecord &block : blocks) {
+        block.first = position;
+        if (block.count > sampleCount - position) {
+            fatal("Corrupt .brainwire file: block sample counts exceed total");
+        }
+        position += block.count;
+    }
+    if (position != sampleCount) {
+        fatal("Corrupt .brainwire file: block sample counts do not match total");
+    }
+}
+
+// Decode walked block records into `out`, which holds `sampleCount` samples
+// in `layout`. Blocks in another layout than the WAV's are reconstructed in
+// a buffer of their own and converted while still in cache. `shared` holds
+// the decoders of an archive's shared tables.
+inline void decodeBlockRecords(std::vector<BlockRecord> &blocks, uint64_t sampleCount, const SampleLayout &layout, void *out, int threads,
+                               const std::vector<std::shared_ptr<const HuffmanDecoder>> *shared = nullptr) {
+    placeBlockRecords(blocks, sampleCount);
+    checkSampleLayout(layout, sampleCount);
+
+    // Parse the block models (building Huffman decode tables) in parallel,
+    // link reused tables in file order, then decode in parallel
+    std::vector<BlockModel> models(blocks.size());
+    parallelFor(blocks.size(), threads, [&](size_t b) {
+        const BlockRecord &block = blocks[b];
+        models[b] = readBlockModel(block.codec, block.payload, block.size, block.count);
+    });
+    std::vector<uint8_t> codecs;
+    for (const BlockRecord &block : blocks) codecs.push_back(block.codec);
+    resolveTableReferences(codecs, models, shared);
+
+    bool direct = isWavLayout(layout);
+    parallelFor(blocks.size(), threads, [&](size_t b) {
+        const BlockRecord &block = blocks[b];
+        if (direct) {
+            decodeBlock(block.codec, block.payload, block.size, models[b], static_cast<int16_t*>(out) + block.first, block.count);
+            return;
+        }
+        std::vector<int16_t> samples(block.count);
+        decodeBlock(block.codec, block.payload, block.size, models[b], samples.data(), block.count);
+        convertSamples(samples.data(), block.count, block.first, sampleCount, layout, out);
+    });
+}
+
+inline void decodeBlockRecords(std::vector<BlockRecord> &blocks, uint64_t sampleCount, std::vector<int16_t> &audioData, int threads,
+                               const std::vector<std::shared_ptr<const HuffmanDecoder>> *shared = nullptr) {
+    placeBlockRecords(blocks, sampleCount);
+    resizeBuffer(audioData, sampleCount);
+    decodeBlockRecords(blocks, sampleCount, SampleLayout(), audioData.data(), threads, shared);
+}
+
+// Walk a stream body (see writeBrainwireStream), resolving duplicate blocks.
+// Sample planes are only accepted when `planes` is given.
+inline std::vector<BlockRecord> readBrainwireStream(ByteReader &in, WavHeader &header, uint64_t &sampleCount,
+                                                    const DuplicateResolver *resolveDuplicate = nullptr, bool *planes = nullptr) {
+    sampleCount = in.varint();
+    header = readCompactHeader(in, sampleCount, planes);
+    uint64_t blockCount = in.varint();
+
+    // Walk the block headers first so the blocks can be decoded in parallel
+    std::vector<BlockRecord> blocks;
+    for (uint64_t b = 0; b < blockCount; ++b) {
+        BlockRecord block = readBlockRecord(in);
+        if (block.codec == CODEC_DUPLICATE) {
+            if (!resolveDuplicate) {
+                fatal("Corrupt .brainwire file: duplicate block outside an archive");
+            }
+            ByteReader reference(block.payload, block.size);
+            BlockRecord original = (*resolveDuplicate)(reference.varint());
+            if (original.codec == CODEC_DUPLICATE || original.count != block.count) {
+                fatal("Corrupt archive: bad duplicate block reference");
+            }
+            block = original;
+        }
+        if (block.count > sampleCount) {
+            fatal("Corrupt .brainwire file: block sample counts exceed total");
+        }
+        blocks.push_back(block);
+    }
+    return blocks;
+}
+
+// Decode a stream body to the words of the WAV data chunk
+inline void decodeBrainwireStream(ByteReader &in, WavHeader &header, std::vector<int16_t> &audioData, int threads,
+                                  const std::vector<std::shared_ptr<const HuffmanDecoder>> *shared = nullptr,
+                                  const DuplicateResolver *resolveDuplicate = nullptr) {
+    uint64_t sampleCount;
+    bool planes;
+    std::vector<BlockRecord> blocks = readBrainwireStream(in, header, sampleCount, resolveDuplicate, &planes);
+    decodeBlockRecords(blocks, sampleCount, audioData, threads, shared);
+    if (planes) {
+        audioData = joinSamplePlanes(header, audioData);
+    }
+}
+
+#endif
@@ -0,0 +1,206 @@
+#ifndef BRAINWIRE_COMMON_H
+#define BRAINWIRE_COMMON_H
+
+#include <iostream>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+#include <sys/mman.h>
+
+// Report an unrecoverable error (bad input, truncated stream) and stop. The
+// shared library (built with BRAINWIRE_LIBRARY) throws instead, so a bad
+// file fails the call rather than ending the host process.
+struct BrainwireError : std::runtime_error {
+    using std::runtime_error::runtime_error;
+};
+
+// Nonzero while tryParse runs: fatal() throws instead of exiting
+inline thread_local int fatalThrows = 0;
+
+[[noreturn]] inline void fatal(const std::string &message) {
+#ifdef BRAINWIRE_LIBRARY
+    throw BrainwireError(message);
+#else
+    if (fatalThrows > 0) {
+        throw BrainwireError(message);
+    }
+    std::cerr << message << std::endl;
+    exit(1);
+#endif
+}
+
+// Run `parse` over what may be only the start of a structure; false if it
+// failed (most likely by running off the end), with nothing reported, so
+// the caller can read more and try again
+template <typename F>
+bool tryParse(F parse) {
+    fatalThrows++;
+    try {
+        parse();
+    } catch (const BrainwireError &) {
+        fatalThrows--;
+        return false;
+    }
+    fatalThrows--;
+    return true;
+}
+
+// Whole recordings and encoded files run to gigabytes, and sweeping them
+// through 4 KB pages costs a TLB miss every 4 KB. Large buffers are
+// allocated first and advised to use transparent huge pages before any of
+// them is written, so the kernel backs them with 2 MB pages where it can.
+// Where it cannot (THP disabled, an old kernel), the advice is ignored and
+// the buffer is ordinary memory. BRAINWIRE_HUGE_PAGES=0 turns it off, to
+// compare.
+const size_t HUGE_PAGE_SIZE = 2 << 20;
+
+inline bool hugePagesEnabled() {
+    static const bool enabled = [] {
+        const char *setting = getenv("BRAINWIRE_HUGE_PAGES");
+        return !setting || strcmp(setting, "0") != 0;
+    }();
+    return enabled;
+}
+
+// Advise huge pages for the whole 2 MB pages inside [data, data + bytes)
+inline void adviseHugePages(const void *data, size_t bytes) {
+#ifdef MADV_HUGEPAGE
+    uintptr_t first = (reinterpret_cast<uintptr_t>(data) + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+    uintptr_t last = (reinterpret_cast<uintptr_t>(data) + bytes) & ~(HUGE_PAGE_SIZE - 1);
+    if (hugePagesEnabled() && last > first) {
+        madvise(reinterpret_cast<void*>(first), last - first, MADV_HUGEPAGE);
+    }
+#endif
+}
+
+// reserve() and resize() for large buffers: a growing buffer is allocated
+// and advised before its new elements are written
+template <typename T>
+void reserveBuffer(std::vector<T> &buffer, size_t capacity) {
+    if (capacity > buffer.capacity() && capacity * sizeof(T) >= 2 * HUGE_PAGE_SIZE) {
+        buffer.reserve(capacity);
+        adviseHugePages(buffer.data(), capacity * sizeof(T));
+    }
+}
+
+template <typename T>
+void resizeBuffer(std::vector<T> &buffer, size_t size) {
+    reserveBuffer(buffer, size);
+    buffer.resize(size);
+}
+
+inline std::vector<uint8_t> readFileBytes(const std::string &filename) {
+    std::ifstream file(filename, std::ios::binary);
+    if (!file) {
+        fatal("Error opening file: " + filename);
+    }
+    file.seekg(0, std::ios::end);
+    std::streamoff size = file.tellg();
+    if (size < 0) {
+        // Not seekable (a pipe): read as it comes
+        file.clear();
+        return std::vector<uint8_t>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+    std::vector<uint8_t> bytes;
+    resizeBuffer(bytes, static_cast<size_t>(size));
+    file.seekg(0);
+    file.read(reinterpret_cast<char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+    if (!file) {
+        fatal("Error reading file: " + filename);
+    }
+    return bytes;
+}
+
+inline void writeFileBytes(const std::string &filename, const std::vector<uint8_t> &bytes) {
+    std::ofstream file(filename, std::ios::binary);
+    if (!file) {
+        fatal("Error creating file: " + filename);
+    }
+    file.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+}
+
+inline std::vector<uint8_t> readFileRange(std::ifstream &file, uint64_t offset, uint64_t size) {
+    std::vector<uint8_t> bytes;
+    resizeBuffer(bytes, size);
+    file.seekg(static_cast<std::streamoff>(offset));
+    file.read(reinterpret_cast<char*>(bytes.data()), static_cast<std::streamsize>(size));
+    if (!file) {
+        fatal("Unexpected end of file");
+    }
+    return bytes;
+}
+
+// Append a fixed-size little-endian value to a byte buffer
+template <typename T>
+void putValue(std::vector<uint8_t> &out, T value) {
+    const uint8_t *bytes = reinterpret_cast<const uint8_t*>(&value);
+    out.insert(out.end(), bytes, bytes + sizeof(T));
+}
+
+// Append an unsigned LEB128 varint
+inline void putVarint(std::vector<uint8_t> &out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<uint8_t>(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<uint8_t>(value));
+}
+
+inline uint32_t zigzag(int32_t value) {
+    return (static_cast<uint32_t>(value) << 1) ^ static_cast<uint32_t>(value >> 31);
+}
+
+inline int32_t unzigzag(uint32_t value) {
+    return static_cast<int32_t>(value >> 1) ^ -static_cast<int32_t>(value & 1);
+}
+
+// Bounds-checked cursor over an in-memory byte buffer
+struct ByteReader {
+    const uint8_t *data;
+    size_t size;
+    size_t pos;
+
+    ByteReader(const uint8_t *data, size_t size) : data(data), size(size), pos(0) {}
+
+    void need(size_t count) const {
+        if (count > size - pos) {
+            fatal("Unexpected end of encoded data");
+        }
+    }
+
+    template <typename T>
+    T value() {
+        T result;
+        need(sizeof(T));
+        memcpy(&result, data + pos, sizeof(T));
+        pos += sizeof(T);
+        return result;
+    }
+
+    uint64_t varint() {
+        uint64_t result = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            uint8_t byte = value<uint8_t>();
+            result |= static_cast<uint64_t>(byte & 0x7F) << shift;
+            if (!(byte & 0x80)) {
+                return result;
+            }
+        }
+        fatal("Malformed varint in encoded data");
+    }
+
+    const uint8_t *bytes(size_t count) {
+        need(count);
+        const uint8_t *result = data + pos;
+        pos += count;
+        return result;
+    }
+};
+
+#endif
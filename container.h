@@ -0,0 +1,662 @@
+#ifndef BRAINWIRE_CONTAINER_H
+#define BRAINWIRE_CONTAINER_H
+
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "wav.h"
+#include "format.h"
+#include "codec.h"
+#include "hash.h"
+#include "zonemap.h"
+#include "preview.h"
+
+// The .brainwire file: block records up front, a trailing index, and two
+// fixed slots after the version byte that point at the live index (see
+// format.h). Appending writes only the new blocks and a new index, so a
+// growing recording is never decoded or re-encoded; the index is a few
+// bytes per block.
+
+struct IndexBlock {
+    uint64_t offset; // of the block record, from the start of the file
+    uint64_t count;
+};
+
+struct BrainwireIndex {
+    uint32_t generation = 0;
+    size_t slot = 0;
+    uint64_t offset = 0; // where the index itself starts
+    uint64_t end = 0;    // and ends; an append writes from here
+    uint64_t sampleCount = 0;
+    WavHeader header;
+    bool planes = false;             // samples split into planes (see pcm.h)
+    std::vector<IndexBlock> blocks;
+    std::vector<BlockSummary> zones; // one per block, or none
+    uint32_t previewFactor = 0;      // 0 = no preview layer
+    int32_t previewTail = 0;         // sum of the last, partial preview group
+    std::vector<PreviewRecord> preview;
+};
+
+inline void writeBrainwireIndex(std::vector<uint8_t> &out, const BrainwireIndex &index) {
+    size_t start = out.size();
+    putVarint(out, index.generation);
+    putVarint(out, index.sampleCount);
+    writeCompactHeader(out, index.header, index.sampleCount, index.planes);
+    putVarint(out, index.blocks.size());
+    uint64_t previous = FORMAT_PREAMBLE_SIZE;
+    for (const IndexBlock &block : index.blocks) {
+        putVarint(out, block.offset - previous);
+        putVarint(out, block.count);
+        previous = block.offset;
+    }
+    if (index.zones.size() == index.blocks.size()) {
+        for (const BlockSummary &zone : index.zones) writeBlockSummary(out, zone);
+        // The preview layer follows the zone maps, so it is only kept with them
+        if (index.previewFactor > 0) {
+            putVarint(out, index.previewFactor);
+            putVarint(out, zigzag(index.previewTail));
+            putVarint(out, index.preview.size());
+            previous = FORMAT_PREAMBLE_SIZE;
+            for (const PreviewRecord &record : index.preview) {
+                putVarint(out, record.offset - previous);
+                putVarint(out, record.first);
+                previous = record.offset;
+            }
+        }
+    }
+    putValue(out, hashBytes(out.data() + start, out.size() - start));
+}
+
+// Parse an index read from `offset`; false if it is torn or not the one the
+// slot names
+inline bool parseBrainwireIndex(const std::vector<uint8_t> &bytes, uint64_t offset, uint32_t generation, BrainwireIndex &index) {
+    if (bytes.size() < sizeof(uint64_t)) {
+        return false;
+    }
+    size_t bodySize = bytes.size() - sizeof(uint64_t);
+    uint64_t hash;
+    memcpy(&hash, bytes.data() + bodySize, sizeof(hash));
+    if (hash != hashBytes(bytes.data(), bodySize)) {
+        return false;
+    }
+
+    ByteReader in(bytes.data(), bodySize);
+    if (in.varint() != generation) {
+        return false;
+    }
+    index.generation = generation;
+    index.offset = offset;
+    index.end = offset + bytes.size();
+    index.sampleCount = in.varint();
+    index.header = readCompactHeader(in, index.sampleCount, &index.planes);
+    uint64_t blockCount = in.varint();
+    if (blockCount > in.size - in.pos) {
+        fatal("Corrupt .brainwire index: bad block count");
+    }
+    index.blocks.resize(blockCount);
+    uint64_t position = FORMAT_PREAMBLE_SIZE;
+    for (IndexBlock &block : index.blocks) {
+        uint64_t delta = in.varint();
+        if (delta >= offset - position) {
+            fatal("Corrupt .brainwire index: block offset out of range");
+        }
+        position += delta;
+        block.offset = position;
+        block.count = in.varint();
+    }
+    if (in.pos < in.size) {
+        for (size_t b = 0; b < blockCount; ++b) index.zones.push_back(readBlockSummary(in));
+    }
+    if (in.pos < in.size) {
+        uint64_t factor = in.varint();
+        uint64_t tail = in.varint();
+        uint64_t recordCount = in.varint();
+        if (factor < 2 || factor > MAX_PREVIEW_FACTOR || tail > UINT32_MAX || recordCount > in.size - in.pos) {
+            fatal("Corrupt .brainwire index: bad preview layer");
+        }
+        index.previewFactor = static_cast<uint32_t>(factor);
+        index.previewTail = unzigzag(static_cast<uint32_t>(tail));
+        index.preview.resize(recordCount);
+        position = FORMAT_PREAMBLE_SIZE;
+        for (PreviewRecord &record : index.preview) {
+            uint64_t delta = in.varint();
+            if (delta >= offset - position) {
+                fatal("Corrupt .brainwire index: preview offset out of range");
+            }
+            position += delta;
+            record.offset = position;
+            record.first = in.varint();
+        }
+    }
+    return true;
+}
+
+inline void setIndexSlot(uint8_t *preamble, size_t slot, uint64_t offset, uint32_t size, uint32_t generation) {
+    uint8_t *entry = preamble + sizeof(FORMAT_MAGIC) + 1 + slot * INDEX_SLOT_SIZE;
+    memcpy(entry, &offset, sizeof(offset));
+    memcpy(entry + sizeof(offset), &size, sizeof(size));
+    memcpy(entry + sizeof(offset) + sizeof(size), &generation, sizeof(generation));
+}
+
+// The live index: the valid one with the highest generation. `read(offset,
+// size)` returns file bytes.
+template <typename ReadRange>
+BrainwireIndex loadBrainwireIndex(const uint8_t *preamble, uint64_t fileSize, ReadRange read) {
+    struct Slot {
+        uint64_t offset;
+        uint32_t size;
+        uint32_t generation;
+    } slots[INDEX_SLOTS];
+    for (size_t s = 0; s < INDEX_SLOTS; ++s) {
+        memcpy(&slots[s], preamble + sizeof(FORMAT_MAGIC) + 1 + s * INDEX_SLOT_SIZE, INDEX_SLOT_SIZE);
+    }
+    size_t first = slots[1].generation > slots[0].generation ? 1 : 0;
+    for (size_t s : {first, 1 - first}) {
+        const Slot &slot = slots[s];
+        if (slot.generation == 0 || slot.offset < FORMAT_PREAMBLE_SIZE || slot.offset > fileSize || slot.size > fileSize - slot.offset) {
+            continue;
+        }
+        BrainwireIndex index;
+        if (parseBrainwireIndex(read(slot.offset, slot.size), slot.offset, slot.generation, index)) {
+            index.slot = s;
+            return index;
+        }
+    }
+    fatal("Corrupt .brainwire file: no valid index");
+}
+
+// For the readers that hand out the codec's 16-bit words as samples
+inline void checkNoSamplePlanes(const BrainwireIndex &index) {
+    if (index.planes) {
+        fatal("Samples wider than 16 bits can only be decoded whole to a WAV file");
+    }
+}
+
+inline BrainwireIndex readBrainwireIndex(const std::vector<uint8_t> &data) {
+    if (data.size() < FORMAT_PREAMBLE_SIZE) {
+        fatal("Corrupt .brainwire file: truncated preamble");
+    }
+    return loadBrainwireIndex(data.data(), data.size(), [&](uint64_t offset, uint64_t size) {
+        return std::vector<uint8_t>(data.begin() + offset, data.begin() + offset + size);
+    });
+}
+
+// Records for the blocks of `index`, in file order
+inline std::vector<BlockRecord> indexBlockRecords(const std::vector<uint8_t> &data, const BrainwireIndex &index) {
+    std::vector<BlockRecord> blocks;
+    for (const IndexBlock &entry : index.blocks) {
+        ByteReader in(data.data() + entry.offset, index.offset - entry.offset);
+        BlockRecord block = readBlockRecord(in);
+        if (block.count != entry.count) {
+            fatal("Corrupt .brainwire file: block record does not match index");
+        }
+        blocks.push_back(block);
+    }
+    return blocks;
+}
+
+// Preview records at `position` for `count` new samples, added to `index`.
+// Call before the samples' blocks are added.
+inline void appendPreviewRecords(std::vector<uint8_t> &out, uint64_t position, const int16_t *samples, size_t count,
+                                 const EncodeOptions &options, BrainwireIndex &index) {
+    uint64_t first = index.sampleCount / index.previewFactor;
+    std::vector<int16_t> preview = decimateSamples(samples, count, index.previewFactor, index.sampleCount, index.previewTail);
+    for (const PreparedBlock &block : encodeBlocks(options, preview)) {
+        index.preview.push_back({position + out.size(), first});
+        first += block.stats.samples;
+        writeBlockRecord(out, block);
+    }
+}
+
+// Block records at `position` for `blocks`, added to `index`
+inline void appendBlockRecords(std::vector<uint8_t> &out, uint64_t position, const std::vector<PreparedBlock> &blocks, BrainwireIndex &index) {
+    bool zoned = index.zones.size() == index.blocks.size(); // files without zone maps stay without
+    for (const PreparedBlock &block : blocks) {
+        if (zoned) index.zones.push_back(block.summary);
+        index.blocks.push_back({position + out.size(), block.stats.samples});
+        index.sampleCount += block.stats.samples;
+        writeBlockRecord(out, block);
+    }
+}
+
+inline std::vector<uint8_t> beginBrainwireFile() {
+    std::vector<uint8_t> out(FORMAT_PREAMBLE_SIZE, 0);
+    memcpy(out.data(), FORMAT_MAGIC, sizeof(FORMAT_MAGIC));
+    out[sizeof(FORMAT_MAGIC)] = FORMAT_VERSION;
+    return out;
+}
+
+// Write the first index after the records in `out` and point slot 0 at it
+inline void finishBrainwireFile(std::vector<uint8_t> &out, BrainwireIndex &index) {
+    index.generation = 1;
+    index.offset = out.size();
+    writeBrainwireIndex(out, index);
+    setIndexSlot(out.data(), 0, index.offset, static_cast<uint32_t>(out.size() - index.offset), index.generation);
+}
+
+// Samples wider than 16 bits are coded as planes (see pcm.h)
+inline std::vector<uint8_t> encodeBrainwire(const WavHeader &header, const std::vector<int16_t> &audioData, const EncodeOptions &options, EncodeStats &stats) {
+    BrainwireIndex index;
+    index.header = header;
+    index.planes = usesSamplePlanes(header, audioData.size());
+    if (index.planes && options.previewFactor > 0) {
+        fatal("A preview layer needs 16-bit samples");
+    }
+    std::vector<int16_t> planes;
+    if (index.planes) {
+        planes = splitSamplePlanes(header, audioData);
+    }
+    std::vector<PreparedBlock> blocks = encodeBlocks(options, index.planes ? planes : audioData);
+
+    // Room for the records (payload and up to 21 bytes of record header)
+    // and the index, so the output is allocated once
+    std::vector<uint8_t> out = beginBrainwireFile();
+    size_t capacity = out.size();
+    for (const PreparedBlock &block : blocks) capacity += block.payload.size() + 21 + 64;
+    if (options.previewFactor > 0) {
+        capacity += capacity / options.previewFactor;
+    }
+    reserveBuffer(out, capacity);
+    if (options.previewFactor > 0) {
+        checkPreviewOptions(header, options.previewFactor);
+        index.previewFactor = options.previewFactor;
+        appendPreviewRecords(out, 0, audioData.data(), audioData.size(), options, index);
+        stats.previewBytes = out.size() - FORMAT_PREAMBLE_SIZE;
+    }
+    appendBlockRecords(out, 0, blocks, index);
+    finishBrainwireFile(out, index);
+
+    stats.blocks.clear();
+    for (const PreparedBlock &block : blocks) stats.blocks.push_back(block.stats);
+    stats.outputBytes = out.size();
+    return out;
+}
+
+// Version 1 layout: one stream body, no index. Nothing in it points
+// forward, so it can be decoded as it arrives through a pipe (see reader.h).
+inline std::vector<uint8_t> encodeBrainwireStream(const WavHeader &header, const std::vector<int16_t> &audioData, const EncodeOptions &options,
+                                                  EncodeStats &stats) {
+    if (options.previewFactor > 0) {
+        fatal("The stream layout has no preview layer");
+    }
+    std::vector<PreparedBlock> blocks = encodeBlocks(options, audioData);
+    std::vector<uint8_t> out(FORMAT_MAGIC, FORMAT_MAGIC + sizeof(FORMAT_MAGIC));
+    out.push_back(FORMAT_VERSION_STREAM);
+    writeBrainwireStream(out, header, audioData.size(), blocks);
+
+    stats.blocks.clear();
+    for (const PreparedBlock &block : blocks) stats.blocks.push_back(block.stats);
+    stats.outputBytes = out.size();
+    return out;
+}
+
+inline void decodeBrainwire(const std::vector<uint8_t> &data, WavHeader &header, std::vector<int16_t> &audioData, int threads) {
+    ByteReader in(data.data(), data.size());
+    in.bytes(sizeof(FORMAT_MAGIC));
+    uint8_t version = in.value<uint8_t>();
+    if (version == FORMAT_VERSION_STREAM) {
+        decodeBrainwireStream(in, header, audioData, threads);
+        return;
+    }
+    if (version != FORMAT_VERSION) {
+        fatal("Unsupported .brainwire version " + std::to_string(version));
+    }
+    BrainwireIndex index = readBrainwireIndex(data);
+    std::vector<BlockRecord> blocks = indexBlockRecords(data, index);
+    header = index.header;
+    decodeBlockRecords(blocks, index.sampleCount, audioData, threads);
+    if (index.planes) {
+        audioData = joinSamplePlanes(header, audioData);
+    }
+}
+
+// The header and block records of a whole .brainwire file (either version)
+// held in memory
+inline std::vector<BlockRecord> readBrainwireRecords(const uint8_t *data, size_t size, WavHeader &header, uint64_t &sampleCount) {
+    ByteReader in(data, size);
+    if (memcmp(in.bytes(sizeof(FORMAT_MAGIC)), FORMAT_MAGIC, sizeof(FORMAT_MAGIC)) != 0) {
+        fatal("Not a .brainwire file");
+    }
+    uint8_t version = in.value<uint8_t>();
+    std::vector<BlockRecord> blocks;
+    if (version == FORMAT_VERSION_STREAM) {
+        blocks = readBrainwireStream(in, header, sampleCount);
+    } else if (version == FORMAT_VERSION) {
+        if (size < FORMAT_PREAMBLE_SIZE) {
+            fatal("Corrupt .brainwire file: truncated preamble");
+        }
+        BrainwireIndex index = loadBrainwireIndex(data, size, [&](uint64_t offset, uint64_t count) {
+            return std::vector<uint8_t>(data + offset, data + offset + count);
+        });
+        checkNoSamplePlanes(index);
+        for (const IndexBlock &entry : index.blocks) {
+            ByteReader record(data + entry.offset, index.offset - entry.offset);
+            blocks.push_back(readBlockRecord(record));
+            if (blocks.back().count != entry.count) {
+                fatal("Corrupt .brainwire file: block record does not match index");
+            }
+        }
+        header = index.header;
+        sampleCount = index.sampleCount;
+    } else {
+        fatal("Unsupported .brainwire version " + std::to_string(version));
+    }
+    placeBlockRecords(blocks, sampleCount);
+    return blocks;
+}
+
+// Decode to `layout` (its channel count is taken from the header) into
+// `out`, which is resized to hold every sample
+inline void decodeBrainwire(const std::vector<uint8_t> &data, WavHeader &header, SampleLayout layout, std::vector<uint8_t> &out, int threads) {
+    uint64_t sampleCount;
+    std::vector<BlockRecord> blocks = readBrainwireRecords(data.data(), data.size(), header, sampleCount);
+    layout.channels = header.channels;
+    checkSampleLayout(layout, sampleCount);
+    resizeBuffer(out, sampleCount * sampleBytes(layout.format));
+    decodeBlockRecords(blocks, sampleCount, layout, out.data(), threads);
+}
+
+// Random access to the blocks of a .brainwire file on disk. Version 2
+// files read the preamble and index up front and block records on demand;
+// version 1 files have no index, so they are read whole and walked once.
+struct BrainwireSource {
+    std::ifstream file;
+    std::vector<uint8_t> data; // version 1 only
+    BrainwireIndex index;      // for version 1, offset is the end of the records
+    std::vector<uint64_t> firsts; // first sample of each block, then the total
+};
+
+inline BrainwireSource openBrainwireSource(const std::string &filename) {
+    BrainwireSource source;
+    source.file.open(filename, std::ios::binary);
+    if (!source.file) {
+        fatal("Error opening file: " + filename);
+    }
+    source.file.seekg(0, std::ios::end);
+    uint64_t fileSize = static_cast<uint64_t>(source.file.tellg());
+    if (fileSize < sizeof(FORMAT_MAGIC) + 1) {
+        fatal("Not a .brainwire file: " + filename);
+    }
+    std::vector<uint8_t> head = readFileRange(source.file, 0, sizeof(FORMAT_MAGIC) + 1);
+    if (memcmp(head.data(), FORMAT_MAGIC, sizeof(FORMAT_MAGIC)) != 0) {
+        fatal("Not a .brainwire file: " + filename);
+    }
+
+    if (head[sizeof(FORMAT_MAGIC)] == FORMAT_VERSION_STREAM) {
+        source.data = readFileRange(source.file, 0, fileSize);
+        ByteReader in(source.data.data(), source.data.size());
+        in.bytes(head.size());
+        source.index.sampleCount = in.varint();
+        source.index.header = readCompactHeader(in, source.index.sampleCount);
+        uint64_t blockCount = in.varint();
+        for (uint64_t b = 0; b < blockCount; ++b) {
+            uint64_t offset = in.pos;
+            BlockRecord block = readBlockRecord(in);
+            source.index.blocks.push_back({offset, block.count});
+        }
+        source.index.offset = in.pos;
+    } else if (head[sizeof(FORMAT_MAGIC)] == FORMAT_VERSION) {
+        if (fileSize < FORMAT_PREAMBLE_SIZE) {
+            fatal("Corrupt .brainwire file: truncated preamble");
+        }
+        std::vector<uint8_t> preamble = readFileRange(source.file, 0, FORMAT_PREAMBLE_SIZE);
+        source.index = loadBrainwireIndex(preamble.data(), fileSize, [&](uint64_t offset, uint64_t size) {
+            return readFileRange(source.file, offset, size);
+        });
+        checkNoSamplePlanes(source.index);
+    } else {
+        fatal("Unsupported .brainwire version " + std::to_string(head[sizeof(FORMAT_MAGIC)]));
+    }
+
+    uint64_t position = 0;
+    for (const IndexBlock &block : source.index.blocks) {
+        source.firsts.push_back(position);
+        position += block.count;
+    }
+    if (position != source.index.sampleCount) {
+        fatal("Corrupt .brainwire file: block sample counts do not match total");
+    }
+    source.firsts.push_back(position);
+    return source;
+}
+
+// Where block b's record ends at the latest (it may be followed by
+// unrelated bytes)
+inline uint64_t sourceRecordEnd(const BrainwireSource &source, size_t b) {
+    return b + 1 < source.index.blocks.size() ? source.index.blocks[b + 1].offset : source.index.offset;
+}
+
+inline std::vector<uint8_t> readSourceRange(BrainwireSource &source, uint64_t offset, uint64_t size) {
+    if (!source.data.empty()) {
+        return std::vector<uint8_t>(source.data.begin() + offset, source.data.begin() + offset + size);
+    }
+    return readFileRange(source.file, offset, size);
+}
+
+// The bytes of block b's record (possibly followed by unrelated bytes)
+inline std::vector<uint8_t> readSourceRecord(BrainwireSource &source, size_t b) {
+    uint64_t offset = source.index.blocks[b].offset;
+    return readSourceRange(source, offset, sourceRecordEnd(source, b) - offset);
+}
+
+// The preview layer of a version 2 file (see preview.h), reading only its
+// records, and the header of the preview as a recording
+inline void decodeBrainwirePreview(BrainwireSource &source, WavHeader &header, std::vector<int16_t> &preview, int threads) {
+    const BrainwireIndex &index = source.index;
+    if (index.previewFactor == 0) {
+        fatal("No preview layer in this file; encode it with --preview N");
+    }
+    // A record ends at the next record or the index, whichever comes first
+    std::vector<uint64_t> starts = {index.offset};
+    for (const IndexBlock &block : index.blocks) starts.push_back(block.offset);
+    for (const PreviewRecord &record : index.preview) starts.push_back(record.offset);
+    std::sort(starts.begin(), starts.end());
+    auto recordEnd = [&](uint64_t offset) { return *std::upper_bound(starts.begin(), starts.end(), offset); };
+
+    // Records written together lie back to back, so read each run at once
+    std::vector<std::vector<uint8_t>> runs;
+    std::vector<BlockRecord> records;
+    uint64_t total = 0;
+    for (size_t r = 0; r < index.preview.size();) {
+        size_t end = r + 1;
+        while (end < index.preview.size() && index.preview[end].offset == recordEnd(index.preview[end - 1].offset)) end++;
+        uint64_t first = index.preview[r].offset;
+        runs.push_back(readFileRange(source.file, first, recordEnd(index.preview[end - 1].offset) - first));
+        for (; r < end; ++r) {
+            ByteReader in(runs.back().data() + (index.preview[r].offset - first), recordEnd(index.preview[r].offset) - index.preview[r].offset);
+            records.push_back(readBlockRecord(in));
+            if (records.back().codec == CODEC_DUPLICATE || records.back().count > index.sampleCount) {
+                fatal("Corrupt .brainwire file: bad preview record");
+            }
+            total += records.back().count;
+        }
+    }
+    std::vector<int16_t> samples;
+    decodeBlockRecords(records, total, samples, threads);
+
+    // Place each record at its first preview sample; a later record's first
+    // sample redoes the group an append continued
+    uint64_t count = (index.sampleCount + index.previewFactor - 1) / index.previewFactor;
+    preview.assign(count, 0);
+    uint64_t covered = 0;
+    for (size_t r = 0; r < records.size(); ++r) {
+        uint64_t first = index.preview[r].first;
+        if (first > covered || records[r].count > count - first) {
+            fatal("Corrupt .brainwire file: preview records do not cover the recording");
+        }
+        std::copy(samples.begin() + records[r].first, samples.begin() + records[r].first + records[r].count, preview.begin() + first);
+        covered = std::max(covered, first + records[r].count);
+    }
+    if (covered != count) {
+        fatal("Corrupt .brainwire file: preview records do not cover the recording");
+    }
+    header = previewHeader(index.header, index.previewFactor, count);
+}
+
+inline void writeAt(int fd, uint64_t offset, const uint8_t *data, size_t size, const std::string &filename) {
+    while (size > 0) {
+        ssize_t written = pwrite(fd, data, size, static_cast<off_t>(offset));
+        if (written <= 0) {
+            fatal("Error writing file: " + filename);
+        }
+        data += written;
+        offset += written;
+        size -= written;
+    }
+}
+
+inline std::vector<uint8_t> readAt(int fd, uint64_t offset, uint64_t size, const std::string &filename) {
+    std::vector<uint8_t> bytes(size);
+    size_t done = 0;
+    while (done < size) {
+        ssize_t got = pread(fd, bytes.data() + done, size - done, static_cast<off_t>(offset + done));
+        if (got <= 0) {
+            fatal("Unexpected end of file: " + filename);
+        }
+        done += got;
+    }
+    return bytes;
+}
+
+// Encode `audioData` as new blocks at the end of an existing version 2
+// file. Reads the preamble and the index, writes the blocks and a new index
+// past the live one, syncs, then flips the older slot to the new index and
+// syncs again.
+inline void appendBrainwire(const std::string &filename, const WavHeader &header, const std::vector<int16_t> &audioData,
+                            const EncodeOptions &options, EncodeStats &stats) {
+    int fd = open(filename.c_str(), O_RDWR);
+    if (fd < 0) {
+        fatal("Error opening file: " + filename);
+    }
+    off_t fileSize = lseek(fd, 0, SEEK_END);
+    if (fileSize < static_cast<off_t>(FORMAT_PREAMBLE_SIZE)) {
+        fatal("Not an appendable .brainwire file: " + filename);
+    }
+    std::vector<uint8_t> preamble = readAt(fd, 0, FORMAT_PREAMBLE_SIZE, filename);
+    if (memcmp(preamble.data(), FORMAT_MAGIC, sizeof(FORMAT_MAGIC)) != 0) {
+        fatal("Not a .brainwire file: " + filename);
+    }
+    if (preamble[sizeof(FORMAT_MAGIC)] != FORMAT_VERSION) {
+        fatal("Cannot append to .brainwire version " + std::to_string(preamble[sizeof(FORMAT_MAGIC)]) + "; re-encode it first");
+    }
+    BrainwireIndex index = loadBrainwireIndex(preamble.data(), fileSize, [&](uint64_t offset, uint64_t size) {
+        return readAt(fd, offset, size, filename);
+    });
+
+    if (!sameSampleFormat(index.header, header)) {
+        fatal("Cannot append: sample format differs from " + filename);
+    }
+    if (index.planes) {
+        fatal("Cannot append: " + filename + " holds samples wider than 16 bits");
+    }
+
+    if (options.previewFactor > 0 && options.previewFactor != index.previewFactor) {
+        fatal(index.previewFactor > 0 ? "Cannot append: " + filename + " has a preview layer decimated by " + std::to_string(index.previewFactor)
+                                      : "Cannot append: " + filename + " has no preview layer to extend");
+    }
+
+    std::vector<PreparedBlock> blocks = encodeBlocks(options, audioData);
+    std::vector<uint8_t> out;
+    uint64_t start = index.end;
+    if (index.previewFactor > 0) {
+        appendPreviewRecords(out, start, audioData.data(), audioData.size(), options, index);
+        stats.previewBytes = out.size();
+    }
+    appendBlockRecords(out, start, blocks, index);
+    uint32_t appendedBytes = static_cast<uint32_t>(audioData.size() * sizeof(int16_t));
+    index.header.data_size += appendedBytes;
+    index.header.overall_size += appendedBytes;
+    index.generation++;
+    index.offset = start + out.size();
+    writeBrainwireIndex(out, index);
+
+    writeAt(fd, start, out.data(), out.size(), filename);
+    if (ftruncate(fd, static_cast<off_t>(start + out.size())) != 0 || fsync(fd) != 0) {
+        fatal("Error writing file: " + filename);
+    }
+    size_t slot = 1 - index.slot;
+    setIndexSlot(preamble.data(), slot, index.offset, static_cast<uint32_t>(start + out.size() - index.offset), index.generation);
+    writeAt(fd, sizeof(FORMAT_MAGIC) + 1 + slot * INDEX_SLOT_SIZE, preamble.data() + sizeof(FORMAT_MAGIC) + 1 + slot * INDEX_SLOT_SIZE,
+            INDEX_SLOT_SIZE, filename);
+    if (fsync(fd) != 0 || close(fd) != 0) {
+        fatal("Error writing file: " + filename);
+    }
+
+    stats.blocks.clear();
+    for (const PreparedBlock &block : blocks) stats.blocks.push_back(block.stats);
+    stats.outputBytes = out.size();
+}
+
+// A version 2 file written to disk as it is encoded, for recordings that do
+// not fit in memory: each chunk of samples is encoded and its records are
+// written at once, and the index and slot go in when the writer is closed.
+// Blocks never span chunks; each chunk starts its own table history.
+struct BrainwireWriter {
+    int fd = -1;
+    std::string filename;
+    EncodeOptions options;
+    BrainwireIndex index;
+    uint64_t position = 0; // bytes written
+    EncodeStats stats;
+};
+
+inline void openBrainwireWriter(BrainwireWriter &writer, const std::string &filename, const WavHeader &header, const EncodeOptions &options) {
+    writer.filename = filename;
+    writer.options = options;
+    writer.index.header = header;
+    if (options.previewFactor > 0) {
+        checkPreviewOptions(header, options.previewFactor);
+        writer.index.previewFactor = options.previewFactor;
+    }
+    writer.fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (writer.fd < 0) {
+        fatal("Error creating file: " + filename);
+    }
+    std::vector<uint8_t> preamble = beginBrainwireFile();
+    writeAt(writer.fd, 0, preamble.data(), preamble.size(), filename);
+    writer.position = preamble.size();
+}
+
+inline void writeBrainwireSamples(BrainwireWriter &writer, const std::vector<int16_t> &samples) {
+    if (samples.empty()) {
+        return;
+    }
+    std::vector<PreparedBlock> blocks = encodeBlocks(writer.options, samples);
+    std::vector<uint8_t> out;
+    if (writer.index.previewFactor > 0) {
+        appendPreviewRecords(out, writer.position, samples.data(), samples.size(), writer.options, writer.index);
+        writer.stats.previewBytes += out.size();
+    }
+    appendBlockRecords(out, writer.position, blocks, writer.index);
+    writeAt(writer.fd, writer.position, out.data(), out.size(), writer.filename);
+    writer.position += out.size();
+    for (const PreparedBlock &block : blocks) writer.stats.blocks.push_back(block.stats);
+}
+
+// Write the index and point slot 0 at it
+inline void closeBrainwireWriter(BrainwireWriter &writer) {
+    std::vector<uint8_t> out;
+    writer.index.generation = 1;
+    writer.index.offset = writer.position;
+    writeBrainwireIndex(out, writer.index);
+    writeAt(writer.fd, writer.position, out.data(), out.size(), writer.filename);
+    writer.position += out.size();
+
+    std::vector<uint8_t> preamble = beginBrainwireFile();
+    setIndexSlot(preamble.data(), 0, writer.index.offset, static_cast<uint32_t>(out.size()), writer.index.generation);
+    writeAt(writer.fd, 0, preamble.data(), preamble.size(), writer.filename);
+    if (close(writer.fd) != 0) {
+        fatal("Error writing file: " + writer.filename);
+    }
+    writer.fd = -1;
+    writer.stats.outputBytes = writer.position;
+}
+
+#endif
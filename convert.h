@@ -0,0 +1,107 @@
+#ifndef BRAINWIRE_CONVERT_H
+#define BRAINWIRE_CONVERT_H
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "common.h"
+
+// Decoded samples in the form a consumer wants them: int16 as stored, int32,
+// or float32 multiplied by a scale (e.g. microvolts per count), interleaved
+// as in the WAV or planar (all of channel 0, then channel 1, ...). The
+// decoder converts each block as soon as it is reconstructed, straight into
+// the caller's buffer.
+
+enum SampleFormat : uint8_t {
+    SAMPLES_INT16,
+    SAMPLES_INT32,
+    SAMPLES_FLOAT32,
+};
+
+struct SampleLayout {
+    SampleFormat format = SAMPLES_INT16;
+    float scale = 1.0f;    // float32 only
+    bool planar = false;
+    uint16_t channels = 1; // of the recording; only matters when planar
+};
+
+inline size_t sampleBytes(SampleFormat format) {
+    return format == SAMPLES_INT16 ? sizeof(int16_t) : format == SAMPLES_INT32 ? sizeof(int32_t) : sizeof(float);
+}
+
+inline SampleFormat parseSampleFormat(const std::string &name) {
+    if (name == "i16") return SAMPLES_INT16;
+    if (name == "i32") return SAMPLES_INT32;
+    if (name == "f32") return SAMPLES_FLOAT32;
+    fatal("Unknown sample format: " + name + " (use i16, i32 or f32)");
+}
+
+// Whether `layout` is plain interleaved int16, the WAV's own layout
+inline bool isWavLayout(const SampleLayout &layout) {
+    return layout.format == SAMPLES_INT16 && (!layout.planar || layout.channels == 1);
+}
+
+inline void checkSampleLayout(const SampleLayout &layout, uint64_t sampleCount) {
+    if (layout.channels == 0 || (layout.planar && sampleCount % layout.channels != 0)) {
+        fatal("Cannot split " + std::to_string(sampleCount) + " samples into " + std::to_string(layout.channels) + " channels");
+    }
+}
+
+template <typename T, typename Convert>
+void storeSamples(const int16_t *samples, size_t count, uint64_t first, uint64_t sampleCount, const SampleLayout &layout, T *out, Convert convert) {
+    if (!layout.planar || layout.channels == 1) {
+        for (size_t i = 0; i < count; ++i) out[first + i] = convert(samples[i]);
+        return;
+    }
+    uint64_t frames = sampleCount / layout.channels;
+    uint64_t channel = first % layout.channels, frame = first / layout.channels;
+    for (size_t i = 0; i < count; ++i) {
+        out[channel * frames + frame] = convert(samples[i]);
+        if (++channel == layout.channels) {
+            channel = 0;
+            frame++;
+        }
+    }
+}
+
+// Store samples [first, first + count) of a recording of `sampleCount`
+// samples into `out`, laid out as a whole recording in `layout`
+inline void convertSamples(const int16_t *samples, size_t count, uint64_t first, uint64_t sampleCount, const SampleLayout &layout, void *out) {
+    bool interleaved = !layout.planar || layout.channels == 1;
+    if (layout.format == SAMPLES_INT16) {
+        if (interleaved) {
+            memcpy(static_cast<int16_t*>(out) + first, samples, count * sizeof(int16_t));
+        } else {
+            storeSamples(samples, count, first, sampleCount, layout, static_cast<int16_t*>(out), [](int16_t x) { return x; });
+        }
+    } else if (layout.format == SAMPLES_INT32) {
+        storeSamples(samples, count, first, sampleCount, layout, static_cast<int32_t*>(out), [](int16_t x) { return static_cast<int32_t>(x); });
+    } else {
+        float scale = layout.scale;
+        size_t i = 0;
+#if defined(__SSE2__)
+        // 8 samples a step: sign-extend to 32 bits, convert, scale
+        if (interleaved) {
+            float *to = static_cast<float*>(out) + first;
+            const __m128 factor = _mm_set1_ps(scale);
+            for (; i + 8 <= count; i += 8) {
+                __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(samples + i));
+                __m128i low = _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16);
+                __m128i high = _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16);
+                _mm_storeu_ps(to + i, _mm_mul_ps(_mm_cvtepi32_ps(low), factor));
+                _mm_storeu_ps(to + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(high), factor));
+            }
+        }
+#endif
+        storeSamples(samples + i, count - i, first + i, sampleCount, layout, static_cast<float*>(out),
+                     [scale](int16_t x) { return static_cast<float>(x) * scale; });
+    }
+}
+
+#endif
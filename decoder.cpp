@@ -1,170 +1,141 @@
 #include <iostream>
 #include <fstream>
 #include <vector>
-#include <map>
-#include <queue>
-#include <bitset>
 #include <cstdint>
-
-// Structure to hold WAV file header
-struct WavHeader {
-    char riff[4];             // "RIFF"
-    uint32_t overall_size;    // overall size of file in bytes
-    char wave[4];             // "WAVE"
-    char fmt_chunk_marker[4]; // "fmt " string with trailing null char
-    uint32_t length_of_fmt;   // length of the format data
-    uint16_t format_type;     // format type
-    uint16_t channels;        // number of channels
-    uint32_t sample_rate;     // sampling rate (blocks per second)
-    uint32_t byterate;        // SampleRate * NumChannels * BitsPerSample/8
-    uint16_t block_align;     // NumChannels * BitsPerSample/8
-    uint16_t bits_per_sample; // bits per sample, 8- 8bits, 16- 16 bits etc
-    char data_chunk_header[4];// "data"
-    uint32_t data_size;       // data size
-};
-
-struct HuffmanNode {
-    int16_t sample;
-    HuffmanNode* left;
-    HuffmanNode* right;
-
-    HuffmanNode(int16_t sample) : sample(sample), left(nullptr), right(nullptr) {}
-    HuffmanNode() : sample(-1), left(nullptr), right(nullptr) {}
-};
-
-std::map<int16_t, std::string> readHuffmanCodes(std::ifstream &file) {
-    std::map<int16_t, std::string> huffmanCodes;
-    uint32_t huffmanCodeCount;
-    file.read(reinterpret_cast<char*>(&huffmanCodeCount), sizeof(huffmanCodeCount));
-
-    for (uint32_t i = 0; i < huffmanCodeCount; ++i) {
-        int16_t sample;
-        uint32_t codeLength;
-        file.read(reinterpret_cast<char*>(&sample), sizeof(sample));
-        file.read(reinterpret_cast<char*>(&codeLength), sizeof(codeLength));
-
-        std::string code(codeLength, '0');
-        file.read(&code[0], codeLength);
-
-        huffmanCodes[sample] = code;
-    }
-
-    return huffmanCodes;
+#include <cstring>
+
+#include "common.h"
+#include "wav.h"
+#include "codec.h"
+#include "container.h"
+#include "reader.h"
+#include "legacy.h"
+
+// Samples as raw little-endian values in `layout`, without a header
+void saveRawSamples(const std::string &filename, const WavHeader &header, SampleLayout layout, const std::vector<int16_t> &audioData) {
+    layout.channels = header.channels;
+    checkSampleLayout(layout, audioData.size());
+    std::vector<uint8_t> bytes(audioData.size() * sampleBytes(layout.format));
+    convertSamples(audioData.data(), audioData.size(), 0, audioData.size(), layout, bytes.data());
+    writeFileBytes(filename, bytes);
 }
 
-HuffmanNode* buildHuffmanTree(const std::map<int16_t, std::string> &huffmanCodes) {
-    HuffmanNode* root = new HuffmanNode();
-
-    for (const auto &pair : huffmanCodes) {
-        HuffmanNode* currentNode = root;
-        for (char bit : pair.second) {
-            if (bit == '0') {
-                if (!currentNode->left) {
-                    currentNode->left = new HuffmanNode();
-                }
-                currentNode = currentNode->left;
-            } else {
-                if (!currentNode->right) {
-                    currentNode->right = new HuffmanNode();
-                }
-                currentNode = currentNode->right;
-            }
+// Decode from a pipe, writing each chunk as it comes
+void decodePipe(BrainwireReader &reader, const std::string &filename, bool raw, SampleLayout layout) {
+    layout.channels = reader.header.channels;
+    if (layout.planar && layout.channels > 1) {
+        fatal("--planar needs a seekable input");
+    }
+    std::ofstream file(filename, std::ios::binary);
+    if (!file) {
+        fatal("Error creating file: " + filename);
+    }
+    if (!raw) {
+        file.write(reinterpret_cast<const char*>(&reader.header), sizeof(reader.header));
+    }
+    std::vector<int16_t> chunk(1 << 16);
+    std::vector<uint8_t> bytes;
+    uint64_t written = 0;
+    while (size_t count = readSamples(reader, chunk.data(), chunk.size())) {
+        bytes.resize(count * sampleBytes(layout.format));
+        convertSamples(chunk.data(), count, 0, count, layout, bytes.data());
+        // A WAV keeps its odd-sized data chunk without the pad byte (see saveWavFile)
+        size_t size = bytes.size();
+        if (!raw && reader.header.data_size % 2 == 1 && written + size == reader.header.data_size + 1u) {
+            size--;
         }
-        currentNode->sample = pair.first;
+        file.write(reinterpret_cast<const char*>(bytes.data()), size);
+        written += size;
     }
-
-    return root;
 }
 
-std::vector<int16_t> decodeAudioData(const std::string &encodedData, HuffmanNode* root) {
-    std::vector<int16_t> audioData;
-    HuffmanNode* currentNode = root;
-
-    for (char bit : encodedData) {
-        if (bit == '0') {
-            currentNode = currentNode->left;
+int main(int argc, char* argv[]) {
+    int threads = defaultThreadCount();
+    bool preview = false;
+    bool raw = false; // any of --format, --scale, --planar
+    bool formatGiven = false;
+    SampleLayout layout;
+    std::vector<std::string> paths;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--threads" && i + 1 < argc) {
+            threads = std::stoi(argv[++i]);
+        } else if (arg == "--preview") {
+            preview = true;
+        } else if (arg == "--format" && i + 1 < argc) {
+            layout.format = parseSampleFormat(argv[++i]);
+            raw = formatGiven = true;
+        } else if (arg == "--scale" && i + 1 < argc) {
+            layout.scale = std::stof(argv[++i]);
+            raw = true;
+        } else if (arg == "--planar") {
+            layout.planar = true;
+            raw = true;
         } else {
-            currentNode = currentNode->right;
-        }
-
-        if (currentNode->left == nullptr && currentNode->right == nullptr) {
-            audioData.push_back(currentNode->sample);
-            currentNode = root;
+            paths.push_back(arg);
         }
     }
 
-    return audioData;
-}
-
-std::string readEncodedData(std::ifstream &file, uint32_t encodedDataSize) {
-    std::string encodedData;
-    encodedData.reserve(encodedDataSize);
-
-    for (uint32_t i = 0; i < encodedDataSize; ++i) {
-        std::bitset<8> byte;
-        unsigned char c;
-        file.read(reinterpret_cast<char*>(&c), sizeof(c));
-        byte = std::bitset<8>(c);
-
-        for (size_t j = 0; j < 8 && encodedData.size() < encodedDataSize; ++j) {
-            encodedData.push_back(byte[j] ? '1' : '0');
-        }
+    if (paths.size() != 2) {
+        std::cerr << "Usage: " << argv[0] << " [--threads N] [--preview] [--format i16|i32|f32] [--scale UNITS_PER_COUNT] [--planar]\n"
+                  << "       <input_encoded_file> <output_file>" << std::endl;
+        return 1;
     }
-
-    return encodedData;
-}
-
-void saveWavFile(const std::string &filename, const WavHeader &header, const std::vector<int16_t> &audioData) {
-    std::ofstream file(filename, std::ios::binary);
-    if (!file) {
-        std::cerr << "Error creating file: " << filename << std::endl;
-        exit(1);
+    // --scale alone means float output, e.g. --scale 0.195 for microvolts
+    if (layout.scale != 1.0f && !formatGiven) {
+        layout.format = SAMPLES_FLOAT32;
+    } else if (layout.scale != 1.0f && layout.format != SAMPLES_FLOAT32) {
+        fatal("--scale only applies to f32 output");
     }
 
-    // Write the WAV header to the file
-    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    std::string inputFilePath = paths[0];
+    std::string outputFilePath = paths[1];
 
-    // Write the audio data to the file
-    file.write(reinterpret_cast<const char*>(audioData.data()), audioData.size() * sizeof(int16_t));
-}
+    WavHeader header;
+    std::vector<int16_t> audioData;
 
-int main(int argc, char* argv[]) {
-    if (argc != 3) {
-        std::cerr << "Usage: " << argv[0] << " <input_encoded_file> <output_wav_file>" << std::endl;
-        return 1;
+    // "-" reads a stream-layout file from standard input
+    if (inputFilePath == "-") {
+        BrainwireReader reader = openBrainwireReader(std::cin, threads);
+        decodePipe(reader, outputFilePath, raw, layout);
+        std::cout << "Decoding completed." << std::endl;
+        return 0;
     }
 
-    std::string inputFilePath = argv[1];
-    std::string outputFilePath = argv[2];
-
-    std::ifstream file(inputFilePath, std::ios::binary);
-    if (!file) {
-        std::cerr << "Error opening file: " << inputFilePath << std::endl;
-        return 1;
+    // --preview reads only the index and the preview layer
+    if (preview) {
+        BrainwireSource source = openBrainwireSource(inputFilePath);
+        decodeBrainwirePreview(source, header, audioData, threads);
+        if (raw) {
+            saveRawSamples(outputFilePath, header, layout, audioData);
+        } else {
+            saveWavFile(outputFilePath, header, audioData);
+        }
+        std::cout << "Preview decoded: " << audioData.size() << " samples, 1/" << source.index.previewFactor << " rate." << std::endl;
+        return 0;
     }
 
-    // Read the WAV header
-    WavHeader header;
-    file.read(reinterpret_cast<char*>(&header), sizeof(header));
-
-    // Read the Huffman codes
-    std::map<int16_t, std::string> huffmanCodes = readHuffmanCodes(file);
-
-    // Read the encoded data size
-    uint32_t encodedDataSize;
-    file.read(reinterpret_cast<char*>(&encodedDataSize), sizeof(encodedDataSize));
-
-    // Read the encoded data
-    std::string encodedData = readEncodedData(file, encodedDataSize);
-
-    // Build the Huffman tree
-    HuffmanNode* huffmanTree = buildHuffmanTree(huffmanCodes);
-
-    // Decode the audio data
-    std::vector<int16_t> audioData = decodeAudioData(encodedData, huffmanTree);
-
-    // Save the decoded audio data to a WAV file
-    saveWavFile(outputFilePath, header, audioData);
+    // Other layouts than the WAV's are written as raw samples, converted
+    // block by block as they are decoded
+    std::vector<uint8_t> data = readFileBytes(inputFilePath);
+    bool brainwire = data.size() >= sizeof(FORMAT_MAGIC) && memcmp(data.data(), FORMAT_MAGIC, sizeof(FORMAT_MAGIC)) == 0;
+    if (brainwire && raw) {
+        std::vector<uint8_t> samples;
+        decodeBrainwire(data, header, layout, samples, threads);
+        writeFileBytes(outputFilePath, samples);
+    } else {
+        if (brainwire) {
+            decodeBrainwire(data, header, audioData, threads);
+        } else {
+            decodeLegacy(data.data(), data.size(), header, audioData, threads);
+        }
+        if (raw) {
+            saveRawSamples(outputFilePath, header, layout, audioData);
+        } else {
+            // Save the decoded audio data to a WAV file
+            saveWavFile(outputFilePath, header, audioData);
+        }
+    }
 
     std::cout << "Decoding completed." << std::endl;
 
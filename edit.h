@@ -0,0 +1,330 @@
+#ifndef BRAINWIRE_EDIT_H
+#define BRAINWIRE_EDIT_H
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <algorithm>
+#include <cstdint>
+
+#include "common.h"
+#include "wav.h"
+#include "format.h"
+#include "codec.h"
+#include "container.h"
+
+// Cutting and concatenating .brainwire files in the compressed domain.
+//
+// Whole blocks are copied byte for byte; only a block split by a cut is
+// decoded, and just its kept samples are re-encoded. What can break is a
+// Huffman block's table reference ("the k-th most recent block with its own
+// tables"), since the blocks before it change. Every Huffman block is
+// therefore tagged with the identity of the tables it codes with, and when
+// the output is assembled a reference is renumbered if those tables are
+// still in the history, or the tables are copied into the block (their
+// serialized bytes, not re-derived) if they are not. The residual
+// bitstream is never touched.
+
+struct EditBlock {
+    uint8_t codec;
+    uint64_t count;
+    std::vector<uint8_t> payload;
+    int tableReference = 0;
+    size_t tableOffset = 0; // of the table reference byte
+    size_t dataOffset = 0;  // of the coded residuals
+    size_t tableId = 0;     // tables this Huffman block codes with
+    std::shared_ptr<const std::vector<uint8_t>> tableBytes; // and their serialized form
+    bool summarized = false;
+    BlockSummary summary;
+};
+
+struct EditStats {
+    size_t copiedBlocks = 0;
+    size_t copiedBytes = 0;
+    size_t reencodedBlocks = 0;
+    size_t reencodedSamples = 0;
+    size_t relinkedTables = 0;
+    size_t inlinedTables = 0;
+};
+
+inline EditBlock makeEditBlock(uint8_t codec, uint64_t count, const uint8_t *payload, size_t size) {
+    EditBlock block;
+    block.codec = codec;
+    block.count = count;
+    block.payload.assign(payload, payload + size);
+    BlockModel model = readBlockModel(codec, payload, size, count, false);
+    if (codec == CODEC_HUFFMAN) {
+        if (model.tableReference == TABLE_SHARED) {
+            fatal("Cannot edit a block that uses archive tables");
+        }
+        block.tableReference = model.tableReference;
+        block.tableOffset = model.tableOffset;
+        block.dataOffset = model.dataOffset;
+    }
+    return block;
+}
+
+// Block b of `source` from the `size` bytes of its record
+inline EditBlock parseEditBlock(const BrainwireSource &source, size_t b, const uint8_t *record, size_t size) {
+    ByteReader in(record, size);
+    BlockRecord parsed = readBlockRecord(in);
+    if (parsed.count != source.index.blocks[b].count) {
+        fatal("Corrupt .brainwire file: block record does not match index");
+    }
+    if (parsed.codec == CODEC_DUPLICATE) {
+        fatal("Corrupt .brainwire file: duplicate block outside an archive");
+    }
+    EditBlock block = makeEditBlock(parsed.codec, parsed.count, parsed.payload, parsed.size);
+    if (!source.index.zones.empty()) {
+        block.summarized = true;
+        block.summary = source.index.zones[b];
+    }
+    return block;
+}
+
+inline EditBlock readEditBlock(BrainwireSource &source, size_t b) {
+    std::vector<uint8_t> bytes = readSourceRecord(source, b);
+    return parseEditBlock(source, b, bytes.data(), bytes.size());
+}
+
+// Tables some Huffman block sent, and their identity
+struct EditTables {
+    size_t id = 0;
+    std::shared_ptr<const std::vector<uint8_t>> bytes;
+};
+
+// Tag the Huffman blocks of a run that was coded together (one file, or
+// one re-encoded batch) with their tables, following its references.
+// `recent` holds the tables of the blocks before the run, most recent
+// first, and is left holding those after it.
+inline void resolveEditTables(std::vector<EditBlock> &blocks, size_t &nextTableId, std::vector<EditTables> *recent = nullptr) {
+    std::vector<EditTables> local;
+    std::vector<EditTables> &history = recent ? *recent : local; // most recent first
+    for (EditBlock &block : blocks) {
+        if (block.codec != CODEC_HUFFMAN) {
+            continue;
+        }
+        if (block.tableReference == 0) {
+            block.tableId = nextTableId++;
+            block.tableBytes = std::make_shared<const std::vector<uint8_t>>(block.payload.begin() + block.tableOffset + 1,
+                                                                             block.payload.begin() + block.dataOffset);
+            history.insert(history.begin(), {block.tableId, block.tableBytes});
+            if (history.size() > static_cast<size_t>(TABLE_HISTORY)) {
+                history.pop_back();
+            }
+        } else if (static_cast<size_t>(block.tableReference) > history.size()) {
+            fatal("Corrupt .brainwire file: table reference before any tables");
+        } else {
+            block.tableId = history[block.tableReference - 1].id;
+            block.tableBytes = history[block.tableReference - 1].bytes;
+        }
+    }
+}
+
+// Fix up table references for the blocks in their new order
+inline void relinkEditTables(std::vector<EditBlock> &blocks, EditStats &stats) {
+    std::vector<size_t> history; // table ids, most recent first
+    for (EditBlock &block : blocks) {
+        if (block.codec != CODEC_HUFFMAN) {
+            continue;
+        }
+        if (block.tableReference != 0) {
+            auto found = std::find(history.begin(), history.end(), block.tableId);
+            if (found != history.end()) {
+                int reference = static_cast<int>(found - history.begin()) + 1;
+                if (reference != block.tableReference) {
+                    block.payload[block.tableOffset] = static_cast<uint8_t>(reference);
+                    block.tableReference = reference;
+                    stats.relinkedTables++;
+                }
+                continue;
+            }
+            std::vector<uint8_t> payload(block.payload.begin(), block.payload.begin() + block.tableOffset);
+            payload.push_back(0);
+            payload.insert(payload.end(), block.tableBytes->begin(), block.tableBytes->end());
+            block.dataOffset = payload.size();
+            payload.insert(payload.end(), block.payload.begin() + block.tableOffset + 1, block.payload.end());
+            block.payload = std::move(payload);
+            block.tableReference = 0;
+            stats.inlinedTables++;
+        }
+        history.insert(history.begin(), block.tableId);
+        if (history.size() > static_cast<size_t>(TABLE_HISTORY)) {
+            history.pop_back();
+        }
+    }
+}
+
+inline std::vector<int16_t> decodeEditBlock(const EditBlock &block) {
+    BlockModel model = readBlockModel(block.codec, block.payload.data(), block.payload.size(), block.count, false);
+    if (block.codec == CODEC_HUFFMAN) {
+        ByteReader in(block.tableBytes->data(), block.tableBytes->size());
+        model.huffman = std::make_shared<const HuffmanDecoder>(buildHuffmanDecoder(readEntropyTables(in)));
+    }
+    std::vector<int16_t> samples(block.count);
+    decodeBlock(block.codec, block.payload.data(), block.payload.size(), model, samples.data(), block.count);
+    return samples;
+}
+
+inline void reencodeSamples(const EncodeOptions &options, const std::vector<int16_t> &samples, std::vector<EditBlock> &out,
+                            size_t &nextTableId, EditStats &stats) {
+    std::vector<EditBlock> batch;
+    for (const PreparedBlock &block : encodeBlocks(options, samples)) {
+        batch.push_back(makeEditBlock(block.stats.codec, block.stats.samples, block.payload.data(), block.payload.size()));
+        batch.back().summarized = true;
+        batch.back().summary = block.summary;
+    }
+    resolveEditTables(batch, nextTableId);
+    stats.reencodedBlocks += batch.size();
+    stats.reencodedSamples += samples.size();
+    out.insert(out.end(), std::make_move_iterator(batch.begin()), std::make_move_iterator(batch.end()));
+}
+
+inline std::vector<uint8_t> writeEditedFile(const WavHeader &header, std::vector<EditBlock> &blocks, EditStats &stats) {
+    relinkEditTables(blocks, stats);
+    std::vector<uint8_t> out = beginBrainwireFile();
+    BrainwireIndex index;
+    index.header = header;
+    bool zoned = std::all_of(blocks.begin(), blocks.end(), [](const EditBlock &block) { return block.summarized; });
+    for (const EditBlock &block : blocks) {
+        if (zoned) index.zones.push_back(block.summary);
+        index.blocks.push_back({out.size(), block.count});
+        index.sampleCount += block.count;
+        writeBlockRecord(out, block.codec, block.count, block.payload);
+    }
+    finishBrainwireFile(out, index);
+    return out;
+}
+
+// Header for `sampleCount` samples in the format of `header`, keeping any
+// bytes it declares beyond the data chunk
+inline WavHeader resizedHeader(const WavHeader &header, uint64_t sampleCount) {
+    WavHeader resized = header;
+    resized.data_size = static_cast<uint32_t>(sampleCount * sizeof(int16_t));
+    resized.overall_size = header.overall_size - header.data_size + resized.data_size;
+    return resized;
+}
+
+// What the blocks before edited ranges add to the table history: for each
+// block whether it sends its own tables (-1 until known) and, if so, which.
+// A block is looked at once however many ranges reach back over it.
+struct EditTableCache {
+    std::vector<int8_t> own;
+    std::vector<EditTables> tables;
+    uint64_t bytesRead = 0; // of records read only for their tables
+};
+
+// Note the blocks [firstBlock, ...) read and resolved in full
+inline void cacheEditTables(EditTableCache &cache, size_t firstBlock, const std::vector<EditBlock> &blocks) {
+    for (size_t b = 0; b < blocks.size(); ++b) {
+        bool own = blocks[b].codec == CODEC_HUFFMAN && blocks[b].tableReference == 0;
+        cache.own[firstBlock + b] = own;
+        if (own) cache.tables[firstBlock + b] = {blocks[b].tableId, blocks[b].tableBytes};
+    }
+}
+
+// The tables of the last `depth` blocks before `block` with their own, most
+// recent first (fewer if the file starts first). Blocks not yet known have
+// just the head of their record read, up to the end of the tables.
+inline std::vector<EditTables> editTablesBefore(BrainwireSource &source, size_t block, int depth, size_t &nextTableId, EditTableCache &cache) {
+    std::vector<EditTables> history;
+    while (block > 0 && history.size() < static_cast<size_t>(depth)) {
+        block--;
+        if (cache.own[block] < 0) {
+            uint64_t offset = source.index.blocks[block].offset;
+            uint64_t headSize = 0;
+            std::vector<uint8_t> tables;
+            bool own = readRecordTables([&](uint64_t at, uint64_t size) {
+                headSize = size;
+                return readSourceRange(source, at, size);
+            }, offset, sourceRecordEnd(source, block), source.index.blocks[block].count, tables);
+            cache.bytesRead += headSize;
+            cache.own[block] = own;
+            if (own) cache.tables[block] = {nextTableId++, std::make_shared<const std::vector<uint8_t>>(std::move(tables))};
+        }
+        if (cache.own[block]) {
+            history.push_back(cache.tables[block]);
+        }
+    }
+    return history;
+}
+
+// Blocks [firstBlock, lastBlock] of `source` with their tables resolved.
+// Of the blocks before them only as many with their own tables are found as
+// the range's references reach back for, and only their tables are read.
+// The range's records lie back to back, so they are read in one go.
+inline std::vector<EditBlock> readEditBlocks(BrainwireSource &source, size_t firstBlock, size_t lastBlock, size_t &nextTableId,
+                                             EditTableCache &cache) {
+    if (cache.own.empty()) {
+        cache.own.assign(source.index.blocks.size(), -1);
+        cache.tables.resize(source.index.blocks.size());
+    }
+    uint64_t start = source.index.blocks[firstBlock].offset;
+    std::vector<uint8_t> bytes = readSourceRange(source, start, sourceRecordEnd(source, lastBlock) - start);
+    std::vector<EditBlock> blocks;
+    for (size_t b = firstBlock; b <= lastBlock; ++b) {
+        uint64_t offset = source.index.blocks[b].offset;
+        blocks.push_back(parseEditBlock(source, b, bytes.data() + (offset - start), sourceRecordEnd(source, b) - offset));
+    }
+    int depth = tableHistoryDepth(blocks.size(), [&](size_t b) { return blocks[b].codec == CODEC_HUFFMAN ? blocks[b].tableReference : -1; });
+    std::vector<EditTables> history = editTablesBefore(source, firstBlock, depth, nextTableId, cache);
+    resolveEditTables(blocks, nextTableId, &history);
+    cacheEditTables(cache, firstBlock, blocks);
+    return blocks;
+}
+
+// Samples [first, last) of `source`: the blocks overlapping the range, the
+// ones at its edges re-encoded
+inline std::vector<uint8_t> cutBrainwire(BrainwireSource &source, uint64_t first, uint64_t last, const EncodeOptions &options, EditStats &stats) {
+    const std::vector<uint64_t> &firsts = source.firsts;
+    if (first >= last || last > firsts.back()) {
+        fatal("Range " + std::to_string(first) + ":" + std::to_string(last) + " is outside the recording (" +
+              std::to_string(firsts.back()) + " samples)");
+    }
+    size_t firstBlock = std::upper_bound(firsts.begin(), firsts.end(), first) - firsts.begin() - 1;
+    size_t lastBlock = std::upper_bound(firsts.begin(), firsts.end(), last - 1) - firsts.begin() - 1;
+    size_t nextTableId = 0;
+    EditTableCache cache;
+    std::vector<EditBlock> blocks = readEditBlocks(source, firstBlock, lastBlock, nextTableId, cache);
+
+    std::vector<EditBlock> output;
+    for (size_t b = firstBlock; b <= lastBlock; ++b) {
+        EditBlock &block = blocks[b - firstBlock];
+        uint64_t keepFirst = std::max(first, firsts[b]);
+        uint64_t keepLast = std::min(last, firsts[b + 1]);
+        if (keepFirst == firsts[b] && keepLast == firsts[b + 1]) {
+            stats.copiedBlocks++;
+            stats.copiedBytes += block.payload.size();
+            output.push_back(std::move(block));
+            continue;
+        }
+        std::vector<int16_t> samples = decodeEditBlock(block);
+        reencodeSamples(options, std::vector<int16_t>(samples.begin() + (keepFirst - firsts[b]), samples.begin() + (keepLast - firsts[b])),
+                        output, nextTableId, stats);
+    }
+    return writeEditedFile(resizedHeader(source.index.header, last - first), output, stats);
+}
+
+// The recordings one after another; every block is copied
+inline std::vector<uint8_t> concatBrainwire(std::vector<BrainwireSource> &sources, EditStats &stats) {
+    std::vector<EditBlock> output;
+    size_t nextTableId = 0;
+    uint64_t sampleCount = 0;
+    for (BrainwireSource &source : sources) {
+        if (!sameSampleFormat(sources[0].index.header, source.index.header)) {
+            fatal("Cannot concatenate recordings with different sample formats");
+        }
+        std::vector<EditBlock> blocks;
+        for (size_t b = 0; b < source.index.blocks.size(); ++b) {
+            blocks.push_back(readEditBlock(source, b));
+            stats.copiedBlocks++;
+            stats.copiedBytes += blocks.back().payload.size();
+        }
+        resolveEditTables(blocks, nextTableId);
+        output.insert(output.end(), std::make_move_iterator(blocks.begin()), std::make_move_iterator(blocks.end()));
+        sampleCount += source.index.sampleCount;
+    }
+    return writeEditedFile(resizedHeader(sources[0].index.header, sampleCount), output, stats);
+}
+
+#endif
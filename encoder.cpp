@@ -1,171 +1,95 @@
 #include <iostream>
 #include <fstream>
 #include <vector>
-#include <map>
-#include <queue>
-#include <bitset>
+#include <string>
+#include <thread>
 #include <cstdint>
 
-// Structure to hold WAV file header
-struct WavHeader {
-    char riff[4];             // "RIFF"
-    uint32_t overall_size;    // overall size of file in bytes
-    char wave[4];             // "WAVE"
-    char fmt_chunk_marker[4]; // "fmt " string with trailing null char
-    uint32_t length_of_fmt;   // length of the format data
-    uint16_t format_type;     // format type
-    uint16_t channels;        // number of channels
-    uint32_t sample_rate;     // sampling rate (blocks per second)
-    uint32_t byterate;        // SampleRate * NumChannels * BitsPerSample/8
-    uint16_t block_align;     // NumChannels * BitsPerSample/8
-    uint16_t bits_per_sample; // bits per sample, 8- 8bits, 16- 16 bits etc
-    char data_chunk_header[4];// "data"
-    uint32_t data_size;       // data size
-};
+#include "common.h"
+#include "wav.h"
+#include "codec.h"
+#include "container.h"
+#include "cli.h"
 
-std::vector<int16_t> readWavFile(const std::string &filename, WavHeader &header) {
-    std::ifstream file(filename, std::ios::binary);
-    if (!file) {
-        std::cerr << "Error opening file: " << filename << std::endl;
-        exit(1);
-    }
-
-    file.read(reinterpret_cast<char*>(&header), sizeof(WavHeader));
-
-    // Check if it's a valid WAV file
-    if (std::string(header.riff, 4) != "RIFF" || std::string(header.wave, 4) != "WAVE") {
-        std::cerr << "Invalid WAV file: " << filename << std::endl;
-        exit(1);
+int main(int argc, char* argv[]) {
+    bool showStats = false;
+    bool append = false;
+    bool stream = false;
+    EncodeOptions options;
+    FeatureOptions featureOptions;
+    std::string featurePath;
+    std::vector<std::string> paths;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--stats") {
+            showStats = true;
+        } else if (arg == "--append") {
+            append = true;
+        } else if (arg == "--stream") {
+            stream = true;
+        } else if (arg == "--preview" && i + 1 < argc) {
+            options.previewFactor = static_cast<uint32_t>(std::stoul(argv[++i]));
+        } else if (!parseEncodeOption(argc, argv, i, options) && !parseFeatureOption(argc, argv, i, featureOptions, featurePath)) {
+            paths.push_back(arg);
+        }
     }
 
-    std::vector<int16_t> audioData(header.data_size / sizeof(int16_t));
-    file.read(reinterpret_cast<char*>(audioData.data()), header.data_size);
-    return audioData;
-}
-
-std::map<int16_t, int> calculateFrequencies(const std::vector<int16_t> &audioData) {
-    std::map<int16_t, int> frequencies;
-    for (int16_t sample : audioData) {
-        frequencies[sample]++;
+    if (paths.size() != 2) {
+        std::cerr << "Usage: " << argv[0] << " [--stats] [--append | --stream] [--preview FACTOR] " << ENCODE_OPTIONS_USAGE << "\n"
+                  << "       " << FEATURE_OPTIONS_USAGE << "\n"
+                  << "       <input_wav_file> <output_encoded_file>" << std::endl;
+        return 1;
     }
-    return frequencies;
-}
 
-struct HuffmanNode {
-    int16_t sample;
-    int frequency;
-    HuffmanNode* left;
-    HuffmanNode* right;
+    std::string inputFilePath = paths[0];
+    std::string outputFilePath = paths[1];
 
-    HuffmanNode(int16_t sample, int frequency) : sample(sample), frequency(frequency), left(nullptr), right(nullptr) {}
-};
+    WavHeader header;
+    std::vector<int16_t> audioData = readWavFile(inputFilePath, header);
 
-struct Compare {
-    bool operator()(HuffmanNode* l, HuffmanNode* r) {
-        return l->frequency > r->frequency;
+    // Features are computed on their own thread while the blocks are encoded
+    if (!featurePath.empty() && append) {
+        fatal("--features cannot be combined with --append");
     }
-};
-
-HuffmanNode* buildHuffmanTree(const std::map<int16_t, int> &frequencies) {
-    std::priority_queue<HuffmanNode*, std::vector<HuffmanNode*>, Compare> minHeap;
-    
-    for (const auto &pair : frequencies) {
-        minHeap.push(new HuffmanNode(pair.first, pair.second));
+    if (!featurePath.empty() && pcmFormat(header) != PCM_S16) {
+        fatal("--features needs 16-bit samples");
     }
-
-    while (minHeap.size() > 1) {
-        HuffmanNode* left = minHeap.top();
-        minHeap.pop();
-        HuffmanNode* right = minHeap.top();
-        minHeap.pop();
-
-        HuffmanNode* combined = new HuffmanNode(-1, left->frequency + right->frequency);
-        combined->left = left;
-        combined->right = right;
-
-        minHeap.push(combined);
+    // The filters and crossing counts run over consecutive samples, which
+    // interleaved channels are not
+    if (!featurePath.empty() && header.channels != 1) {
+        fatal("--features needs a single-channel recording");
     }
-
-    return minHeap.top();
-}
-
-void generateCodes(HuffmanNode* root, const std::string &str, std::map<int16_t, std::string> &huffmanCodes) {
-    if (!root) return;
-
-    if (root->sample != -1) {
-        huffmanCodes[root->sample] = str;
+    FeatureSet features;
+    std::thread featureThread;
+    if (!featurePath.empty()) {
+        featureThread = std::thread([&]() {
+            features = extractFeatures(audioData.data(), audioData.size(), header.sample_rate, featureOptions);
+        });
     }
 
-    generateCodes(root->left, str + "0", huffmanCodes);
-    generateCodes(root->right, str + "1", huffmanCodes);
-}
-
-std::string encodeAudioData(const std::vector<int16_t> &audioData, const std::map<int16_t, std::string> &huffmanCodes) {
-    std::string encodedData;
-    for (int16_t sample : audioData) {
-        encodedData += huffmanCodes.at(sample);
+    // --append adds the samples to an existing file in place; --stream
+    // writes the index-free layout a pipe can carry
+    EncodeStats stats;
+    if (stream && append) {
+        fatal("--stream cannot be combined with --append");
+    } else if (stream) {
+        writeFileBytes(outputFilePath, encodeBrainwireStream(header, audioData, options, stats));
+    } else if (append && std::ifstream(outputFilePath)) {
+        appendBrainwire(outputFilePath, header, audioData, options, stats);
+    } else {
+        std::vector<uint8_t> encoded = encodeBrainwire(header, audioData, options, stats);
+        writeFileBytes(outputFilePath, encoded);
     }
-    return encodedData;
-}
-
-void saveEncodedFile(const std::string &filename, const WavHeader &header, const std::string &encodedData, const std::map<int16_t, std::string> &huffmanCodes) {
-    std::ofstream file(filename, std::ios::binary);
-    if (!file) {
-        std::cerr << "Error creating file: " << filename << std::endl;
-        exit(1);
-    }
-
-    // Write the WAV header to the file
-    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
-
-    // Write the Huffman codes to the file
-    uint32_t huffmanCodeCount = huffmanCodes.size();
-    file.write(reinterpret_cast<char*>(&huffmanCodeCount), sizeof(huffmanCodeCount));
-    for (const auto &pair : huffmanCodes) {
-        file.write(reinterpret_cast<const char*>(&pair.first), sizeof(pair.first));
-        uint32_t codeLength = pair.second.size();
-        file.write(reinterpret_cast<const char*>(&codeLength), sizeof(codeLength));
-        file.write(pair.second.data(), codeLength);
+    if (featureThread.joinable()) {
+        featureThread.join();
+        writeFileBytes(featurePath, writeFeatureSidecar(features));
     }
 
-    // Write the encoded data size
-    uint32_t encodedDataSize = encodedData.size();
-    file.write(reinterpret_cast<char*>(&encodedDataSize), sizeof(encodedDataSize));
-
-    // Write the encoded data as bits
-    std::bitset<8> byte;
-    for (size_t i = 0; i < encodedData.size(); ++i) {
-        byte[i % 8] = encodedData[i] == '1';
-        if (i % 8 == 7 || i == encodedData.size() - 1) {
-            unsigned char c = static_cast<unsigned char>(byte.to_ulong());
-            file.write(reinterpret_cast<const char*>(&c), sizeof(c));
-            byte.reset();
-        }
-    }
-}
-
-int main(int argc, char* argv[]) {
-    if (argc != 3) {
-        std::cerr << "Usage: " << argv[0] << " <input_wav_file> <output_encoded_file>" << std::endl;
-        return 1;
+    if (showStats) {
+        printStats(stats, audioData.size());
     }
 
-    std::string inputFilePath = argv[1];
-    std::string outputFilePath = argv[2];
-
-    WavHeader header;
-    std::vector<int16_t> audioData = readWavFile(inputFilePath, header);
-
-    std::map<int16_t, int> frequencies = calculateFrequencies(audioData);
-    HuffmanNode* huffmanTree = buildHuffmanTree(frequencies);
-
-    std::map<int16_t, std::string> huffmanCodes;
-    generateCodes(huffmanTree, "", huffmanCodes);
-
-    std::string encodedData = encodeAudioData(audioData, huffmanCodes);
-    saveEncodedFile(outputFilePath, header, encodedData, huffmanCodes);
-
     std::cout << "Encoding completed." << std::endl;
 
     return 0;
-}
\ No newline at end of file
+}
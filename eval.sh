@@ -7,11 +7,25 @@ get_file_size() {
   stat -f%z "$1"
 }
 
+# Wall-clock seconds with sub-second resolution (portable to macOS)
+now() {
+  perl -MTime::HiRes=time -e 'printf "%.6f\n", time'
+}
+
+# Extra encoder flags, e.g. ENCODER_FLAGS="--codec cm" ./eval.sh
+ENCODER_FLAGS=${ENCODER_FLAGS:-}
+
+# Large buffers use transparent huge pages unless BRAINWIRE_HUGE_PAGES=0;
+# run once with each to compare
+HUGE_PAGES=$([ "${BRAINWIRE_HUGE_PAGES:-1}" = "0" ] && echo off || echo on)
+
 
 total_size_raw=0
 encoder_size=$(get_file_size encode)
 decoder_size=$(get_file_size decode)
 total_size_compressed=$((encoder_size + decoder_size))
+encode_seconds=0
+decode_seconds=0
 
 for file in data/*
 do
@@ -19,8 +33,13 @@ do
   compressed_file_path="${file}.brainwire"
   decompressed_file_path="${file}.copy"
 
-  ./encoder "$file" "$compressed_file_path"
+  start=$(now)
+  ./encoder $ENCODER_FLAGS "$file" "$compressed_file_path"
+  middle=$(now)
   ./decoder "$compressed_file_path" "$decompressed_file_path"
+  end=$(now)
+  encode_seconds=$(echo "${encode_seconds} + ${middle} - ${start}" | bc)
+  decode_seconds=$(echo "${decode_seconds} + ${end} - ${middle}" | bc)
 
   file_size=$(get_file_size "$file")
   compressed_size=$(get_file_size "$compressed_file_path")
@@ -37,8 +56,13 @@ do
 done
 
 compression_ratio=$(echo "scale=2; ${total_size_raw} / ${total_size_compressed}" | bc)
+encode_speed=$(echo "scale=2; ${total_size_raw} / 1000000 / ${encode_seconds}" | bc)
+decode_speed=$(echo "scale=2; ${total_size_raw} / 1000000 / ${decode_seconds}" | bc)
 
 echo "All recordings successfully compressed."
 echo "Original size (bytes): ${total_size_raw}"
 echo "Compressed size (bytes): ${total_size_compressed}"
 echo "Compression ratio: ${compression_ratio}"
+echo "Encode speed (MB/s): ${encode_speed}"
+echo "Decode speed (MB/s): ${decode_speed}"
+echo "Huge pages: ${HUGE_PAGES}"
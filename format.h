@@ -0,0 +1,93 @@
+#ifndef BRAINWIRE_FORMAT_H
+#define BRAINWIRE_FORMAT_H
+
+#include <cstdint>
+
+// .brainwire file layout (all integers little-endian):
+//
+//   magic "BRWR", version byte (2)
+//   two index slots, each: uint64 index offset, uint32 index size,
+//     uint32 generation (0 = empty)
+//   block records, each:
+//     codec id byte
+//     varint sample count
+//     varint payload size
+//     payload
+//   index (at the offset in the valid slot with the highest generation):
+//     varint generation
+//     varint total sample count
+//     WAV header: template id, then its fields (see writeCompactHeader) or
+//       the 44 original bytes; template 2 marks sample planes (see pcm.h)
+//     varint block count
+//     per block: varint record offset as a delta from the previous
+//       record's (the first from the end of the slots), varint sample count
+//     optionally, per block: zone map (see writeBlockSummary)
+//     optionally, after the zone maps, the preview layer (see preview.h):
+//       varint decimation factor, zigzag varint sum of the last partial
+//       group, varint record count, then per record: varint offset as a
+//       delta from the previous preview record's (the first from the end
+//       of the slots), varint first preview sample
+//     uint64 hash of the index bytes above (see hashBytes)
+//
+// Preview records are ordinary block records of the decimated samples,
+// written just before the full-rate blocks of the same encode or append;
+// only the index's preview list points at them.
+//
+// Files grow in place: an append writes the new blocks and a new index
+// after the live index, syncs, then points the other slot at the new index
+// and syncs again. A crash at any point leaves one slot naming an intact
+// index, and indexes that fail their hash are ignored. Anything past the
+// live index is leftover from an interrupted append and is overwritten.
+//
+// Version 1 files hold a single stream body after the version byte: varint
+// total sample count, WAV header, varint block count, then the block
+// records. Archive recordings use the same stream body (see archive.h).
+//
+// CODEC_STORED blocks hold the samples verbatim as 16-bit PCM.
+// CODEC_DUPLICATE blocks (archives only) hold the varint archive offset of
+// an earlier block record with the same samples. All other block payloads
+// start with the prediction stage:
+//   model flags byte
+//   if MODEL_RUNS: constant/ramp runs (see writeRuns); the stages below
+//     only see the samples outside them
+//   if MODEL_VALUE_MAP: value map (see writeValueMap), prediction on ranks
+//   if MODEL_LPC: predictor order, shift and coefficients
+//   if MODEL_SPIKE_TEMPLATES: spike events (see writeSpikeEvents)
+// followed by the coded residuals, by codec:
+//   CODEC_HUFFMAN  table reference byte: 0 = entropy tables follow (see
+//                  writeEntropyTables); k = reuse the tables of the k-th
+//                  most recent Huffman block that carried its own (k up to
+//                  TABLE_HISTORY); TABLE_SHARED = varint index into the
+//                  enclosing archive's shared tables; then the
+//                  context-switched bitstream
+//   CODEC_CM       context-mixing arithmetic coded stream
+//
+// Files written before the format had a magic start with the raw "RIFF"
+// header instead; the decoder still reads those (legacy.h), in parallel
+// despite their single bitstream.
+
+const char FORMAT_MAGIC[4] = {'B', 'R', 'W', 'R'};
+const uint8_t FORMAT_VERSION = 2;
+const uint8_t FORMAT_VERSION_STREAM = 1;
+const size_t INDEX_SLOTS = 2;
+const size_t INDEX_SLOT_SIZE = sizeof(uint64_t) + 2 * sizeof(uint32_t);
+const size_t FORMAT_PREAMBLE_SIZE = sizeof(FORMAT_MAGIC) + 1 + INDEX_SLOTS * INDEX_SLOT_SIZE;
+const int TABLE_HISTORY = 4;
+const uint8_t TABLE_SHARED = 0xFF;
+const size_t SHARED_TABLE_CANDIDATES = 8;
+
+enum CodecId : uint8_t {
+    CODEC_HUFFMAN = 1,
+    CODEC_CM = 2,
+    CODEC_STORED = 3,
+    CODEC_DUPLICATE = 4,
+};
+
+enum ModelFlags : uint8_t {
+    MODEL_SPIKE_TEMPLATES = 1,
+    MODEL_VALUE_MAP = 2,
+    MODEL_LPC = 4,
+    MODEL_RUNS = 8,
+};
+
+#endif
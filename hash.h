@@ -0,0 +1,108 @@
+#ifndef BRAINWIRE_HASH_H
+#define BRAINWIRE_HASH_H
+
+#include <cstdint>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+// 64-bit content hash for deduplication, built like XXH3's long-input loop:
+// 64-byte stripes feed eight 64-bit lanes, each adding the data word and the
+// product of the low and high halves of (word ^ key). That product is one
+// _mm_mul_epu32, so the loop runs four (AVX2) or two (SSE2) lanes per
+// instruction. Not bit-compatible with XXH3.
+//
+// Archive deduplication confirms matches with memcmp, but the value is also
+// the checksum stored in every .brainwire index (writeBrainwireIndex), so it
+// is part of the file format: changing the function breaks existing files,
+// and the AVX2, SSE2 and scalar paths must stay bit-identical.
+
+const uint64_t HASH_PRIME_1 = 0x9E3779B185EBCA87ULL;
+const uint64_t HASH_PRIME_2 = 0xC2B2AE3D27D4EB4FULL;
+const uint64_t HASH_PRIME_3 = 0x165667B19E3779F9ULL;
+const size_t HASH_STRIPE = 64;
+
+alignas(32) const uint64_t HASH_KEY[8] = {
+    0xBE4BA423396CFEB8ULL, 0x1CAD21F72C81017CULL, 0xDB979083E96DD4DEULL, 0x1F67B3B7A4A44072ULL,
+    0x78E5C0CC4EE679CBULL, 0x2172FFCC7DD05A82ULL, 0x8E2443F7744608B8ULL, 0x4C263A81E69035E0ULL,
+};
+
+inline uint64_t hashAvalanche(uint64_t h) {
+    h ^= h >> 37;
+    h *= HASH_PRIME_3;
+    h ^= h >> 32;
+    return h;
+}
+
+inline void hashStripes(uint64_t acc[8], const uint8_t *data, size_t stripes) {
+#if defined(__AVX2__)
+    __m256i a0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(acc));
+    __m256i a1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(acc + 4));
+    const __m256i k0 = _mm256_load_si256(reinterpret_cast<const __m256i*>(HASH_KEY));
+    const __m256i k1 = _mm256_load_si256(reinterpret_cast<const __m256i*>(HASH_KEY + 4));
+    for (size_t s = 0; s < stripes; ++s, data += HASH_STRIPE) {
+        __m256i d0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data));
+        __m256i d1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + 32));
+        __m256i x0 = _mm256_xor_si256(d0, k0);
+        __m256i x1 = _mm256_xor_si256(d1, k1);
+        a0 = _mm256_add_epi64(a0, _mm256_add_epi64(d0, _mm256_mul_epu32(x0, _mm256_srli_epi64(x0, 32))));
+        a1 = _mm256_add_epi64(a1, _mm256_add_epi64(d1, _mm256_mul_epu32(x1, _mm256_srli_epi64(x1, 32))));
+    }
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(acc), a0);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(acc + 4), a1);
+#elif defined(__SSE2__)
+    __m128i a[4];
+    __m128i k[4];
+    for (int j = 0; j < 4; ++j) {
+        a[j] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(acc + 2 * j));
+        k[j] = _mm_load_si128(reinterpret_cast<const __m128i*>(HASH_KEY + 2 * j));
+    }
+    for (size_t s = 0; s < stripes; ++s, data += HASH_STRIPE) {
+        for (int j = 0; j < 4; ++j) {
+            __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 16 * j));
+            __m128i x = _mm_xor_si128(d, k[j]);
+            a[j] = _mm_add_epi64(a[j], _mm_add_epi64(d, _mm_mul_epu32(x, _mm_srli_epi64(x, 32))));
+        }
+    }
+    for (int j = 0; j < 4; ++j) {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(acc + 2 * j), a[j]);
+    }
+#else
+    for (size_t s = 0; s < stripes; ++s, data += HASH_STRIPE) {
+        for (int j = 0; j < 8; ++j) {
+            uint64_t word;
+            memcpy(&word, data + 8 * j, sizeof(word));
+            uint64_t x = word ^ HASH_KEY[j];
+            acc[j] += word + (x & 0xFFFFFFFF) * (x >> 32);
+        }
+    }
+#endif
+}
+
+inline uint64_t hashBytes(const void *data, size_t size) {
+    const uint8_t *bytes = static_cast<const uint8_t*>(data);
+    uint64_t acc[8] = {HASH_PRIME_3, HASH_PRIME_1, HASH_PRIME_2, HASH_PRIME_3, HASH_PRIME_2, HASH_PRIME_1, HASH_PRIME_3, HASH_PRIME_1};
+    size_t stripes = size / HASH_STRIPE;
+    hashStripes(acc, bytes, stripes);
+
+    // Last partial stripe, zero padded; the length goes into the merge
+    uint8_t last[HASH_STRIPE] = {};
+    if (size > stripes * HASH_STRIPE) {
+        memcpy(last, bytes + stripes * HASH_STRIPE, size - stripes * HASH_STRIPE);
+    }
+    hashStripes(acc, last, 1);
+
+    uint64_t h = size * HASH_PRIME_1;
+    for (int j = 0; j < 8; ++j) {
+        h ^= hashAvalanche(acc[j] * HASH_PRIME_2);
+        h = (h << 27 | h >> 37) * HASH_PRIME_1 + HASH_PRIME_3;
+    }
+    return hashAvalanche(h);
+}
+
+#endif
@@ -0,0 +1,690 @@
+#ifndef BRAINWIRE_HUFFMAN_H
+#define BRAINWIRE_HUFFMAN_H
+
+#include <vector>
+#include <queue>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+
+#include "common.h"
+#include "bitio.h"
+
+// Canonical Huffman coding of residuals with order-1 context switching.
+//
+// The spread of the next residual depends on how active the signal is right
+// now, so instead of one global table the coder keeps up to MAX_CONTEXTS
+// tables and picks one per sample from the magnitude of the two previous
+// residuals. The magnitude is first reduced to its bit length (a "context
+// class"), and a small per-stream map merges neighbouring classes into
+// contexts, so both sides switch tables with a couple of table lookups and
+// no data-dependent branches.
+
+const int MAX_CODE_LENGTH = 15;
+const int LOOKUP_BITS = 10;
+const int CONTEXT_CLASSES = 18; // bit lengths of |r1| + |r2|, 0..17
+const int MAX_CONTEXTS = 16;
+const size_t MAX_ALPHABET = 4096;
+
+// Decode table entries: symbol value in the low 16 bits, code length above it
+const int ENTRY_LENGTH_SHIFT = 16;
+const uint32_t ESCAPE_FLAG = 1u << 21;
+
+inline int bitLength(uint32_t value) {
+    return 32 - __builtin_clz(value | 1) - (value == 0);
+}
+
+inline int contextClass(int16_t r1, int16_t r2) {
+    return bitLength(static_cast<uint32_t>(std::abs(r1) + std::abs(r2)));
+}
+
+// Symbols that get their own code. Values outside the alphabet (seen only
+// once, or beyond MAX_ALPHABET) are sent as an escape code plus 16 raw bits,
+// which keeps tables small on noisy input.
+struct Alphabet {
+    std::vector<int16_t> symbols; // sorted ascending
+    bool hasEscape = false;
+
+    size_t size() const { return symbols.size() + (hasEscape ? 1 : 0); }
+    int escapeIndex() const { return static_cast<int>(symbols.size()); }
+};
+
+// Everything the decoder needs to rebuild the codes of one stream
+struct EntropyTables {
+    Alphabet alphabet;
+    uint8_t contextMap[CONTEXT_CLASSES] = {};
+    int contextCount = 1;
+    std::vector<std::vector<uint8_t>> lengths; // [context][alphabet index]
+};
+
+struct HuffmanNode {
+    int symbol; // alphabet index, -1 for internal nodes
+    uint32_t frequency;
+    HuffmanNode* left;
+    HuffmanNode* right;
+
+    HuffmanNode(int symbol, uint32_t frequency) : symbol(symbol), frequency(frequency), left(nullptr), right(nullptr) {}
+};
+
+struct Compare {
+    bool operator()(HuffmanNode* l, HuffmanNode* r) {
+        return l->frequency > r->frequency;
+    }
+};
+
+inline HuffmanNode* buildHuffmanTree(const std::vector<uint32_t> &frequencies) {
+    std::priority_queue<HuffmanNode*, std::vector<HuffmanNode*>, Compare> minHeap;
+
+    for (size_t i = 0; i < frequencies.size(); ++i) {
+        if (frequencies[i] > 0) {
+            minHeap.push(new HuffmanNode(static_cast<int>(i), frequencies[i]));
+        }
+    }
+    if (minHeap.empty()) {
+        return nullptr;
+    }
+
+    while (minHeap.size() > 1) {
+        HuffmanNode* left = minHeap.top();
+        minHeap.pop();
+        HuffmanNode* right = minHeap.top();
+        minHeap.pop();
+
+        HuffmanNode* combined = new HuffmanNode(-1, left->frequency + right->frequency);
+        combined->left = left;
+        combined->right = right;
+
+        minHeap.push(combined);
+    }
+
+    return minHeap.top();
+}
+
+inline void freeHuffmanTree(HuffmanNode* root) {
+    if (!root) return;
+    freeHuffmanTree(root->left);
+    freeHuffmanTree(root->right);
+    delete root;
+}
+
+inline void collectCodeLengths(HuffmanNode* root, int depth, std::vector<int> &lengths) {
+    if (!root) return;
+
+    if (!root->left && !root->right) {
+        lengths[root->symbol] = std::max(depth, 1);
+    }
+
+    collectCodeLengths(root->left, depth + 1, lengths);
+    collectCodeLengths(root->right, depth + 1, lengths);
+}
+
+// Rebalance the length distribution so no code exceeds maxLength (the
+// procedure from JPEG Annex K.3), then hand the shortest codes back to the
+// most frequent symbols.
+inline void limitCodeLengths(std::vector<int> &lengths, const std::vector<uint32_t> &frequencies, int maxLength) {
+    int longest = 0;
+    for (int length : lengths) {
+        longest = std::max(longest, length);
+    }
+    if (longest <= maxLength) {
+        return;
+    }
+
+    std::vector<int> count(longest + 1, 0);
+    for (int length : lengths) {
+        if (length > 0) count[length]++;
+    }
+    for (int length = longest; length > maxLength; --length) {
+        while (count[length] > 0) {
+            int j = length - 2;
+            while (count[j] == 0) --j;
+            count[length] -= 2;
+            count[length - 1] += 1;
+            count[j + 1] += 2;
+            count[j] -= 1;
+        }
+    }
+
+    std::vector<int> order;
+    for (size_t i = 0; i < lengths.size(); ++i) {
+        if (lengths[i] > 0) order.push_back(static_cast<int>(i));
+    }
+    std::sort(order.begin(), order.end(), [&](int a, int b) {
+        if (frequencies[a] != frequencies[b]) return frequencies[a] > frequencies[b];
+        return a < b;
+    });
+    size_t next = 0;
+    for (int length = 1; length <= maxLength; ++length) {
+        for (int i = 0; i < count[length]; ++i) {
+            lengths[order[next++]] = length;
+        }
+    }
+}
+
+inline std::vector<uint8_t> buildCodeLengths(const std::vector<uint32_t> &frequencies) {
+    std::vector<int> lengths(frequencies.size(), 0);
+    HuffmanNode* root = buildHuffmanTree(frequencies);
+    collectCodeLengths(root, 0, lengths);
+    freeHuffmanTree(root);
+    limitCodeLengths(lengths, frequencies, MAX_CODE_LENGTH);
+    return std::vector<uint8_t>(lengths.begin(), lengths.end());
+}
+
+// Canonical codes: shorter codes first, ties broken by alphabet index
+inline std::vector<uint32_t> canonicalCodes(const std::vector<uint8_t> &lengths) {
+    uint32_t count[MAX_CODE_LENGTH + 1] = {};
+    for (uint8_t length : lengths) {
+        count[length]++;
+    }
+    count[0] = 0;
+
+    uint32_t nextCode[MAX_CODE_LENGTH + 1] = {};
+    uint32_t code = 0;
+    for (int length = 1; length <= MAX_CODE_LENGTH; ++length) {
+        code = (code + count[length - 1]) << 1;
+        nextCode[length] = code;
+    }
+
+    std::vector<uint32_t> codes(lengths.size(), 0);
+    for (size_t i = 0; i < lengths.size(); ++i) {
+        if (lengths[i] > 0) {
+            codes[i] = nextCode[lengths[i]]++;
+        }
+    }
+    return codes;
+}
+
+// Estimated cost in bits of coding a histogram with its own table
+inline double tableCost(const std::vector<uint32_t> &histogram) {
+    double total = 0;
+    for (uint32_t count : histogram) total += count;
+    if (total == 0) return 0;
+
+    double bits = 0;
+    for (uint32_t count : histogram) {
+        if (count > 0) bits += count * std::log2(total / count);
+    }
+    return bits + 4.0 * histogram.size(); // one length nibble per alphabet entry
+}
+
+// Estimated Huffman-coded size of a residual sequence in bits: order-0
+// entropy plus table entries, with singletons priced as escapes. Cheap
+// enough for encoder decisions that should not run a full entropy encode.
+inline double estimateCodedBits(const int16_t *residuals, size_t count) {
+    std::vector<uint32_t> frequencies(65536, 0);
+    for (size_t i = 0; i < count; ++i) {
+        frequencies[static_cast<uint16_t>(residuals[i])]++;
+    }
+    double bits = 0;
+    for (uint32_t frequency : frequencies) {
+        if (frequency > 1) {
+            bits += frequency * std::log2(static_cast<double>(count) / frequency) + 20;
+        } else if (frequency == 1) {
+            bits += 16 + std::log2(static_cast<double>(count));
+        }
+    }
+    return bits;
+}
+
+// Merge neighbouring context classes while that lowers the estimated size
+// (code bits plus table bits), and until at most MAX_CONTEXTS remain.
+inline int chooseContextMap(const std::vector<std::vector<uint32_t>> &classHistograms, uint8_t contextMap[CONTEXT_CLASSES]) {
+    struct Group {
+        int first;
+        int last;
+        std::vector<uint32_t> histogram;
+        double cost;
+    };
+
+    std::vector<Group> groups;
+    for (int c = 0; c < CONTEXT_CLASSES; ++c) {
+        groups.push_back({c, c, classHistograms[c], tableCost(classHistograms[c])});
+    }
+
+    while (groups.size() > 1) {
+        size_t best = 0;
+        double bestSaving = -1e300;
+        std::vector<uint32_t> bestMerged;
+        double bestCost = 0;
+        for (size_t g = 0; g + 1 < groups.size(); ++g) {
+            std::vector<uint32_t> merged = groups[g].histogram;
+            for (size_t i = 0; i < merged.size(); ++i) {
+                merged[i] += groups[g + 1].histogram[i];
+            }
+            double cost = tableCost(merged);
+            double saving = groups[g].cost + groups[g + 1].cost - cost;
+            if (saving > bestSaving) {
+                bestSaving = saving;
+                best = g;
+                bestMerged.swap(merged);
+                bestCost = cost;
+            }
+        }
+        if (bestSaving < 0 && groups.size() <= static_cast<size_t>(MAX_CONTEXTS)) {
+            break;
+        }
+        groups[best].last = groups[best + 1].last;
+        groups[best].histogram.swap(bestMerged);
+        groups[best].cost = bestCost;
+        groups.erase(groups.begin() + best + 1);
+    }
+
+    for (size_t g = 0; g < groups.size(); ++g) {
+        for (int c = groups[g].first; c <= groups[g].last; ++c) {
+            contextMap[c] = static_cast<uint8_t>(g);
+        }
+    }
+    return static_cast<int>(groups.size());
+}
+
+// Map every 16-bit value to its alphabet index (or the escape index)
+inline std::vector<int> alphabetIndex(const Alphabet &alphabet) {
+    std::vector<int> index(65536, alphabet.escapeIndex());
+    for (size_t i = 0; i < alphabet.symbols.size(); ++i) {
+        index[static_cast<uint16_t>(alphabet.symbols[i])] = static_cast<int>(i);
+    }
+    return index;
+}
+
+inline EntropyTables buildEntropyTables(const int16_t *residuals, size_t count) {
+    EntropyTables tables;
+
+    std::vector<uint32_t> frequencies(65536, 0);
+    for (size_t i = 0; i < count; ++i) {
+        frequencies[static_cast<uint16_t>(residuals[i])]++;
+    }
+
+    std::vector<int> candidates;
+    for (int v = 0; v < 65536; ++v) {
+        if (frequencies[v] > 1) {
+            candidates.push_back(v);
+        } else if (frequencies[v] == 1) {
+            tables.alphabet.hasEscape = true;
+        }
+    }
+    if (candidates.size() >= MAX_ALPHABET) {
+        std::sort(candidates.begin(), candidates.end(), [&](int a, int b) {
+            return frequencies[a] > frequencies[b];
+        });
+        candidates.resize(MAX_ALPHABET - 1);
+        tables.alphabet.hasEscape = true;
+    }
+    for (int v : candidates) {
+        tables.alphabet.symbols.push_back(static_cast<int16_t>(v));
+    }
+    std::sort(tables.alphabet.symbols.begin(), tables.alphabet.symbols.end());
+
+    std::vector<int> index = alphabetIndex(tables.alphabet);
+    std::vector<std::vector<uint32_t>> classHistograms(CONTEXT_CLASSES, std::vector<uint32_t>(tables.alphabet.size(), 0));
+    int16_t r1 = 0, r2 = 0;
+    for (size_t i = 0; i < count; ++i) {
+        int16_t r = residuals[i];
+        classHistograms[contextClass(r1, r2)][index[static_cast<uint16_t>(r)]]++;
+        r2 = r1;
+        r1 = r;
+    }
+
+    tables.contextCount = chooseContextMap(classHistograms, tables.contextMap);
+    for (int ctx = 0; ctx < tables.contextCount; ++ctx) {
+        std::vector<uint32_t> histogram(tables.alphabet.size(), 0);
+        for (int c = 0; c < CONTEXT_CLASSES; ++c) {
+            if (tables.contextMap[c] != ctx) continue;
+            for (size_t i = 0; i < histogram.size(); ++i) {
+                histogram[i] += classHistograms[c][i];
+            }
+        }
+        tables.lengths.push_back(buildCodeLengths(histogram));
+    }
+    return tables;
+}
+
+inline void encodeResiduals(std::vector<uint8_t> &out, const int16_t *residuals, size_t count, const EntropyTables &tables) {
+    std::vector<int> index = alphabetIndex(tables.alphabet);
+    std::vector<std::vector<uint32_t>> codes;
+    for (const auto &lengths : tables.lengths) {
+        codes.push_back(canonicalCodes(lengths));
+    }
+    int escape = tables.alphabet.escapeIndex();
+
+    BitWriter writer;
+    writer.bytes.swap(out);
+    int16_t r1 = 0, r2 = 0;
+    for (size_t n = 0; n < count; ++n) {
+        int16_t r = residuals[n];
+        int ctx = tables.contextMap[contextClass(r1, r2)];
+        int i = index[static_cast<uint16_t>(r)];
+        writer.write(codes[ctx][i], tables.lengths[ctx][i]);
+        if (i == escape) {
+            writer.write(static_cast<uint16_t>(r), 16);
+        }
+        r2 = r1;
+        r1 = r;
+    }
+    writer.flush();
+    out.swap(writer.bytes);
+}
+
+// Exact size in bits of coding `residuals` with `tables`, or INFINITY if
+// some residual has no code in its context (the tables cannot be reused)
+inline double codedBitsWithTables(const int16_t *residuals, size_t count, const EntropyTables &tables) {
+    std::vector<int> index = alphabetIndex(tables.alphabet);
+    int escape = tables.alphabet.escapeIndex();
+    double bits = 0;
+    int16_t r1 = 0, r2 = 0;
+    for (size_t n = 0; n < count; ++n) {
+        int16_t r = residuals[n];
+        int i = index[static_cast<uint16_t>(r)];
+        if (i == escape && !tables.alphabet.hasEscape) {
+            return INFINITY;
+        }
+        int length = tables.lengths[tables.contextMap[contextClass(r1, r2)]][i];
+        if (length == 0) {
+            return INFINITY;
+        }
+        bits += length + (i == escape ? 16 : 0);
+        r2 = r1;
+        r1 = r;
+    }
+    return bits;
+}
+
+// Table-driven decoder for one context: codes up to LOOKUP_BITS long resolve
+// with a single lookup, longer ones fall back to a canonical search.
+struct DecodeTable {
+    uint32_t lookup[1 << LOOKUP_BITS];
+    uint32_t firstCode[MAX_CODE_LENGTH + 1];
+    uint32_t count[MAX_CODE_LENGTH + 1];
+    uint32_t offset[MAX_CODE_LENGTH + 1];
+    std::vector<uint32_t> entries; // canonical order
+
+    uint32_t decodeLong(uint32_t bits) const {
+        for (int length = LOOKUP_BITS + 1; length <= MAX_CODE_LENGTH; ++length) {
+            uint32_t code = bits >> (MAX_CODE_LENGTH - length);
+            if (code - firstCode[length] < count[length]) {
+                return entries[offset[length] + code - firstCode[length]];
+            }
+        }
+        fatal("Corrupt encoded data: invalid code");
+    }
+};
+
+inline void buildDecodeTable(DecodeTable &table, const std::vector<uint8_t> &lengths, const Alphabet &alphabet) {
+    std::vector<uint32_t> codes = canonicalCodes(lengths);
+
+    std::fill(std::begin(table.lookup), std::end(table.lookup), 0);
+    std::fill(std::begin(table.count), std::end(table.count), 0);
+    uint32_t kraft = 0;
+    for (uint8_t length : lengths) {
+        if (length > MAX_CODE_LENGTH) fatal("Corrupt code table: invalid code length");
+        if (length > 0) {
+            table.count[length]++;
+            kraft += 1u << (MAX_CODE_LENGTH - length);
+        }
+    }
+    if (kraft > 1u << MAX_CODE_LENGTH) {
+        fatal("Corrupt code table: oversubscribed code lengths");
+    }
+
+    std::vector<int> order;
+    for (size_t i = 0; i < lengths.size(); ++i) {
+        if (lengths[i] > 0) order.push_back(static_cast<int>(i));
+    }
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return lengths[a] < lengths[b]; });
+
+    uint32_t position = 0;
+    for (int length = 1; length <= MAX_CODE_LENGTH; ++length) {
+        table.offset[length] = position;
+        table.firstCode[length] = 0;
+        position += table.count[length];
+    }
+
+    table.entries.clear();
+    for (int i : order) {
+        uint32_t entry = static_cast<uint32_t>(lengths[i]) << ENTRY_LENGTH_SHIFT;
+        if (i == alphabet.escapeIndex()) {
+            entry |= ESCAPE_FLAG;
+        } else {
+            entry |= static_cast<uint16_t>(alphabet.symbols[i]);
+        }
+        if (table.entries.empty() || lengths[order[table.entries.size() - 1]] != lengths[i]) {
+            table.firstCode[lengths[i]] = codes[i];
+        }
+        table.entries.push_back(entry);
+
+        if (lengths[i] <= LOOKUP_BITS) {
+            uint32_t first = codes[i] << (LOOKUP_BITS - lengths[i]);
+            uint32_t fill = 1u << (LOOKUP_BITS - lengths[i]);
+            for (uint32_t j = 0; j < fill; ++j) {
+                table.lookup[first + j] = entry;
+            }
+        }
+    }
+}
+
+// Code lengths are sent like DEFLATE's dynamic block header: the lengths of
+// all contexts form one sequence, run-length coded into the 19-symbol
+// code-length alphabet (0-15 literal, 16 repeat previous 3-6 times, 17 zeros
+// 3-10 times, 18 zeros 11-138 times), which is itself Huffman coded with
+// 7-bit-limited codes whose lengths go first as 3-bit fields.
+const int LENGTH_CODE_SYMBOLS = 19;
+const int MAX_LENGTH_CODE_LENGTH = 7;
+const uint8_t LENGTH_CODE_ORDER[LENGTH_CODE_SYMBOLS] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+struct LengthToken {
+    uint8_t symbol;
+    uint8_t extra; // repeat count minus the symbol's minimum
+};
+
+inline std::vector<LengthToken> runLengthCodeLengths(const std::vector<uint8_t> &lengths) {
+    std::vector<LengthToken> tokens;
+    size_t i = 0;
+    while (i < lengths.size()) {
+        uint8_t length = lengths[i];
+        size_t run = 1;
+        while (i + run < lengths.size() && lengths[i + run] == length) run++;
+        if (length == 0 && run >= 3) {
+            run = std::min<size_t>(run, 138);
+            tokens.push_back(run >= 11 ? LengthToken{18, static_cast<uint8_t>(run - 11)} : LengthToken{17, static_cast<uint8_t>(run - 3)});
+            i += run;
+        } else if (i > 0 && lengths[i - 1] == length && run >= 3) {
+            run = std::min<size_t>(run, 6);
+            tokens.push_back({16, static_cast<uint8_t>(run - 3)});
+            i += run;
+        } else {
+            tokens.push_back({length, 0});
+            i++;
+        }
+    }
+    return tokens;
+}
+
+inline int lengthTokenExtraBits(uint8_t symbol) {
+    return symbol == 16 ? 2 : symbol == 17 ? 3 : symbol == 18 ? 7 : 0;
+}
+
+inline void writeCodeLengths(std::vector<uint8_t> &out, const std::vector<uint8_t> &lengths) {
+    std::vector<LengthToken> tokens = runLengthCodeLengths(lengths);
+    std::vector<uint32_t> frequencies(LENGTH_CODE_SYMBOLS, 0);
+    for (const LengthToken &token : tokens) frequencies[token.symbol]++;
+
+    std::vector<int> treeLengths(LENGTH_CODE_SYMBOLS, 0);
+    HuffmanNode* root = buildHuffmanTree(frequencies);
+    collectCodeLengths(root, 0, treeLengths);
+    freeHuffmanTree(root);
+    limitCodeLengths(treeLengths, frequencies, MAX_LENGTH_CODE_LENGTH);
+    std::vector<uint8_t> codeLengths(treeLengths.begin(), treeLengths.end());
+    std::vector<uint32_t> codes = canonicalCodes(codeLengths);
+
+    int sent = LENGTH_CODE_SYMBOLS;
+    while (sent > 4 && codeLengths[LENGTH_CODE_ORDER[sent - 1]] == 0) sent--;
+
+    BitWriter writer;
+    writer.write(sent - 4, 4);
+    for (int i = 0; i < sent; ++i) {
+        writer.write(codeLengths[LENGTH_CODE_ORDER[i]], 3);
+    }
+    for (const LengthToken &token : tokens) {
+        writer.write(codes[token.symbol], codeLengths[token.symbol]);
+        writer.write(token.extra, lengthTokenExtraBits(token.symbol));
+    }
+    writer.flush();
+    putVarint(out, writer.bytes.size());
+    out.insert(out.end(), writer.bytes.begin(), writer.bytes.end());
+}
+
+inline void readCodeLengths(ByteReader &in, std::vector<uint8_t> &lengths) {
+    size_t size = in.varint();
+    BitReader reader(in.bytes(size), size);
+
+    int sent = reader.read(4) + 4;
+    if (sent > LENGTH_CODE_SYMBOLS) {
+        fatal("Corrupt code table: bad code-length header");
+    }
+    std::vector<uint8_t> codeLengths(LENGTH_CODE_SYMBOLS, 0);
+    for (int i = 0; i < sent; ++i) {
+        reader.refill();
+        codeLengths[LENGTH_CODE_ORDER[i]] = static_cast<uint8_t>(reader.read(3));
+    }
+    Alphabet lengthAlphabet;
+    for (int symbol = 0; symbol < LENGTH_CODE_SYMBOLS; ++symbol) {
+        lengthAlphabet.symbols.push_back(static_cast<int16_t>(symbol));
+    }
+    DecodeTable table;
+    buildDecodeTable(table, codeLengths, lengthAlphabet);
+
+    size_t i = 0;
+    while (i < lengths.size()) {
+        reader.refill();
+        uint32_t entry = table.lookup[reader.peek(LOOKUP_BITS)];
+        if (entry == 0) {
+            fatal("Corrupt code table: invalid code-length code");
+        }
+        reader.consume(entry >> ENTRY_LENGTH_SHIFT & 0x1F);
+        uint8_t symbol = static_cast<uint8_t>(entry & 0xFFFF);
+        if (symbol < 16) {
+            lengths[i++] = symbol;
+            continue;
+        }
+        if (symbol == 16 && i == 0) {
+            fatal("Corrupt code table: repeat with no previous length");
+        }
+        uint8_t value = symbol == 16 ? lengths[i - 1] : 0;
+        size_t repeat = reader.read(lengthTokenExtraBits(symbol)) + (symbol == 18 ? 11 : 3);
+        if (repeat > lengths.size() - i) {
+            fatal("Corrupt code table: code lengths overrun");
+        }
+        std::fill(lengths.begin() + i, lengths.begin() + i + repeat, value);
+        i += repeat;
+    }
+}
+
+// Tables as: varint (symbol count << 1 | escape), the sorted symbols as a
+// zigzag first value and gap varints, the context map as a bit per class
+// (1 = starts a new context), then every context's code lengths.
+inline void writeEntropyTables(std::vector<uint8_t> &out, const EntropyTables &tables) {
+    const std::vector<int16_t> &symbols = tables.alphabet.symbols;
+    putVarint(out, symbols.size() << 1 | (tables.alphabet.hasEscape ? 1 : 0));
+    for (size_t i = 0; i < symbols.size(); ++i) {
+        putVarint(out, i == 0 ? zigzag(symbols[0]) : static_cast<uint32_t>(symbols[i] - symbols[i - 1] - 1));
+    }
+
+    uint32_t boundaries = 0;
+    for (int c = 1; c < CONTEXT_CLASSES; ++c) {
+        if (tables.contextMap[c] != tables.contextMap[c - 1]) boundaries |= 1u << (c - 1);
+    }
+    putValue(out, static_cast<uint8_t>(boundaries));
+    putValue(out, static_cast<uint16_t>(boundaries >> 8));
+
+    std::vector<uint8_t> lengths;
+    for (int ctx = 0; ctx < tables.contextCount; ++ctx) {
+        lengths.insert(lengths.end(), tables.lengths[ctx].begin(), tables.lengths[ctx].end());
+    }
+    writeCodeLengths(out, lengths);
+}
+
+inline EntropyTables readEntropyTables(ByteReader &in) {
+    EntropyTables tables;
+
+    uint64_t header = in.varint();
+    uint64_t symbolCount = header >> 1;
+    if (symbolCount >= MAX_ALPHABET) {
+        fatal("Corrupt code table: too many symbols");
+    }
+    tables.alphabet.hasEscape = (header & 1) != 0;
+    tables.alphabet.symbols.resize(symbolCount);
+    int64_t symbol = 0;
+    for (uint64_t i = 0; i < symbolCount; ++i) {
+        uint64_t coded = in.varint();
+        if (coded > 65536) {
+            fatal("Corrupt code table: symbol out of range");
+        }
+        symbol = i == 0 ? unzigzag(static_cast<uint32_t>(coded)) : symbol + 1 + static_cast<int64_t>(coded);
+        if (symbol < -32768 || symbol > 32767) {
+            fatal("Corrupt code table: symbol out of range");
+        }
+        tables.alphabet.symbols[i] = static_cast<int16_t>(symbol);
+    }
+
+    uint32_t boundaries = in.value<uint8_t>();
+    boundaries |= static_cast<uint32_t>(in.value<uint16_t>()) << 8;
+    tables.contextMap[0] = 0;
+    for (int c = 1; c < CONTEXT_CLASSES; ++c) {
+        tables.contextMap[c] = tables.contextMap[c - 1] + (boundaries >> (c - 1) & 1);
+    }
+    tables.contextCount = tables.contextMap[CONTEXT_CLASSES - 1] + 1;
+    if (tables.contextCount > MAX_CONTEXTS) {
+        fatal("Corrupt code table: too many contexts");
+    }
+
+    size_t alphabetSize = tables.alphabet.size();
+    std::vector<uint8_t> lengths(tables.contextCount * alphabetSize);
+    readCodeLengths(in, lengths);
+    for (int ctx = 0; ctx < tables.contextCount; ++ctx) {
+        tables.lengths.emplace_back(lengths.begin() + ctx * alphabetSize, lengths.begin() + (ctx + 1) * alphabetSize);
+    }
+    return tables;
+}
+
+// Decode tables for every context of one stream's tables. Built once and
+// shared by all blocks that reuse the tables.
+struct HuffmanDecoder {
+    EntropyTables tables;
+    std::vector<DecodeTable> decodeTables;
+};
+
+inline HuffmanDecoder buildHuffmanDecoder(EntropyTables tables) {
+    HuffmanDecoder decoder;
+    decoder.decodeTables.resize(tables.contextCount);
+    for (int ctx = 0; ctx < tables.contextCount; ++ctx) {
+        buildDecodeTable(decoder.decodeTables[ctx], tables.lengths[ctx], tables.alphabet);
+    }
+    decoder.tables = std::move(tables);
+    return decoder;
+}
+
+inline void decodeResiduals(const uint8_t *data, size_t size, const HuffmanDecoder &decoder, int16_t *out, size_t count) {
+    const EntropyTables &tables = decoder.tables;
+    const std::vector<DecodeTable> &decodeTables = decoder.decodeTables;
+
+    BitReader reader(data, size);
+    int16_t r1 = 0, r2 = 0;
+    for (size_t i = 0; i < count; ++i) {
+        reader.refill();
+        const DecodeTable &table = decodeTables[tables.contextMap[contextClass(r1, r2)]];
+        uint32_t entry = table.lookup[reader.peek(LOOKUP_BITS)];
+        if (entry == 0) {
+            entry = table.decodeLong(reader.peek(MAX_CODE_LENGTH));
+        }
+        reader.consume(entry >> ENTRY_LENGTH_SHIFT & 0x1F);
+        int16_t r = static_cast<int16_t>(entry & 0xFFFF);
+        if (entry & ESCAPE_FLAG) {
+            r = static_cast<int16_t>(reader.read(16));
+        }
+        out[i] = r;
+        r2 = r1;
+        r1 = r;
+    }
+}
+
+#endif
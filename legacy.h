@@ -0,0 +1,374 @@
+#ifndef BRAINWIRE_LEGACY_H
+#define BRAINWIRE_LEGACY_H
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <array>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+#include "common.h"
+#include "wav.h"
+#include "parallel.h"
+
+// Files written before the format had a magic: a raw WavHeader, the Huffman
+// codes as '0'/'1' strings, the code bit count and a single bitstream
+// (LSB-first within each byte) with no blocks and no index.
+//
+// Having no block boundaries, the stream is decoded in parallel
+// speculatively: it is cut into segments at arbitrary bit offsets and each
+// is decoded as if a code started there. Huffman codes resynchronize
+// quickly, so once the true decode of the previous segment runs into a
+// code start that the speculative decode also found, everything after it
+// is correct. Stitching re-decodes only the few codes before that sync
+// point; a segment that never syncs is decoded again in full, so the
+// output is always identical to a sequential decode.
+
+const int LEGACY_LOOKUP_BITS = 12;
+const uint32_t LEGACY_LEAF = 0x80000000u;     // child: low 16 bits are the sample
+const uint32_t LEGACY_CONTINUE = 0x40000000u; // lookup: low bits are the node reached
+const int LEGACY_LENGTH_SHIFT = 16;
+const size_t LEGACY_SYNC_WINDOW = 1024;       // code starts kept per segment for syncing
+const uint64_t LEGACY_MIN_SEGMENT_BITS = 1 << 20;
+const size_t LEGACY_WINDOW_BYTES = 1 << 20;       // of the bitstream held by a LegacyReader
+
+struct LegacyDecoder {
+    // nodes[i][bit]: 0 for no code, LEGACY_LEAF | sample, else a node index
+    std::vector<std::array<uint32_t, 2>> nodes;
+    // Next LEGACY_LOOKUP_BITS bits -> LEGACY_LEAF | length << 16 | sample,
+    // LEGACY_CONTINUE | node for longer codes, or 0
+    std::vector<uint32_t> lookup;
+};
+
+struct LegacyStream {
+    WavHeader header;
+    LegacyDecoder decoder;
+    const uint8_t *bits;
+    size_t byteCount;
+    uint64_t bitCount;
+};
+
+// Decoded codes of one segment, decoded from a guessed start
+struct LegacySegment {
+    std::vector<int16_t> samples;
+    std::vector<uint64_t> starts; // bit positions of the first codes
+    uint64_t exit = 0;            // first code start at or after the segment end
+    bool failed = false;          // ran into a bit pattern that is no code
+};
+
+inline LegacyDecoder buildLegacyDecoder(const std::vector<std::pair<int16_t, std::string>> &codes) {
+    LegacyDecoder decoder;
+    decoder.nodes.push_back({0, 0});
+    for (const auto &code : codes) {
+        // An empty code (single-symbol input) is never read from the stream
+        if (code.second.empty()) {
+            continue;
+        }
+        uint32_t node = 0;
+        for (size_t i = 0; i < code.second.size(); ++i) {
+            int bit = code.second[i] == '1';
+            uint32_t &child = decoder.nodes[node][bit];
+            if (child & LEGACY_LEAF) {
+                fatal("Corrupt legacy code table: overlapping codes");
+            }
+            if (i + 1 == code.second.size()) {
+                if (child != 0) {
+                    fatal("Corrupt legacy code table: overlapping codes");
+                }
+                child = LEGACY_LEAF | static_cast<uint16_t>(code.first);
+            } else {
+                if (child == 0) {
+                    child = static_cast<uint32_t>(decoder.nodes.size());
+                    decoder.nodes.push_back({0, 0});
+                }
+                node = decoder.nodes[node][bit];
+            }
+        }
+    }
+
+    decoder.lookup.resize(1 << LEGACY_LOOKUP_BITS);
+    for (uint32_t bits = 0; bits < decoder.lookup.size(); ++bits) {
+        uint32_t node = 0, entry = 0;
+        for (int length = 1; length <= LEGACY_LOOKUP_BITS; ++length) {
+            uint32_t child = decoder.nodes[node][bits >> (length - 1) & 1];
+            if (child == 0) {
+                break;
+            }
+            if (child & LEGACY_LEAF) {
+                entry = child | static_cast<uint32_t>(length) << LEGACY_LENGTH_SHIFT;
+                break;
+            }
+            node = child;
+            if (length == LEGACY_LOOKUP_BITS) {
+                entry = LEGACY_CONTINUE | node;
+            }
+        }
+        decoder.lookup[bits] = entry;
+    }
+    return decoder;
+}
+
+// Header, code table and bit count of a legacy file; `read(to, size)`
+// fills `to` with the next bytes of the file. Leaves the stream's bits unset.
+template <typename Read>
+LegacyStream readLegacyPrefix(Read read) {
+    LegacyStream stream;
+    read(&stream.header, sizeof(stream.header));
+    uint32_t codeCount;
+    read(&codeCount, sizeof(codeCount));
+    std::vector<std::pair<int16_t, std::string>> codes;
+    for (uint32_t i = 0; i < codeCount; ++i) {
+        int16_t sample;
+        uint32_t codeLength;
+        read(&sample, sizeof(sample));
+        read(&codeLength, sizeof(codeLength));
+        // No code of a 16-bit alphabet is longer than the alphabet
+        if (codeLength > 1u << 16) {
+            fatal("Corrupt legacy code table");
+        }
+        std::string code(codeLength, '0');
+        read(&code[0], codeLength);
+        if (code.find_first_not_of("01") != std::string::npos) {
+            fatal("Corrupt legacy code table");
+        }
+        codes.emplace_back(sample, std::move(code));
+    }
+    stream.decoder = buildLegacyDecoder(codes);
+    uint32_t bitCount;
+    read(&bitCount, sizeof(bitCount));
+    stream.bitCount = bitCount;
+    stream.bits = nullptr;
+    stream.byteCount = 0;
+    return stream;
+}
+
+inline LegacyStream readLegacyStream(const uint8_t *data, size_t size) {
+    ByteReader in(data, size);
+    LegacyStream stream = readLegacyPrefix([&](void *to, size_t count) {
+        in.need(count);
+        memcpy(to, data + in.pos, count);
+        in.pos += count;
+    });
+    stream.byteCount = static_cast<size_t>((stream.bitCount + 7) / 8);
+    in.need(stream.byteCount);
+    stream.bits = data + in.pos;
+    return stream;
+}
+
+// At least 57 bits from bit `position` on, zeros past the end
+inline uint64_t peekLegacyBits(const LegacyStream &stream, uint64_t position) {
+    size_t byte = static_cast<size_t>(position >> 3);
+    uint64_t word = 0;
+    if (byte + 8 <= stream.byteCount) {
+        memcpy(&word, stream.bits + byte, sizeof(word));
+    } else {
+        for (size_t i = byte; i < stream.byteCount; ++i) {
+            word |= static_cast<uint64_t>(stream.bits[i]) << (8 * (i - byte));
+        }
+    }
+    return word >> (position & 7);
+}
+
+// Length of the code at `position` and its sample; 0 at the end of the
+// stream (including a final code cut short, dropped as it always was), or
+// -1 if the bits there are no code
+inline int decodeLegacyCode(const LegacyStream &stream, uint64_t position, int16_t &sample) {
+    const LegacyDecoder &decoder = stream.decoder;
+    uint32_t entry = decoder.lookup[peekLegacyBits(stream, position) & ((1u << LEGACY_LOOKUP_BITS) - 1)];
+    uint32_t leaf = 0;
+    int length;
+    if (entry & LEGACY_LEAF) {
+        leaf = entry;
+        length = entry >> LEGACY_LENGTH_SHIFT & 0x1F;
+    } else if (entry & LEGACY_CONTINUE) {
+        // Longer codes walk the tree a bit at a time
+        uint32_t node = entry & ~LEGACY_CONTINUE;
+        for (length = LEGACY_LOOKUP_BITS; !leaf; ++length) {
+            if (position + length >= stream.bitCount) {
+                return 0;
+            }
+            uint32_t child = decoder.nodes[node][peekLegacyBits(stream, position + length) & 1];
+            if (child == 0) {
+                return -1;
+            }
+            if (child & LEGACY_LEAF) {
+                leaf = child;
+            } else {
+                node = child;
+            }
+        }
+    } else {
+        return position + LEGACY_LOOKUP_BITS > stream.bitCount ? 0 : -1;
+    }
+    if (position + length > stream.bitCount) {
+        return 0;
+    }
+    sample = static_cast<int16_t>(leaf & 0xFFFF);
+    return length;
+}
+
+// Decode the codes that start in [position, end), appending to `out` and
+// keeping the first `keepStarts` code starts. Returns the position after
+// the last code; `invalid` is set if decoding stopped at bits that are no code.
+inline uint64_t decodeLegacyRange(const LegacyStream &stream, uint64_t position, uint64_t end, std::vector<int16_t> &out,
+                                  std::vector<uint64_t> *starts, size_t keepStarts, bool &invalid) {
+    invalid = false;
+    while (position < end) {
+        int16_t sample;
+        int length = decodeLegacyCode(stream, position, sample);
+        if (length <= 0) {
+            invalid = length < 0;
+            break;
+        }
+        if (starts && starts->size() < keepStarts) {
+            starts->push_back(position);
+        }
+        out.push_back(sample);
+        position += length;
+    }
+    return position;
+}
+
+// Decode a legacy file held in memory on up to `threads` cores
+inline void decodeLegacy(const uint8_t *data, size_t size, WavHeader &header, std::vector<int16_t> &audioData, int threads) {
+    LegacyStream stream = readLegacyStream(data, size);
+    header = stream.header;
+
+    uint64_t segmentCount = std::max<uint64_t>(1, std::min<uint64_t>(static_cast<uint64_t>(std::max(threads, 1)) * 4,
+                                                                     stream.bitCount / LEGACY_MIN_SEGMENT_BITS));
+    uint64_t segmentBits = (stream.bitCount + segmentCount - 1) / std::max<uint64_t>(segmentCount, 1);
+    std::vector<LegacySegment> segments(segmentCount);
+    parallelFor(segments.size(), threads, [&](size_t s) {
+        LegacySegment &segment = segments[s];
+        uint64_t begin = s * segmentBits, end = std::min(stream.bitCount, begin + segmentBits);
+        segment.exit = decodeLegacyRange(stream, begin, end, segment.samples, &segment.starts, LEGACY_SYNC_WINDOW, segment.failed);
+        if (s == 0 && segment.failed) {
+            fatal("Corrupt legacy data: invalid code");
+        }
+    });
+
+    // Stitch: follow the true code starts into each segment until one is
+    // also a start the speculative decode found
+    size_t total = segments[0].samples.size();
+    uint64_t position = segments[0].exit;
+    for (size_t s = 1; s < segments.size(); ++s) {
+        LegacySegment &segment = segments[s];
+        uint64_t end = std::min(stream.bitCount, (s + 1) * segmentBits);
+        std::vector<int16_t> prefix;
+        auto next = segment.failed ? segment.starts.end() : std::lower_bound(segment.starts.begin(), segment.starts.end(), position);
+        while (next != segment.starts.end() && *next != position) {
+            int16_t sample;
+            int length = decodeLegacyCode(stream, position, sample);
+            if (length <= 0) {
+                next = segment.starts.end();
+                break;
+            }
+            prefix.push_back(sample);
+            position += length;
+            while (next != segment.starts.end() && *next < position) ++next;
+        }
+        if (next != segment.starts.end()) {
+            // Synced: the speculative samples from here on are right
+            segment.samples.erase(segment.samples.begin(), segment.samples.begin() + (next - segment.starts.begin()));
+            segment.samples.insert(segment.samples.begin(), prefix.begin(), prefix.end());
+            position = segment.exit;
+        } else {
+            // No sync within the window, or the speculative decode went
+            // astray: decode the rest of the segment for real
+            segment.samples = std::move(prefix);
+            bool invalid;
+            position = decodeLegacyRange(stream, position, end, segment.samples, nullptr, 0, invalid);
+            if (invalid) {
+                fatal("Corrupt legacy data: invalid code");
+            }
+        }
+        total += segment.samples.size();
+    }
+
+    resizeBuffer(audioData, total);
+    std::vector<size_t> offsets(segments.size(), 0);
+    for (size_t s = 1; s < segments.size(); ++s) {
+        offsets[s] = offsets[s - 1] + segments[s - 1].samples.size();
+    }
+    parallelFor(segments.size(), threads, [&](size_t s) {
+        std::copy(segments[s].samples.begin(), segments[s].samples.end(), audioData.begin() + offsets[s]);
+        std::vector<int16_t>().swap(segments[s].samples);
+    });
+}
+
+// Sequential decoding of a legacy file on disk through a window of its
+// bitstream, so files of any size decode in bounded memory (transcoding)
+struct LegacyReader {
+    std::ifstream file;
+    std::string filename;
+    LegacyStream stream;         // over `window`
+    std::vector<uint8_t> window;
+    uint64_t windowStart = 0;    // stream byte at window[0]
+    uint64_t totalBits = 0;
+    uint64_t position = 0;       // bit in the window
+    uint64_t samples = 0;        // decoded so far
+};
+
+// Move the window past the consumed bytes and read more; false at the end
+inline bool refillLegacyWindow(LegacyReader &reader) {
+    uint64_t totalBytes = (reader.totalBits + 7) / 8;
+    if (reader.windowStart + reader.window.size() >= totalBytes) {
+        return false;
+    }
+    size_t consumed = static_cast<size_t>(reader.position >> 3);
+    reader.window.erase(reader.window.begin(), reader.window.begin() + consumed);
+    reader.windowStart += consumed;
+    reader.position &= 7;
+    size_t kept = reader.window.size();
+    size_t wanted = static_cast<size_t>(std::min<uint64_t>(LEGACY_WINDOW_BYTES, totalBytes - reader.windowStart));
+    reader.window.resize(wanted);
+    reader.file.read(reinterpret_cast<char*>(reader.window.data() + kept), wanted - kept);
+    if (static_cast<size_t>(reader.file.gcount()) != wanted - kept) {
+        fatal("Unexpected end of legacy file: " + reader.filename);
+    }
+    reader.stream.bits = reader.window.data();
+    reader.stream.byteCount = reader.window.size();
+    reader.stream.bitCount = std::min<uint64_t>(reader.totalBits - reader.windowStart * 8, reader.window.size() * 8);
+    return true;
+}
+
+inline void openLegacyReader(LegacyReader &reader, const std::string &filename) {
+    reader.filename = filename;
+    reader.file.open(filename, std::ios::binary);
+    if (!reader.file) {
+        fatal("Error opening file: " + filename);
+    }
+    reader.stream = readLegacyPrefix([&](void *to, size_t count) {
+        if (!reader.file.read(static_cast<char*>(to), count)) {
+            fatal("Unexpected end of legacy file: " + filename);
+        }
+    });
+    reader.totalBits = reader.stream.bitCount;
+    reader.stream.bitCount = 0;
+    refillLegacyWindow(reader);
+}
+
+// Up to `count` next samples into `out`; fewer only at the end
+inline size_t readLegacySamples(LegacyReader &reader, int16_t *out, size_t count) {
+    size_t done = 0;
+    while (done < count) {
+        int16_t sample;
+        int length = decodeLegacyCode(reader.stream, reader.position, sample);
+        if (length < 0) {
+            fatal("Corrupt legacy data: invalid code in " + reader.filename);
+        }
+        if (length == 0) {
+            // A code cut off by the window, or the end of the stream
+            if (!refillLegacyWindow(reader)) break;
+            continue;
+        }
+        out[done++] = sample;
+        reader.position += length;
+    }
+    reader.samples += done;
+    return done;
+}
+
+#endif
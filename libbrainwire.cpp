@@ -0,0 +1,206 @@
+// Shared library behind libbrainwire.h:
+//
+//     g++ -O2 -std=c++17 -pthread -shared -fPIC -fvisibility=hidden libbrainwire.cpp -o libbrainwire.so
+//
+// With BRAINWIRE_LIBRARY, fatal() throws; every entry point catches and
+// turns the message into brainwire_last_error().
+
+#define BRAINWIRE_LIBRARY
+
+#include <string>
+#include <vector>
+#include <new>
+#include <cstdint>
+
+#include "common.h"
+#include "wav.h"
+#include "codec.h"
+#include "container.h"
+#include "convert.h"
+#include "reader.h"
+#include "libbrainwire.h"
+
+struct brainwire_reader {
+    BrainwireReader reader;
+    std::vector<int16_t> chunk; // for formats other than int16
+};
+
+namespace {
+
+thread_local std::string lastError;
+
+// Run `call`, turning an exception into -1 and the last error
+template <typename F>
+int guarded(F call) {
+    try {
+        call();
+        return 0;
+    } catch (const std::exception &error) {
+        lastError = error.what();
+    } catch (...) {
+        lastError = "Unknown error";
+    }
+    return -1;
+}
+
+int threadCount(int threads) {
+    return threads > 0 ? threads : defaultThreadCount();
+}
+
+SampleLayout makeLayout(int format, float scale, int planar, uint16_t channels) {
+    if (format != BRAINWIRE_INT16 && format != BRAINWIRE_INT32 && format != BRAINWIRE_FLOAT32) {
+        fatal("Unknown sample format " + std::to_string(format));
+    }
+    SampleLayout layout;
+    layout.format = static_cast<SampleFormat>(format);
+    layout.scale = scale;
+    layout.planar = planar != 0;
+    layout.channels = channels;
+    return layout;
+}
+
+void fillInfo(const WavHeader &header, uint64_t sampleCount, brainwire_info *info) {
+    info->sample_count = sampleCount;
+    info->sample_rate = header.sample_rate;
+    info->channels = header.channels;
+    info->bits_per_sample = header.bits_per_sample;
+}
+
+void decodeInto(const uint8_t *data, size_t size, int format, float scale, int planar, void *out, size_t outSize, int threads) {
+    WavHeader header;
+    uint64_t sampleCount;
+    std::vector<BlockRecord> blocks = readBrainwireRecords(data, size, header, sampleCount);
+    SampleLayout layout = makeLayout(format, scale, planar, header.channels);
+    checkSampleLayout(layout, sampleCount);
+    if (outSize < sampleCount * sampleBytes(layout.format)) {
+        fatal("Output buffer too small: " + std::to_string(sampleCount) + " samples need " +
+              std::to_string(sampleCount * sampleBytes(layout.format)) + " bytes");
+    }
+    decodeBlockRecords(blocks, sampleCount, layout, out, threadCount(threads));
+}
+
+}
+
+extern "C" {
+
+int brainwire_api_version(void) {
+    return BRAINWIRE_API_VERSION;
+}
+
+const char *brainwire_last_error(void) {
+    return lastError.c_str();
+}
+
+size_t brainwire_output_size(uint64_t sample_count, int format) {
+    return sample_count * sampleBytes(static_cast<SampleFormat>(format));
+}
+
+int brainwire_info_buffer(const void *data, size_t size, brainwire_info *info) {
+    return guarded([&]() {
+        WavHeader header;
+        uint64_t sampleCount;
+        readBrainwireRecords(static_cast<const uint8_t*>(data), size, header, sampleCount);
+        fillInfo(header, sampleCount, info);
+    });
+}
+
+int brainwire_info_file(const char *path, brainwire_info *info) {
+    return guarded([&]() {
+        BrainwireReader reader = openBrainwireReader(std::string(path), 1);
+        fillInfo(reader.header, reader.sampleCount, info);
+    });
+}
+
+int brainwire_decode_buffer(const void *data, size_t size, int format, float scale, int planar, void *out, size_t out_size, int threads) {
+    return guarded([&]() {
+        decodeInto(static_cast<const uint8_t*>(data), size, format, scale, planar, out, out_size, threads);
+    });
+}
+
+int brainwire_decode_file(const char *path, int format, float scale, int planar, void *out, size_t out_size, int threads) {
+    return guarded([&]() {
+        std::vector<uint8_t> data = readFileBytes(path);
+        decodeInto(data.data(), data.size(), format, scale, planar, out, out_size, threads);
+    });
+}
+
+int brainwire_encode_file(const int16_t *samples, uint64_t count, uint32_t sample_rate, uint16_t channels, int codec, int level,
+                          int threads, const char *path) {
+    return guarded([&]() {
+        if (codec != BRAINWIRE_HUFFMAN && codec != BRAINWIRE_CM) {
+            fatal("Unknown codec " + std::to_string(codec));
+        }
+        if (channels == 0 || count * sizeof(int16_t) > UINT32_MAX - 36) {
+            fatal("Cannot encode " + std::to_string(count) + " samples in " + std::to_string(channels) + " channels");
+        }
+        EncodeOptions options;
+        options.codec = static_cast<uint8_t>(codec);
+        options.level = level;
+        options.threads = threadCount(threads);
+        uint32_t dataSize = static_cast<uint32_t>(count * sizeof(int16_t));
+        WavHeader header = pcm16Header(sample_rate, channels, dataSize, dataSize + 36);
+        EncodeStats stats;
+        writeFileBytes(path, encodeBrainwire(header, std::vector<int16_t>(samples, samples + count), options, stats));
+    });
+}
+
+brainwire_reader *brainwire_open(const char *path, int threads) {
+    brainwire_reader *handle = nullptr;
+    guarded([&]() {
+        BrainwireReader reader = openBrainwireReader(std::string(path), threadCount(threads));
+        handle = new brainwire_reader{std::move(reader), {}};
+    });
+    return handle;
+}
+
+brainwire_reader *brainwire_open_buffer(const void *data, size_t size, int threads) {
+    brainwire_reader *handle = nullptr;
+    guarded([&]() {
+        BrainwireReader reader = openBrainwireReader(static_cast<const uint8_t*>(data), size, threadCount(threads));
+        handle = new brainwire_reader{std::move(reader), {}};
+    });
+    return handle;
+}
+
+int brainwire_reader_info(const brainwire_reader *reader, brainwire_info *info) {
+    fillInfo(reader->reader.header, reader->reader.sampleCount, info);
+    return 0;
+}
+
+int64_t brainwire_read(brainwire_reader *reader, int format, float scale, void *out, uint64_t count) {
+    int64_t done = 0;
+    int status = guarded([&]() {
+        SampleLayout layout = makeLayout(format, scale, 0, reader->reader.header.channels);
+        if (layout.format == SAMPLES_INT16) {
+            done = static_cast<int64_t>(readSamples(reader->reader, static_cast<int16_t*>(out), count));
+            return;
+        }
+        // Convert a chunk at a time through a small buffer
+        reader->chunk.resize(1 << 16);
+        while (static_cast<uint64_t>(done) < count) {
+            size_t got = readSamples(reader->reader, reader->chunk.data(), std::min<uint64_t>(count - done, reader->chunk.size()));
+            if (got == 0) {
+                break;
+            }
+            convertSamples(reader->chunk.data(), got, done, count, layout, out);
+            done += got;
+        }
+    });
+    return status == 0 ? done : -1;
+}
+
+int brainwire_seek(brainwire_reader *reader, uint64_t sample) {
+    return guarded([&]() {
+        seekSamples(reader->reader, sample);
+    });
+}
+
+uint64_t brainwire_tell(const brainwire_reader *reader) {
+    return readerPosition(reader->reader);
+}
+
+void brainwire_close(brainwire_reader *reader) {
+    delete reader;
+}
+
+}
@@ -0,0 +1,82 @@
+#ifndef LIBBRAINWIRE_H
+#define LIBBRAINWIRE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* C interface to the brainwire codec, for bindings such as brainwire.py.
+ *
+ * Calls that can fail return 0 (or a count) on success and -1 (or NULL) on
+ * failure, with the reason in brainwire_last_error(). The library never
+ * prints and never exits. Nothing is shared between calls, so threads may
+ * decode at once; a reader is used by one thread at a time.
+ *
+ * Decoded samples go straight into the caller's buffer as int16, int32 or
+ * float32 (times `scale`, e.g. microvolts per count), interleaved as in the
+ * WAV or planar (each channel's samples together). `threads` <= 0 uses
+ * every core. */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define BRAINWIRE_API_VERSION 1
+
+/* Built with -fvisibility=hidden, only these functions are exported */
+#if defined(__GNUC__)
+#define BRAINWIRE_EXPORT __attribute__((visibility("default")))
+#else
+#define BRAINWIRE_EXPORT
+#endif
+
+enum {
+    BRAINWIRE_INT16 = 0,
+    BRAINWIRE_INT32 = 1,
+    BRAINWIRE_FLOAT32 = 2
+};
+
+enum {
+    BRAINWIRE_HUFFMAN = 1,
+    BRAINWIRE_CM = 2
+};
+
+typedef struct {
+    uint64_t sample_count; /* over all channels */
+    uint32_t sample_rate;
+    uint16_t channels;
+    uint16_t bits_per_sample;
+} brainwire_info;
+
+typedef struct brainwire_reader brainwire_reader;
+
+BRAINWIRE_EXPORT int brainwire_api_version(void);
+BRAINWIRE_EXPORT const char *brainwire_last_error(void);
+
+/* Bytes a decode of `sample_count` samples into `format` needs */
+BRAINWIRE_EXPORT size_t brainwire_output_size(uint64_t sample_count, int format);
+
+/* Whole recordings: a .brainwire file in memory or on disk */
+BRAINWIRE_EXPORT int brainwire_info_buffer(const void *data, size_t size, brainwire_info *info);
+BRAINWIRE_EXPORT int brainwire_info_file(const char *path, brainwire_info *info);
+BRAINWIRE_EXPORT int brainwire_decode_buffer(const void *data, size_t size, int format, float scale, int planar, void *out, size_t out_size, int threads);
+BRAINWIRE_EXPORT int brainwire_decode_file(const char *path, int format, float scale, int planar, void *out, size_t out_size, int threads);
+
+/* Encode interleaved 16-bit samples to a .brainwire file */
+BRAINWIRE_EXPORT int brainwire_encode_file(const int16_t *samples, uint64_t count, uint32_t sample_rate, uint16_t channels, int codec, int level,
+                                           int threads, const char *path);
+
+/* Streaming: chunks of interleaved samples and seeks (see reader.h). A
+ * buffer passed to brainwire_open_buffer must outlive the reader. */
+BRAINWIRE_EXPORT brainwire_reader *brainwire_open(const char *path, int threads);
+BRAINWIRE_EXPORT brainwire_reader *brainwire_open_buffer(const void *data, size_t size, int threads);
+BRAINWIRE_EXPORT int brainwire_reader_info(const brainwire_reader *reader, brainwire_info *info);
+BRAINWIRE_EXPORT int64_t brainwire_read(brainwire_reader *reader, int format, float scale, void *out, uint64_t count); /* samples read; 0 at the end */
+BRAINWIRE_EXPORT int brainwire_seek(brainwire_reader *reader, uint64_t sample);
+BRAINWIRE_EXPORT uint64_t brainwire_tell(const brainwire_reader *reader);
+BRAINWIRE_EXPORT void brainwire_close(brainwire_reader *reader);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,323 @@
+#ifndef BRAINWIRE_LPC_H
+#define BRAINWIRE_LPC_H
+
+#include <vector>
+#include <array>
+#include <utility>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#include "common.h"
+#include "huffman.h"
+
+// Per-block linear prediction. The encoder computes the block's
+// autocorrelation, runs Levinson-Durbin once to get every order up to the
+// search limit, ranks the orders by the predicted error and then scores the
+// best few (at a few coefficient precisions) on their actual residual
+// statistics. How far it searches depends on the compression level.
+//
+// Prediction works on a 32-bit "domain" signal: the samples themselves, or
+// their ranks when a value map is in use. Residuals wrap to 16 bits, so the
+// decoder recovers the domain value exactly from prediction + residual.
+
+const int MAX_LPC_ORDER = 32;
+const int MAX_LPC_SHIFT = 20;
+const int DEFAULT_LEVEL = 5;
+
+struct LpcPredictor {
+    int order = 0;
+    int shift = 0;
+    int32_t coefficients[MAX_LPC_ORDER] = {}; // coefficients[k] weighs y[i - 1 - k]
+};
+
+struct LpcSearch {
+    int maxOrder;
+    int candidates;   // orders scored on real residuals
+    int minPrecision; // coefficient bits tried
+    int maxPrecision;
+};
+
+inline LpcSearch lpcSearchForLevel(int level) {
+    if (level <= 0) return {0, 0, 0, 0};
+    if (level <= 3) return {8, 1, 12, 12};
+    if (level <= 6) return {16, 3, 12, 14};
+    return {MAX_LPC_ORDER, 6, 10, 15};
+}
+
+inline double dotProduct(const double *a, const double *b, size_t count) {
+    size_t i = 0;
+    double sum = 0;
+#if defined(__AVX2__)
+    __m256d s0 = _mm256_setzero_pd(), s1 = _mm256_setzero_pd();
+    for (; i + 8 <= count; i += 8) {
+        s0 = _mm256_add_pd(s0, _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+        s1 = _mm256_add_pd(s1, _mm256_mul_pd(_mm256_loadu_pd(a + i + 4), _mm256_loadu_pd(b + i + 4)));
+    }
+    double lanes[4];
+    _mm256_storeu_pd(lanes, _mm256_add_pd(s0, s1));
+    sum = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#elif defined(__SSE2__)
+    __m128d s0 = _mm_setzero_pd(), s1 = _mm_setzero_pd();
+    for (; i + 4 <= count; i += 4) {
+        s0 = _mm_add_pd(s0, _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+        s1 = _mm_add_pd(s1, _mm_mul_pd(_mm_loadu_pd(a + i + 2), _mm_loadu_pd(b + i + 2)));
+    }
+    double lanes[2];
+    _mm_storeu_pd(lanes, _mm_add_pd(s0, s1));
+    sum = lanes[0] + lanes[1];
+#endif
+    for (; i < count; ++i) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+// Autocorrelation of the mean-removed signal for lags 0..maxLag
+inline void autocorrelation(const int32_t *y, size_t count, int maxLag, double *r) {
+    double mean = 0;
+    for (size_t i = 0; i < count; ++i) mean += y[i];
+    mean = count > 0 ? mean / count : 0;
+
+    std::vector<double> centered(count);
+    for (size_t i = 0; i < count; ++i) centered[i] = y[i] - mean;
+
+    for (int lag = 0; lag <= maxLag; ++lag) {
+        r[lag] = static_cast<size_t>(lag) < count ? dotProduct(centered.data(), centered.data() + lag, count - lag) : 0;
+    }
+}
+
+// Levinson-Durbin recursion: coefficients[m - 1][0..m-1] and error[m] for
+// every order m up to maxOrder (error[0] is the signal energy). Stops early
+// if the error vanishes.
+inline int levinsonDurbin(const double *r, int maxOrder, double coefficients[][MAX_LPC_ORDER], double *error) {
+    double a[MAX_LPC_ORDER] = {};
+    error[0] = r[0];
+    for (int m = 1; m <= maxOrder; ++m) {
+        if (error[m - 1] <= 0) {
+            return m - 1;
+        }
+        double acc = r[m];
+        for (int k = 0; k < m - 1; ++k) acc -= a[k] * r[m - 1 - k];
+        double reflection = acc / error[m - 1];
+
+        double previous[MAX_LPC_ORDER];
+        std::copy(a, a + m - 1, previous);
+        a[m - 1] = reflection;
+        for (int k = 0; k < m - 1; ++k) {
+            a[k] = previous[k] - reflection * previous[m - 2 - k];
+        }
+        error[m] = error[m - 1] * (1 - reflection * reflection);
+        std::copy(a, a + m, coefficients[m - 1]);
+    }
+    return maxOrder;
+}
+
+// Quantize to `precision`-bit signed integers with a common shift, carrying
+// the rounding error forward so the sum of coefficients stays accurate.
+inline bool quantizeCoefficients(const double *a, int order, int precision, LpcPredictor &predictor) {
+    double largest = 0;
+    for (int k = 0; k < order; ++k) largest = std::max(largest, std::fabs(a[k]));
+    if (largest <= 0) return false;
+
+    int exponent;
+    std::frexp(largest, &exponent);
+    int shift = std::min(precision - 1 - exponent, MAX_LPC_SHIFT);
+    if (shift < 0) return false;
+
+    int32_t limit = (1 << (precision - 1)) - 1;
+    double carry = 0;
+    predictor.order = order;
+    predictor.shift = shift;
+    for (int k = 0; k < order; ++k) {
+        carry += a[k] * (1 << shift);
+        long q = std::lround(carry);
+        q = std::max<long>(-limit, std::min<long>(limit, q));
+        predictor.coefficients[k] = static_cast<int32_t>(q);
+        carry -= q;
+    }
+    return true;
+}
+
+// Prediction is composed from stages at compile time so that the per-sample
+// loops carry no branch on a block's parameters: a domain (how prediction
+// plus residual wraps: 16-bit signed samples or 16-bit unsigned ranks) and
+// a predictor of fixed order, whose dot product is expanded in full. Every
+// domain x order combination is instantiated in a table, and a block looks
+// up its kernel once by (domain, order).
+
+struct SampleDomain {
+    static int32_t unwrap(int64_t value) { return static_cast<int16_t>(value); }
+};
+
+struct RankDomain {
+    static int32_t unwrap(int64_t value) { return static_cast<int32_t>(value & 0xFFFF); }
+};
+
+// Prediction for sample i from the domain history. The first `Order`
+// samples of a block repeat the previous sample instead.
+template <int Order>
+struct FixedOrderLpc {
+    int32_t coefficients[Order > 0 ? Order : 1];
+    int shift;
+
+    explicit FixedOrderLpc(const LpcPredictor &predictor) : shift(predictor.shift) {
+        std::copy(predictor.coefficients, predictor.coefficients + Order, coefficients);
+    }
+
+    // Past the first Order samples; `history` points at the previous one.
+    // The dot product is expanded term by term, as if written out by hand.
+    int32_t predict(const int32_t *history) const {
+        return static_cast<int32_t>(dot(history, std::make_index_sequence<Order>()) >> shift);
+    }
+
+    template <size_t... K>
+    int64_t dot(const int32_t *history, std::index_sequence<K...>) const {
+        return (int64_t(0) + ... + (static_cast<int64_t>(coefficients[K]) * history[-static_cast<ptrdiff_t>(K)]));
+    }
+
+    int32_t operator()(const int32_t *y, size_t i) const {
+        if (i < static_cast<size_t>(Order)) {
+            return i > 0 ? y[i - 1] : 0;
+        }
+        return predict(y + i - 1);
+    }
+};
+
+// Domain values [from, to) of a block from their residuals; y[0, from)
+// must already hold the block's earlier values
+template <typename Domain, int Order>
+void reconstructLpcRange(const int16_t *residuals, size_t from, size_t to, const LpcPredictor &predictor, int32_t *y) {
+    FixedOrderLpc<Order> predict(predictor);
+    size_t i = from;
+    for (; i < to && i < static_cast<size_t>(Order); ++i) {
+        y[i] = Domain::unwrap(static_cast<int64_t>(predict(y, i)) + residuals[i]);
+    }
+    for (; i < to; ++i) {
+        y[i] = Domain::unwrap(static_cast<int64_t>(predict.predict(y + i - 1)) + residuals[i]);
+    }
+}
+
+template <int Order>
+void computeLpcResidualsFixed(const int32_t *y, size_t count, const LpcPredictor &predictor, int16_t *residuals) {
+    FixedOrderLpc<Order> predict(predictor);
+    size_t i = 0;
+    for (; i < count && i < static_cast<size_t>(Order); ++i) {
+        residuals[i] = static_cast<int16_t>(y[i] - predict(y, i));
+    }
+    for (; i < count; ++i) {
+        residuals[i] = static_cast<int16_t>(y[i] - predict.predict(y + i - 1));
+    }
+}
+
+using LpcReconstructKernel = void (*)(const int16_t*, size_t, size_t, const LpcPredictor&, int32_t*);
+using LpcResidualKernel = void (*)(const int32_t*, size_t, const LpcPredictor&, int16_t*);
+
+template <typename Domain, size_t... Orders>
+std::array<LpcReconstructKernel, sizeof...(Orders)> reconstructKernelTable(std::index_sequence<Orders...>) {
+    return {{&reconstructLpcRange<Domain, static_cast<int>(Orders)>...}};
+}
+
+template <size_t... Orders>
+std::array<LpcResidualKernel, sizeof...(Orders)> residualKernelTable(std::index_sequence<Orders...>) {
+    return {{&computeLpcResidualsFixed<static_cast<int>(Orders)>...}};
+}
+
+inline LpcReconstructKernel lpcReconstructKernel(bool ranks, int order) {
+    static const auto samples = reconstructKernelTable<SampleDomain>(std::make_index_sequence<MAX_LPC_ORDER + 1>());
+    static const auto rankValues = reconstructKernelTable<RankDomain>(std::make_index_sequence<MAX_LPC_ORDER + 1>());
+    return (ranks ? rankValues : samples)[order];
+}
+
+inline void computeLpcResiduals(const int32_t *y, size_t count, const LpcPredictor &predictor, int16_t *residuals) {
+    static const auto kernels = residualKernelTable(std::make_index_sequence<MAX_LPC_ORDER + 1>());
+    kernels[predictor.order](y, count, predictor, residuals);
+}
+
+// Pick the predictor with the smallest estimated coded size (residual
+// statistics plus coefficient bytes). `residuals` receives the winner's.
+inline LpcPredictor chooseLpcPredictor(const int32_t *y, size_t count, int level, std::vector<int16_t> &residuals, double &bits) {
+    LpcPredictor best;
+    residuals.resize(count);
+    computeLpcResiduals(y, count, best, residuals.data());
+    bits = estimateCodedBits(residuals.data(), count);
+
+    LpcSearch search = lpcSearchForLevel(level);
+    int maxOrder = static_cast<int>(std::min<size_t>(search.maxOrder, count / 4));
+    if (maxOrder < 1) {
+        return best;
+    }
+
+    double r[MAX_LPC_ORDER + 1];
+    double coefficients[MAX_LPC_ORDER][MAX_LPC_ORDER];
+    double error[MAX_LPC_ORDER + 1];
+    autocorrelation(y, count, maxOrder, r);
+    maxOrder = levinsonDurbin(r, maxOrder, coefficients, error);
+
+    // Rank orders by predicted bits: n/2 log2(error) plus coefficient cost
+    std::vector<std::pair<double, int>> ranked;
+    for (int m = 1; m <= maxOrder; ++m) {
+        double predicted = 0.5 * count * std::log2(std::max(error[m], 1e-9)) + m * search.maxPrecision;
+        ranked.push_back({predicted, m});
+    }
+    std::sort(ranked.begin(), ranked.end());
+
+    std::vector<int16_t> candidate(count);
+    for (int c = 0; c < search.candidates && c < static_cast<int>(ranked.size()); ++c) {
+        int order = ranked[c].second;
+        for (int precision = search.minPrecision; precision <= search.maxPrecision; precision += 2) {
+            LpcPredictor predictor;
+            if (!quantizeCoefficients(coefficients[order - 1], order, precision, predictor)) {
+                continue;
+            }
+            computeLpcResiduals(y, count, predictor, candidate.data());
+            double candidateBits = estimateCodedBits(candidate.data(), count) + order * (precision + 2);
+            if (candidateBits < bits) {
+                bits = candidateBits;
+                best = predictor;
+                residuals.swap(candidate);
+                candidate.resize(count);
+            }
+        }
+    }
+    return best;
+}
+
+inline void writeLpcPredictor(std::vector<uint8_t> &out, const LpcPredictor &predictor) {
+    out.push_back(static_cast<uint8_t>(predictor.order));
+    if (predictor.order == 0) return;
+    out.push_back(static_cast<uint8_t>(predictor.shift));
+    for (int k = 0; k < predictor.order; ++k) {
+        putVarint(out, zigzag(predictor.coefficients[k]));
+    }
+}
+
+inline LpcPredictor readLpcPredictor(ByteReader &in) {
+    LpcPredictor predictor;
+    predictor.order = in.value<uint8_t>();
+    if (predictor.order > MAX_LPC_ORDER) {
+        fatal("Corrupt predictor: order too high");
+    }
+    if (predictor.order == 0) return predictor;
+    predictor.shift = in.value<uint8_t>();
+    if (predictor.shift > MAX_LPC_SHIFT) {
+        fatal("Corrupt predictor: shift too large");
+    }
+    for (int k = 0; k < predictor.order; ++k) {
+        uint64_t coded = in.varint();
+        if (coded > UINT32_MAX) {
+            fatal("Corrupt predictor: coefficient out of range");
+        }
+        predictor.coefficients[k] = unzigzag(static_cast<uint32_t>(coded));
+    }
+    return predictor;
+}
+
+#endif
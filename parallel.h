@@ -0,0 +1,51 @@
+#ifndef BRAINWIRE_PARALLEL_H
+#define BRAINWIRE_PARALLEL_H
+
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <exception>
+#include <vector>
+#include <algorithm>
+
+inline int defaultThreadCount() {
+    unsigned count = std::thread::hardware_concurrency();
+    return count > 0 ? static_cast<int>(count) : 1;
+}
+
+// Run fn(0) .. fn(count - 1) on up to `threads` workers. Items are handed
+// out one at a time, so uneven work (e.g. noisy vs. flat blocks) balances.
+// If an item throws, no new items are started and the first exception is
+// rethrown on the calling thread.
+template <typename F>
+void parallelFor(size_t count, int threads, F fn) {
+    size_t workerCount = std::min(count, static_cast<size_t>(std::max(threads, 1)));
+    if (workerCount <= 1) {
+        for (size_t i = 0; i < count; ++i) fn(i);
+        return;
+    }
+
+    std::atomic<size_t> next(0);
+    std::exception_ptr error;
+    std::mutex errorLock;
+    std::vector<std::thread> workers;
+    for (size_t t = 0; t < workerCount; ++t) {
+        workers.emplace_back([&]() {
+            try {
+                for (size_t i = next++; i < count; i = next++) fn(i);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(errorLock);
+                if (!error) error = std::current_exception();
+                next = count;
+            }
+        });
+    }
+    for (auto &worker : workers) {
+        worker.join();
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+#endif
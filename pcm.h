@@ -0,0 +1,214 @@
+#ifndef BRAINWIRE_PCM_H
+#define BRAINWIRE_PCM_H
+
+#include <vector>
+#include <cstdint>
+#include <cstring>
+
+#include "common.h"
+#include "wav.h"
+
+// Sample widths other than 16 bits. The codec itself works on 16-bit words;
+// a recording of 8-, 24- or 32-bit integers or 32-bit floats is split into
+// planes of 16-bit words it can predict: the high 16 bits of every sample
+// (the signal), then the remaining low bits (mostly noise, coded on their
+// own), so neither plane mixes bytes of different weight the way the raw
+// WAV words would. Floats are first mapped to integers that order like the
+// floats, so the high plane is as smooth as the signal. The split is
+// exact, and joining the planes gives back the original bytes.
+//
+// Plane layout for a data chunk of B bytes holding N = B / width samples:
+//
+//   N high words (8-bit: the sample minus 128, the only plane)
+//   N low words (24-bit: the low byte; 32-bit: the low 16 bits)
+//   one word per byte left over (B % width), as a value 0-255
+//
+// Only plain PCM (format 1) and IEEE float (format 3) headers are split;
+// anything else is coded as the raw words of the data chunk.
+
+enum PcmFormat : uint8_t {
+    PCM_S16,
+    PCM_U8,
+    PCM_S24,
+    PCM_S32,
+    PCM_F32,
+};
+
+inline PcmFormat pcmFormat(const WavHeader &header) {
+    if (header.format_type == 1) {
+        switch (header.bits_per_sample) {
+            case 8: return PCM_U8;
+            case 24: return PCM_S24;
+            case 32: return PCM_S32;
+        }
+    } else if (header.format_type == 3 && header.bits_per_sample == 32) {
+        return PCM_F32;
+    }
+    return PCM_S16;
+}
+
+// Per-format sample access: `load` reads sample i of the packed data as an
+// integer, `store` writes it back (`last` for the final sample, which may
+// end the buffer), and `shift` splits it into planes
+template <PcmFormat F>
+struct PcmSample;
+
+template <>
+struct PcmSample<PCM_U8> {
+    static constexpr size_t width = 1;
+    static constexpr int planes = 1;
+    static constexpr int shift = 0;
+    static int32_t load(const uint8_t *data, size_t i, bool) { return static_cast<int32_t>(data[i]) - 128; }
+    static void store(uint8_t *data, size_t i, bool, int32_t value) { data[i] = static_cast<uint8_t>(value + 128); }
+};
+
+// Packed little-endian 24-bit: every sample but the last loads and stores a
+// whole 32-bit word (the next sample overwrites the extra byte), so the
+// loops have no byte shuffling
+template <>
+struct PcmSample<PCM_S24> {
+    static constexpr size_t width = 3;
+    static constexpr int planes = 2;
+    static constexpr int shift = 8;
+    static int32_t load(const uint8_t *data, size_t i, bool last) {
+        uint32_t word = 0;
+        memcpy(&word, data + 3 * i, last ? 3 : 4);
+        return static_cast<int32_t>(word << 8) >> 8;
+    }
+    static void store(uint8_t *data, size_t i, bool last, int32_t value) {
+        uint32_t word = static_cast<uint32_t>(value);
+        memcpy(data + 3 * i, &word, last ? 3 : 4);
+    }
+};
+
+template <>
+struct PcmSample<PCM_S32> {
+    static constexpr size_t width = 4;
+    static constexpr int planes = 2;
+    static constexpr int shift = 16;
+    static int32_t load(const uint8_t *data, size_t i, bool) {
+        int32_t value;
+        memcpy(&value, data + 4 * i, 4);
+        return value;
+    }
+    static void store(uint8_t *data, size_t i, bool, int32_t value) { memcpy(data + 4 * i, &value, 4); }
+};
+
+// Negative floats have their magnitude bits flipped, so the integers order
+// like the floats; the mapping is its own inverse
+template <>
+struct PcmSample<PCM_F32> {
+    static constexpr size_t width = 4;
+    static constexpr int planes = 2;
+    static constexpr int shift = 16;
+    static int32_t order(int32_t bits) { return bits >= 0 ? bits : bits ^ 0x7FFFFFFF; }
+    static int32_t load(const uint8_t *data, size_t i, bool last) { return order(PcmSample<PCM_S32>::load(data, i, last)); }
+    static void store(uint8_t *data, size_t i, bool last, int32_t value) { PcmSample<PCM_S32>::store(data, i, last, order(value)); }
+};
+
+template <PcmFormat F>
+void splitPcmSample(const uint8_t *data, size_t i, bool last, int16_t *high, int16_t *low) {
+    using Sample = PcmSample<F>;
+    int32_t value = Sample::load(data, i, last);
+    high[i] = static_cast<int16_t>(value >> Sample::shift);
+    if (Sample::planes == 2) {
+        low[i] = static_cast<int16_t>(value & ((1 << Sample::shift) - 1));
+    }
+}
+
+template <PcmFormat F>
+void joinPcmSample(const int16_t *high, const int16_t *low, size_t i, bool last, uint8_t *data) {
+    using Sample = PcmSample<F>;
+    uint32_t value = static_cast<uint32_t>(high[i]) << Sample::shift;
+    if (Sample::planes == 2) {
+        value |= static_cast<uint16_t>(low[i]) & ((1u << Sample::shift) - 1);
+    }
+    Sample::store(data, i, last, static_cast<int32_t>(value));
+}
+
+// The last sample is done apart, so the main loops take the whole-word path
+template <PcmFormat F>
+void splitPcmPlanes(const uint8_t *data, size_t count, int16_t *high, int16_t *low) {
+    if (count == 0) {
+        return;
+    }
+    for (size_t i = 0; i + 1 < count; ++i) {
+        splitPcmSample<F>(data, i, false, high, low);
+    }
+    splitPcmSample<F>(data, count - 1, true, high, low);
+}
+
+template <PcmFormat F>
+void joinPcmPlanes(const int16_t *high, const int16_t *low, size_t count, uint8_t *data) {
+    if (count == 0) {
+        return;
+    }
+    for (size_t i = 0; i + 1 < count; ++i) {
+        joinPcmSample<F>(high, low, i, false, data);
+    }
+    joinPcmSample<F>(high, low, count - 1, true, data);
+}
+
+// Whether the `words` read from a WAV with `header` are coded as planes
+inline bool usesSamplePlanes(const WavHeader &header, size_t words) {
+    return pcmFormat(header) != PCM_S16 && words == (header.data_size + 1) / 2;
+}
+
+template <PcmFormat F>
+std::vector<int16_t> splitSamplePlanes(const uint8_t *data, size_t bytes) {
+    using Sample = PcmSample<F>;
+    size_t count = bytes / Sample::width;
+    size_t rest = bytes % Sample::width;
+    std::vector<int16_t> planes;
+    resizeBuffer(planes, Sample::planes * count + rest);
+    splitPcmPlanes<F>(data, count, planes.data(), planes.data() + count);
+    for (size_t r = 0; r < rest; ++r) {
+        planes[Sample::planes * count + r] = data[count * Sample::width + r];
+    }
+    return planes;
+}
+
+template <PcmFormat F>
+void joinSamplePlanes(const std::vector<int16_t> &planes, uint8_t *data, size_t bytes) {
+    using Sample = PcmSample<F>;
+    size_t count = bytes / Sample::width;
+    size_t rest = bytes % Sample::width;
+    if (planes.size() != Sample::planes * count + rest) {
+        fatal("Corrupt .brainwire file: sample planes do not match the data size");
+    }
+    joinPcmPlanes<F>(planes.data(), planes.data() + count, count, data);
+    for (size_t r = 0; r < rest; ++r) {
+        data[count * Sample::width + r] = static_cast<uint8_t>(planes[Sample::planes * count + r]);
+    }
+}
+
+// The planes of the raw data chunk words of a recording with `header` (see
+// usesSamplePlanes)
+inline std::vector<int16_t> splitSamplePlanes(const WavHeader &header, const std::vector<int16_t> &words) {
+    const uint8_t *data = reinterpret_cast<const uint8_t*>(words.data());
+    switch (pcmFormat(header)) {
+        case PCM_U8: return splitSamplePlanes<PCM_U8>(data, header.data_size);
+        case PCM_S24: return splitSamplePlanes<PCM_S24>(data, header.data_size);
+        case PCM_S32: return splitSamplePlanes<PCM_S32>(data, header.data_size);
+        case PCM_F32: return splitSamplePlanes<PCM_F32>(data, header.data_size);
+        default: fatal("16-bit samples have no planes");
+    }
+}
+
+// And back: the data chunk words, the last one zero-padded if the chunk has
+// an odd size
+inline std::vector<int16_t> joinSamplePlanes(const WavHeader &header, const std::vector<int16_t> &planes) {
+    std::vector<int16_t> words;
+    resizeBuffer(words, (static_cast<size_t>(header.data_size) + 1) / 2);
+    uint8_t *data = reinterpret_cast<uint8_t*>(words.data());
+    switch (pcmFormat(header)) {
+        case PCM_U8: joinSamplePlanes<PCM_U8>(planes, data, header.data_size); break;
+        case PCM_S24: joinSamplePlanes<PCM_S24>(planes, data, header.data_size); break;
+        case PCM_S32: joinSamplePlanes<PCM_S32>(planes, data, header.data_size); break;
+        case PCM_F32: joinSamplePlanes<PCM_F32>(planes, data, header.data_size); break;
+        default: fatal("Corrupt .brainwire file: sample planes in a 16-bit recording");
+    }
+    return words;
+}
+
+#endif
@@ -0,0 +1,74 @@
+#ifndef BRAINWIRE_PREVIEW_H
+#define BRAINWIRE_PREVIEW_H
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <cstdint>
+
+#include "common.h"
+#include "wav.h"
+
+// Preview layer: the recording decimated by an integer factor, each
+// preview sample the rounded mean of `factor` samples. It is coded with the
+// ordinary block codec and stored ahead of the full-rate blocks, so a
+// viewer decodes a 1/factor-size layer for an overview and the full-rate
+// blocks stay the lossless refinement.
+//
+// Preview sample j always covers samples [j * factor, (j + 1) * factor) of
+// the whole recording. A file that ends partway through a group keeps that
+// group's sum in its index, so an append recomputes the group's preview
+// sample exactly; the newer record's value replaces the older one.
+
+const uint32_t MAX_PREVIEW_FACTOR = 4096; // keeps a group's sum in 32 bits
+
+struct PreviewRecord {
+    uint64_t offset; // of the block record, from the start of the file
+    uint64_t first;  // preview sample it starts at
+};
+
+inline void checkPreviewOptions(const WavHeader &header, uint32_t factor) {
+    if (factor < 2 || factor > MAX_PREVIEW_FACTOR) {
+        fatal("Preview factor must be 2-" + std::to_string(MAX_PREVIEW_FACTOR));
+    }
+    if (header.channels != 1) {
+        fatal("A preview layer needs a single-channel recording");
+    }
+}
+
+inline int16_t previewMean(int32_t sum, size_t count) {
+    return static_cast<int16_t>(std::lround(static_cast<double>(sum) / count));
+}
+
+// Preview samples for `count` samples that follow `done` earlier ones,
+// starting with the group `done` ends in. `tailSum` is the sum of that
+// group so far, and is updated to the sum of the group the new samples end in.
+inline std::vector<int16_t> decimateSamples(const int16_t *samples, size_t count, uint32_t factor, uint64_t done, int32_t &tailSum) {
+    std::vector<int16_t> preview;
+    preview.reserve(count / factor + 2);
+    size_t inGroup = done % factor;
+    int32_t sum = inGroup > 0 ? tailSum : 0;
+    for (size_t i = 0; i < count;) {
+        size_t take = std::min<size_t>(count - i, factor - inGroup);
+        for (size_t end = i + take; i < end; ++i) sum += samples[i];
+        inGroup += take;
+        preview.push_back(previewMean(sum, inGroup));
+        if (inGroup == factor) {
+            sum = 0;
+            inGroup = 0;
+        }
+    }
+    if (count > 0) tailSum = sum;
+    return preview;
+}
+
+// Header for the preview as a recording of its own; the rate is rounded to
+// whole hertz
+inline WavHeader previewHeader(const WavHeader &header, uint32_t factor, uint64_t count) {
+    uint32_t rate = std::max<uint32_t>(1, (header.sample_rate + factor / 2) / factor);
+    uint32_t dataSize = static_cast<uint32_t>(count * sizeof(int16_t));
+    return pcm16Header(rate, header.channels, dataSize, dataSize + 36);
+}
+
+#endif
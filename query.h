@@ -0,0 +1,117 @@
+#ifndef BRAINWIRE_QUERY_H
+#define BRAINWIRE_QUERY_H
+
+#include <vector>
+#include <cstdint>
+#include <cstdlib>
+
+#include "common.h"
+#include "zonemap.h"
+#include "container.h"
+#include "edit.h"
+#include "parallel.h"
+
+// Threshold searches over a .brainwire file. Blocks whose zone map shows
+// no sample beyond the thresholds (or too low an RMS) are skipped without
+// being read; the rest are read, decoded in parallel and scanned. Files
+// without zone maps have every block scanned.
+
+struct ZoneQuery {
+    int32_t below = INT32_MIN; // report samples under this
+    int32_t above = INT32_MAX; // or over this
+    uint32_t minRms = 0;       // only in blocks with at least this RMS
+};
+
+// Samples [first, last) all beyond a threshold; peak is the furthest out
+struct QueryMatch {
+    uint64_t first;
+    uint64_t last;
+    int16_t peak;
+};
+
+struct QueryStats {
+    size_t blocks = 0;
+    size_t skippedBlocks = 0;
+    uint64_t samples = 0;
+    uint64_t skippedSamples = 0;
+    uint64_t bytes = 0;
+    uint64_t skippedBytes = 0;
+};
+
+inline bool zoneMayMatch(const BlockSummary &zone, const ZoneQuery &query) {
+    return zone.rms >= query.minRms && (zone.min < query.below || zone.max > query.above);
+}
+
+inline void scanBlock(const std::vector<int16_t> &samples, uint64_t first, const ZoneQuery &query, std::vector<QueryMatch> &matches) {
+    if (query.minRms > 0 && summarizeBlock(samples.data(), samples.size()).rms < query.minRms) {
+        return;
+    }
+    for (size_t i = 0; i < samples.size(); ++i) {
+        int16_t x = samples[i];
+        if (x >= query.below && x <= query.above) {
+            continue;
+        }
+        if (!matches.empty() && matches.back().last == first + i) {
+            matches.back().last++;
+            if (std::abs(x) > std::abs(matches.back().peak)) matches.back().peak = x;
+        } else {
+            matches.push_back({first + i, first + i + 1, x});
+        }
+    }
+}
+
+inline std::vector<QueryMatch> queryBrainwire(BrainwireSource &source, const ZoneQuery &query, int threads, QueryStats &stats) {
+    const BrainwireIndex &index = source.index;
+    size_t blockCount = index.blocks.size();
+    std::vector<size_t> candidates;
+    for (size_t b = 0; b < blockCount; ++b) {
+        uint64_t end = b + 1 < blockCount ? index.blocks[b + 1].offset : index.offset;
+        uint64_t bytes = end - index.blocks[b].offset;
+        stats.blocks++;
+        stats.samples += index.blocks[b].count;
+        stats.bytes += bytes;
+        if (index.zones.empty() || zoneMayMatch(index.zones[b], query)) {
+            candidates.push_back(b);
+        } else {
+            stats.skippedBlocks++;
+            stats.skippedSamples += index.blocks[b].count;
+            stats.skippedBytes += bytes;
+        }
+    }
+
+    // Read each run of neighbouring candidates in one go, then decode and
+    // scan every block in parallel. The tables a run reuses are looked up
+    // among the blocks before it, each of which is read (just its head) and
+    // resolved once for the whole query; those reads count as bytes read.
+    std::vector<EditBlock> blocks;
+    size_t nextTableId = 0;
+    EditTableCache cache;
+    for (size_t c = 0; c < candidates.size();) {
+        size_t end = c + 1;
+        while (end < candidates.size() && candidates[end] == candidates[end - 1] + 1) end++;
+        std::vector<EditBlock> run = readEditBlocks(source, candidates[c], candidates[end - 1], nextTableId, cache);
+        blocks.insert(blocks.end(), std::make_move_iterator(run.begin()), std::make_move_iterator(run.end()));
+        c = end;
+    }
+    stats.skippedBytes -= cache.bytesRead;
+    std::vector<std::vector<QueryMatch>> found(blocks.size());
+    parallelFor(blocks.size(), threads, [&](size_t c) {
+        scanBlock(decodeEditBlock(blocks[c]), source.firsts[candidates[c]], query, found[c]);
+    });
+
+    // Join matches that run across a block boundary
+    std::vector<QueryMatch> matches;
+    for (const std::vector<QueryMatch> &blockMatches : found) {
+        for (const QueryMatch &match : blockMatches) {
+            if (!matches.empty() && matches.back().last == match.first) {
+                matches.back().last = match.last;
+                if (std::abs(match.peak) > std::abs(matches.back().peak)) matches.back().peak = match.peak;
+            } else {
+                matches.push_back(match);
+            }
+        }
+    }
+    return matches;
+}
+
+#endif
@@ -0,0 +1,422 @@
+#ifndef BRAINWIRE_READER_H
+#define BRAINWIRE_READER_H
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <functional>
+#include <algorithm>
+#include <map>
+#include <fstream>
+#include <cstdint>
+#include <cstring>
+
+#include "common.h"
+#include "wav.h"
+#include "format.h"
+#include "codec.h"
+#include "container.h"
+#include "parallel.h"
+
+// Pull-based decoding: samples come out in whatever chunks the caller asks
+// for, decoded a batch of blocks at a time (one block per thread), so only
+// that batch is in memory however long the recording is.
+//
+// Files and in-memory buffers of either version can seek to any sample. The
+// block holding it is found from the index (version 1: from a walk of the
+// record headers). The Huffman tables its blocks reuse are found among the
+// blocks before it only once a block needs them, and only as far back as
+// its references reach; just the tables are read, and their decoders are
+// kept across seeks. A pipe is read front to back and needs the version 1
+// layout (encoder --stream), whose blocks come before nothing they depend
+// on; it seeks forward only, parsing skipped blocks without decoding them.
+
+using RangeReader = std::function<std::vector<uint8_t>(uint64_t offset, uint64_t size)>;
+
+// Decoders for the tables of blocks before a seek target, by block, kept
+// for later seeks
+const size_t DECODER_CACHE_SIZE = 64;
+
+struct CachedDecoder {
+    std::shared_ptr<const HuffmanDecoder> decoder;
+    uint64_t used = 0;
+};
+
+struct BrainwireReader {
+    RangeReader readRange;               // files and buffers
+    std::shared_ptr<std::ifstream> file; // kept open for readRange
+    std::istream *pipe = nullptr;        // or a pipe
+    int threads = defaultThreadCount();
+
+    WavHeader header;
+    uint64_t sampleCount = 0;
+    uint64_t blockCount = 0;
+    std::vector<IndexBlock> blocks; // random access only
+    std::vector<uint64_t> firsts;   // first sample of each block, then the total
+    uint64_t recordsEnd = 0;        // end of the last block record
+
+    size_t nextBlock = 0;   // next block to decode
+    uint64_t nextFirst = 0; // its first sample
+    std::vector<std::shared_ptr<const HuffmanDecoder>> history; // tables before it, most recent first
+    size_t historyFloor = 0; // after a seek, history covers only blocks from here on
+    std::vector<int8_t> ownTables; // per block: whether it sends its own tables, -1 until known
+    std::map<size_t, CachedDecoder> decoders;
+    uint64_t decoderUses = 0;
+    std::vector<uint8_t> pending; // a pipe record read ahead by a seek
+
+    std::vector<int16_t> window; // decoded samples of the current batch
+    uint64_t windowFirst = 0;
+    size_t windowPos = 0;
+};
+
+inline void finishOpening(BrainwireReader &reader) {
+    uint64_t position = 0;
+    for (const IndexBlock &block : reader.blocks) {
+        reader.firsts.push_back(position);
+        position += block.count;
+    }
+    if (!reader.pipe && position != reader.sampleCount) {
+        fatal("Corrupt .brainwire file: block sample counts do not match total");
+    }
+    reader.firsts.push_back(position);
+}
+
+// Read the index (version 2) or walk the record headers (version 1) of a
+// file or buffer of `size` bytes
+inline void openRandomReader(BrainwireReader &reader, uint64_t size) {
+    if (size < sizeof(FORMAT_MAGIC) + 1) {
+        fatal("Not a .brainwire file");
+    }
+    std::vector<uint8_t> head = reader.readRange(0, std::min<uint64_t>(size, FORMAT_PREAMBLE_SIZE));
+    if (memcmp(head.data(), FORMAT_MAGIC, sizeof(FORMAT_MAGIC)) != 0) {
+        fatal("Not a .brainwire file");
+    }
+    uint8_t version = head[sizeof(FORMAT_MAGIC)];
+    if (version == FORMAT_VERSION) {
+        if (size < FORMAT_PREAMBLE_SIZE) {
+            fatal("Corrupt .brainwire file: truncated preamble");
+        }
+        BrainwireIndex index = loadBrainwireIndex(head.data(), size, reader.readRange);
+        checkNoSamplePlanes(index);
+        reader.header = index.header;
+        reader.sampleCount = index.sampleCount;
+        reader.blocks = index.blocks;
+        reader.recordsEnd = index.offset;
+    } else if (version == FORMAT_VERSION_STREAM) {
+        // The stream header is at most 10 + 45 + 10 bytes, a record header 21
+        uint64_t position = sizeof(FORMAT_MAGIC) + 1;
+        std::vector<uint8_t> bytes = reader.readRange(position, std::min<uint64_t>(size - position, 65));
+        ByteReader in(bytes.data(), bytes.size());
+        reader.sampleCount = in.varint();
+        reader.header = readCompactHeader(in, reader.sampleCount);
+        uint64_t blockCount = in.varint();
+        position += in.pos;
+        for (uint64_t b = 0; b < blockCount; ++b) {
+            bytes = reader.readRange(position, std::min<uint64_t>(size - position, 21));
+            ByteReader record(bytes.data(), bytes.size());
+            record.value<uint8_t>();
+            uint64_t count = record.varint();
+            uint64_t payloadSize = record.varint();
+            if (payloadSize > size - position - record.pos) {
+                fatal("Corrupt .brainwire file: block record past end of file");
+            }
+            reader.blocks.push_back({position, count});
+            position += record.pos + payloadSize;
+        }
+        reader.recordsEnd = position;
+    } else {
+        fatal("Unsupported .brainwire version " + std::to_string(version));
+    }
+    reader.blockCount = reader.blocks.size();
+    finishOpening(reader);
+}
+
+inline BrainwireReader openBrainwireReader(const std::string &filename, int threads = defaultThreadCount()) {
+    BrainwireReader reader;
+    reader.threads = threads;
+    reader.file = std::make_shared<std::ifstream>(filename, std::ios::binary);
+    if (!*reader.file) {
+        fatal("Error opening file: " + filename);
+    }
+    reader.file->seekg(0, std::ios::end);
+    uint64_t size = static_cast<uint64_t>(reader.file->tellg());
+    std::shared_ptr<std::ifstream> file = reader.file;
+    reader.readRange = [file](uint64_t offset, uint64_t count) { return readFileRange(*file, offset, count); };
+    openRandomReader(reader, size);
+    return reader;
+}
+
+// The buffer must outlive the reader
+inline BrainwireReader openBrainwireReader(const uint8_t *data, size_t size, int threads = defaultThreadCount()) {
+    BrainwireReader reader;
+    reader.threads = threads;
+    reader.readRange = [data, size](uint64_t offset, uint64_t count) {
+        if (offset > size || count > size - offset) {
+            fatal("Unexpected end of encoded data");
+        }
+        return std::vector<uint8_t>(data + offset, data + offset + count);
+    };
+    openRandomReader(reader, size);
+    return reader;
+}
+
+inline uint8_t pipeByte(std::istream &in, std::vector<uint8_t> &bytes) {
+    int c = in.get();
+    if (c == EOF) {
+        fatal("Unexpected end of encoded data");
+    }
+    bytes.push_back(static_cast<uint8_t>(c));
+    return static_cast<uint8_t>(c);
+}
+
+// Copy one varint from the pipe to `bytes`
+inline void pipeVarint(std::istream &in, std::vector<uint8_t> &bytes) {
+    for (int i = 0; i < 10; ++i) {
+        if (!(pipeByte(in, bytes) & 0x80)) {
+            return;
+        }
+    }
+    fatal("Malformed varint in encoded data");
+}
+
+inline BrainwireReader openBrainwireReader(std::istream &in, int threads = defaultThreadCount()) {
+    BrainwireReader reader;
+    reader.threads = threads;
+    reader.pipe = &in;
+    std::vector<uint8_t> head;
+    for (size_t i = 0; i < sizeof(FORMAT_MAGIC) + 1; ++i) pipeByte(in, head);
+    if (memcmp(head.data(), FORMAT_MAGIC, sizeof(FORMAT_MAGIC)) != 0) {
+        fatal("Not a .brainwire stream");
+    }
+    if (head[sizeof(FORMAT_MAGIC)] != FORMAT_VERSION_STREAM) {
+        fatal("A pipe can only carry the stream layout (encoder --stream); version 2 files need a seekable input");
+    }
+
+    // Stream header: sample count, WAV header (template id, then 44 bytes or
+    // four varints), block count
+    std::vector<uint8_t> bytes;
+    pipeVarint(in, bytes);
+    if (pipeByte(in, bytes) == HEADER_VERBATIM) {
+        for (size_t i = 0; i < sizeof(WavHeader); ++i) pipeByte(in, bytes);
+    } else {
+        for (int i = 0; i < 4; ++i) pipeVarint(in, bytes);
+    }
+    pipeVarint(in, bytes);
+    ByteReader header(bytes.data(), bytes.size());
+    reader.sampleCount = header.varint();
+    reader.header = readCompactHeader(header, reader.sampleCount);
+    reader.blockCount = header.varint();
+    finishOpening(reader);
+    return reader;
+}
+
+// The next record from a pipe: codec byte, varint count, varint size, payload
+inline std::vector<uint8_t> readPipeRecord(BrainwireReader &reader) {
+    if (!reader.pending.empty()) {
+        return std::move(reader.pending);
+    }
+    std::istream &in = *reader.pipe;
+    std::vector<uint8_t> bytes;
+    pipeByte(in, bytes);
+    pipeVarint(in, bytes);
+    pipeVarint(in, bytes);
+    ByteReader header(bytes.data(), bytes.size());
+    header.value<uint8_t>();
+    header.varint();
+    uint64_t size = header.varint();
+    if (size > (uint64_t(1) << 32)) {
+        fatal("Corrupt .brainwire file: block record too large");
+    }
+    bytes.resize(bytes.size() + size);
+    in.read(reinterpret_cast<char*>(bytes.data() + header.pos), static_cast<std::streamsize>(size));
+    if (!in) {
+        fatal("Unexpected end of encoded data");
+    }
+    return bytes;
+}
+
+// Block b's record at `offset` in `bytes`; from a pipe, starting at sample `first`
+inline BlockRecord parseReaderRecord(const BrainwireReader &reader, const std::vector<uint8_t> &bytes, size_t offset, size_t b, uint64_t first) {
+    ByteReader in(bytes.data() + offset, bytes.size() - offset);
+    BlockRecord record = readBlockRecord(in);
+    if (record.codec == CODEC_DUPLICATE) {
+        fatal("Corrupt .brainwire file: duplicate block outside an archive");
+    }
+    if (reader.pipe ? record.count > reader.sampleCount - first : record.count != reader.blocks[b].count) {
+        fatal("Corrupt .brainwire file: block record does not match index");
+    }
+    return record;
+}
+
+inline void cacheDecoder(BrainwireReader &reader, size_t b, std::shared_ptr<const HuffmanDecoder> decoder) {
+    reader.decoders[b] = {std::move(decoder), ++reader.decoderUses};
+    if (reader.decoders.size() > DECODER_CACHE_SIZE) {
+        auto oldest = std::min_element(reader.decoders.begin(), reader.decoders.end(),
+                                       [](const auto &x, const auto &y) { return x.second.used < y.second.used; });
+        reader.decoders.erase(oldest);
+    }
+}
+
+// Walk back from the history floor until the history holds `depth` tables
+// (or the file starts): only the heads of the records are read, and blocks
+// already known are not read again
+inline void extendTableHistory(BrainwireReader &reader, size_t depth) {
+    if (reader.ownTables.empty()) {
+        reader.ownTables.assign(reader.blockCount, -1);
+    }
+    while (reader.historyFloor > 0 && reader.history.size() < depth) {
+        size_t b = --reader.historyFloor;
+        if (reader.ownTables[b] == 0) {
+            continue;
+        }
+        auto cached = reader.decoders.find(b);
+        if (cached != reader.decoders.end()) {
+            cached->second.used = ++reader.decoderUses;
+            reader.history.push_back(cached->second.decoder);
+            continue;
+        }
+        uint64_t end = b + 1 < reader.blockCount ? reader.blocks[b + 1].offset : reader.recordsEnd;
+        std::vector<uint8_t> tables;
+        reader.ownTables[b] = readRecordTables(reader.readRange, reader.blocks[b].offset, end, reader.blocks[b].count, tables);
+        if (reader.ownTables[b]) {
+            ByteReader in(tables.data(), tables.size());
+            reader.history.push_back(std::make_shared<const HuffmanDecoder>(buildHuffmanDecoder(readEntropyTables(in))));
+            cacheDecoder(reader, b, reader.history.back());
+        }
+    }
+}
+
+// Decode the next batch of blocks into the window (or with `decode` false,
+// only take note of their tables, for a pipe skipping forward)
+inline void readBatch(BrainwireReader &reader, size_t count, bool decode = true) {
+    std::vector<std::vector<uint8_t>> bytes;
+    std::vector<BlockRecord> records;
+    if (reader.pipe) {
+        for (size_t b = 0; b < count; ++b) bytes.push_back(readPipeRecord(reader));
+        uint64_t first = reader.nextFirst;
+        for (size_t b = 0; b < count; ++b) {
+            records.push_back(parseReaderRecord(reader, bytes[b], 0, reader.nextBlock + b, first));
+            first += records.back().count;
+        }
+    } else {
+        // The batch's records lie back to back, so read them in one go
+        size_t last = reader.nextBlock + count - 1;
+        uint64_t start = reader.blocks[reader.nextBlock].offset;
+        uint64_t end = last + 1 < reader.blockCount ? reader.blocks[last + 1].offset : reader.recordsEnd;
+        bytes.push_back(reader.readRange(start, end - start));
+        for (size_t b = reader.nextBlock; b <= last; ++b) {
+            records.push_back(parseReaderRecord(reader, bytes[0], reader.blocks[b].offset - start, b, reader.firsts[b]));
+        }
+    }
+
+    std::vector<BlockModel> models(records.size());
+    parallelFor(records.size(), reader.threads, [&](size_t b) {
+        models[b] = readBlockModel(records[b].codec, records[b].payload, records[b].size, records[b].count);
+    });
+    std::vector<uint8_t> codecs;
+    for (const BlockRecord &record : records) codecs.push_back(record.codec);
+    if (reader.historyFloor > 0) {
+        auto reference = [&](size_t b) { return codecs[b] == CODEC_HUFFMAN ? models[b].tableReference : -1; };
+        extendTableHistory(reader, tableHistoryDepth(records.size(), reference));
+    }
+    resolveTableReferences(codecs, models, nullptr, &reader.history);
+    if (!reader.pipe) {
+        if (reader.ownTables.empty()) reader.ownTables.assign(reader.blockCount, -1);
+        for (size_t b = 0; b < records.size(); ++b) {
+            bool own = codecs[b] == CODEC_HUFFMAN && models[b].tableReference == 0;
+            reader.ownTables[reader.nextBlock + b] = own;
+            if (own) cacheDecoder(reader, reader.nextBlock + b, models[b].huffman);
+        }
+    }
+
+    uint64_t total = 0;
+    for (BlockRecord &record : records) {
+        record.first = total;
+        total += record.count;
+    }
+    reader.window.clear();
+    reader.windowFirst = reader.nextFirst;
+    reader.windowPos = 0;
+    if (decode) {
+        reader.window.resize(total);
+        parallelFor(records.size(), reader.threads, [&](size_t b) {
+            const BlockRecord &record = records[b];
+            decodeBlock(record.codec, record.payload, record.size, models[b], reader.window.data() + record.first, record.count);
+        });
+    }
+    reader.nextBlock += count;
+    reader.nextFirst += total;
+    if (reader.nextBlock == reader.blockCount && reader.nextFirst != reader.sampleCount) {
+        fatal("Corrupt .brainwire file: block sample counts do not match total");
+    }
+    if (!decode) {
+        reader.windowFirst = reader.nextFirst;
+    }
+}
+
+// Decode up to `count` samples into `out`; returns how many there were
+// (fewer only at the end of the recording)
+inline size_t readSamples(BrainwireReader &reader, int16_t *out, size_t count) {
+    size_t done = 0;
+    while (done < count) {
+        if (reader.windowPos == reader.window.size()) {
+            if (reader.nextBlock == reader.blockCount) {
+                break;
+            }
+            readBatch(reader, std::min<uint64_t>(std::max(reader.threads, 1), reader.blockCount - reader.nextBlock));
+            continue;
+        }
+        size_t take = std::min(count - done, reader.window.size() - reader.windowPos);
+        memcpy(out + done, reader.window.data() + reader.windowPos, take * sizeof(int16_t));
+        done += take;
+        reader.windowPos += take;
+    }
+    return done;
+}
+
+// The sample the next read starts at
+inline uint64_t readerPosition(const BrainwireReader &reader) {
+    return reader.windowFirst + reader.windowPos;
+}
+
+// Make `sample` the next one read
+inline void seekSamples(BrainwireReader &reader, uint64_t sample) {
+    if (sample > reader.sampleCount) {
+        fatal("Cannot seek to sample " + std::to_string(sample) + " of " + std::to_string(reader.sampleCount));
+    }
+    if (sample >= reader.windowFirst && sample <= reader.windowFirst + reader.window.size()) {
+        reader.windowPos = sample - reader.windowFirst;
+        return;
+    }
+    if (reader.pipe) {
+        if (sample < reader.windowFirst) {
+            fatal("Cannot seek backwards in a pipe");
+        }
+        // Parse the blocks that end before `sample` only for their tables
+        while (reader.nextBlock < reader.blockCount) {
+            std::vector<uint8_t> bytes = readPipeRecord(reader);
+            BlockRecord record = parseReaderRecord(reader, bytes, 0, reader.nextBlock, reader.nextFirst);
+            reader.pending = std::move(bytes);
+            if (reader.nextFirst + record.count > sample) {
+                break;
+            }
+            readBatch(reader, 1, false);
+        }
+    } else {
+        size_t b = std::upper_bound(reader.firsts.begin(), reader.firsts.end(), sample) - reader.firsts.begin() - 1;
+        // The tables before b are looked up when a block needs them
+        reader.history.clear();
+        reader.historyFloor = b;
+        reader.nextBlock = b;
+        reader.nextFirst = reader.firsts[b];
+    }
+    reader.window.clear();
+    reader.windowFirst = reader.nextFirst;
+    reader.windowPos = 0;
+    if (sample > reader.nextFirst) {
+        readBatch(reader, std::min<uint64_t>(std::max(reader.threads, 1), reader.blockCount - reader.nextBlock));
+        reader.windowPos = sample - reader.windowFirst;
+    }
+}
+
+#endif
@@ -0,0 +1,148 @@
+#ifndef BRAINWIRE_RUNS_H
+#define BRAINWIRE_RUNS_H
+
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "common.h"
+
+// Run tokens for flat or ramping stretches (saturation, disconnected
+// electrodes, zero-filled gaps). Runs of at least MIN_RUN samples with a
+// constant step are cut out of the block before prediction and sent as
+// (offset, length, first value, step); the rest of the pipeline codes only
+// what is left, and the decoder expands the runs with SIMD fills.
+
+const size_t MIN_RUN = 32;
+
+struct SampleRun {
+    uint32_t start;
+    uint32_t length;
+    int16_t base;
+    int16_t step;
+};
+
+inline std::vector<SampleRun> findRuns(const int16_t *samples, size_t count) {
+    std::vector<SampleRun> runs;
+    size_t i = 0;
+    while (i + MIN_RUN <= count) {
+        int step = samples[i + 1] - samples[i];
+        size_t end = i + 1;
+        while (end < count && samples[end] - samples[end - 1] == step) {
+            end++;
+        }
+        if (end - i >= MIN_RUN && step >= -32768 && step <= 32767) {
+            runs.push_back({static_cast<uint32_t>(i), static_cast<uint32_t>(end - i), samples[i], static_cast<int16_t>(step)});
+            i = end;
+        } else {
+            // The ramp through `end - 1` is too short; a run can only start
+            // at its last sample
+            i = std::max(i + 1, end - 1);
+        }
+    }
+    return runs;
+}
+
+// Samples outside the runs, in order
+inline std::vector<int16_t> removeRuns(const int16_t *samples, size_t count, const std::vector<SampleRun> &runs) {
+    std::vector<int16_t> rest;
+    rest.reserve(count);
+    size_t position = 0;
+    for (const SampleRun &run : runs) {
+        rest.insert(rest.end(), samples + position, samples + run.start);
+        position = run.start + run.length;
+    }
+    rest.insert(rest.end(), samples + position, samples + count);
+    return rest;
+}
+
+// out[i] = base + i * step, wrapping like the encoder's 16-bit samples
+inline void fillRamp(int16_t *out, size_t length, int16_t base, int16_t step) {
+    size_t i = 0;
+#if defined(__SSE2__)
+    __m128i value = _mm_setr_epi16(0, 1, 2, 3, 4, 5, 6, 7);
+    value = _mm_add_epi16(_mm_mullo_epi16(value, _mm_set1_epi16(step)), _mm_set1_epi16(base));
+    __m128i increment = _mm_set1_epi16(static_cast<int16_t>(step * 8));
+    for (; i + 8 <= length; i += 8) {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), value);
+        value = _mm_add_epi16(value, increment);
+    }
+#endif
+    for (; i < length; ++i) {
+        out[i] = static_cast<int16_t>(static_cast<uint16_t>(base + static_cast<uint32_t>(i) * static_cast<uint16_t>(step)));
+    }
+}
+
+// `out` holds the `rest` samples at its front; spread them out to their
+// final positions (back to front, so nothing is overwritten early) and fill
+// the runs in between.
+inline void expandRuns(int16_t *out, size_t count, size_t rest, const std::vector<SampleRun> &runs) {
+    size_t runSamples = 0;
+    size_t position = 0;
+    for (const SampleRun &run : runs) {
+        if (run.start < position || run.start > count || run.length > count - run.start) {
+            fatal("Corrupt run tokens: bad offset");
+        }
+        position = run.start + run.length;
+        runSamples += run.length;
+    }
+    if (runSamples + rest != count) {
+        fatal("Corrupt run tokens: lengths do not match block");
+    }
+
+    size_t source = rest;
+    size_t end = count;
+    for (size_t r = runs.size(); r-- > 0;) {
+        const SampleRun &run = runs[r];
+        size_t after = end - (run.start + run.length);
+        source -= after;
+        memmove(out + run.start + run.length, out + source, after * sizeof(int16_t));
+        fillRamp(out + run.start, run.length, run.base, run.step);
+        end = run.start;
+    }
+}
+
+inline void writeRuns(std::vector<uint8_t> &out, const std::vector<SampleRun> &runs) {
+    putVarint(out, runs.size());
+    uint32_t position = 0;
+    for (const SampleRun &run : runs) {
+        putVarint(out, run.start - position);
+        putVarint(out, run.length - MIN_RUN);
+        putVarint(out, zigzag(run.base));
+        putVarint(out, zigzag(run.step));
+        position = run.start + run.length;
+    }
+}
+
+inline std::vector<SampleRun> readRuns(ByteReader &in) {
+    uint64_t count = in.varint();
+    if (count > in.size - in.pos) {
+        fatal("Corrupt run tokens: bad run count");
+    }
+    std::vector<SampleRun> runs(count);
+    uint64_t position = 0;
+    for (SampleRun &run : runs) {
+        uint64_t gap = in.varint();
+        uint64_t length = in.varint();
+        uint64_t base = in.varint();
+        uint64_t step = in.varint();
+        if (gap > UINT32_MAX || length > UINT32_MAX || position + gap + length + MIN_RUN > UINT32_MAX || base > 0xFFFF || step > 0xFFFF) {
+            fatal("Corrupt run tokens: value out of range");
+        }
+        position += gap;
+        length += MIN_RUN;
+        run.start = static_cast<uint32_t>(position);
+        run.length = static_cast<uint32_t>(length);
+        run.base = static_cast<int16_t>(unzigzag(static_cast<uint32_t>(base)));
+        run.step = static_cast<int16_t>(unzigzag(static_cast<uint32_t>(step)));
+        position += length;
+    }
+    return runs;
+}
+
+#endif
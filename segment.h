@@ -0,0 +1,172 @@
+#ifndef BRAINWIRE_SEGMENT_H
+#define BRAINWIRE_SEGMENT_H
+
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#include "runs.h"
+
+// Adaptive block boundaries. The signal is cut into fixed analysis windows
+// and a dynamic program picks the split into blocks (runs of whole windows)
+// with the smallest estimated size. A block is costed like
+// estimateCodedBits on the first differences of its samples, plus a fixed
+// per-block overhead, so quiet stretches merge into long blocks and a
+// regime change starts a new one where the statistics differ enough to pay
+// for another table.
+//
+// Samples inside constant/ramp runs are left out, since runs are coded
+// separately. Each window's differences are kept as a sparse histogram, so
+// costing a block grown by one window touches only that window's distinct
+// values. The longest block the DP considers (in windows) grows with the
+// level, which bounds the work to O(samples x maxWindows / windowSize)
+// updates; a final pass merges neighbouring blocks past that horizon (up to
+// the codec's block size) while that still lowers the estimate.
+
+const size_t SEGMENT_WINDOW = 4096;
+const double BLOCK_OVERHEAD_BITS = 8 * 32;
+
+struct Segment {
+    size_t first;
+    size_t count;
+};
+
+inline size_t segmentWindowsForLevel(int level) {
+    if (level <= 0) return 0;
+    if (level <= 3) return 8;
+    if (level <= 6) return 32;
+    return 256;
+}
+
+inline std::vector<Segment> fixedSegments(size_t sampleCount, size_t blockSize) {
+    std::vector<Segment> segments;
+    for (size_t first = 0; first < sampleCount; first += blockSize) {
+        segments.push_back({first, std::min(blockSize, sampleCount - first)});
+    }
+    return segments;
+}
+
+// Running histogram whose estimateCodedBits cost is updated per change
+class SegmentCost {
+public:
+    SegmentCost() : frequencies(65536, 0) {}
+
+    void add(uint16_t symbol, int64_t delta) {
+        int64_t before = frequencies[symbol];
+        int64_t after = before + delta;
+        frequencies[symbol] = static_cast<uint32_t>(after);
+        sumFLogF += fLogF(after) - fLogF(before);
+        distinct += (after > 0) - (before > 0);
+        singletons += (after == 1) - (before == 1);
+        total += delta;
+    }
+
+    double bits() const {
+        if (total == 0) return 0;
+        double n = static_cast<double>(total);
+        return n * std::log2(n) - sumFLogF + 20.0 * (distinct - singletons) + 16.0 * singletons;
+    }
+
+private:
+    static double fLogF(int64_t f) {
+        return f > 1 ? f * std::log2(static_cast<double>(f)) : 0;
+    }
+
+    std::vector<uint32_t> frequencies;
+    double sumFLogF = 0;
+    int64_t distinct = 0;
+    int64_t singletons = 0;
+    int64_t total = 0;
+};
+
+// Block boundaries for `samples`: blocks are whole analysis windows, at most
+// min(maxBlockSize, window limit for the level) long.
+inline std::vector<Segment> chooseSegments(const int16_t *samples, size_t sampleCount, size_t maxBlockSize, int level) {
+    size_t maxWindows = std::min(segmentWindowsForLevel(level), maxBlockSize / SEGMENT_WINDOW);
+    if (maxWindows <= 1 || sampleCount <= SEGMENT_WINDOW) {
+        return fixedSegments(sampleCount, maxBlockSize);
+    }
+
+    std::vector<uint8_t> inRun(sampleCount, 0);
+    for (const SampleRun &run : findRuns(samples, sampleCount)) {
+        std::fill(inRun.begin() + run.start, inRun.begin() + run.start + run.length, 1);
+    }
+
+    size_t windowCount = (sampleCount + SEGMENT_WINDOW - 1) / SEGMENT_WINDOW;
+    std::vector<std::vector<std::pair<uint16_t, uint32_t>>> histograms(windowCount);
+    std::vector<uint32_t> scratch(65536, 0);
+    for (size_t w = 0; w < windowCount; ++w) {
+        size_t first = w * SEGMENT_WINDOW;
+        size_t last = std::min(first + SEGMENT_WINDOW, sampleCount);
+        std::vector<uint16_t> touched;
+        for (size_t i = first; i < last; ++i) {
+            if (inRun[i]) continue;
+            uint16_t symbol = static_cast<uint16_t>(samples[i] - (i > 0 ? samples[i - 1] : 0));
+            if (scratch[symbol]++ == 0) touched.push_back(symbol);
+        }
+        for (uint16_t symbol : touched) {
+            histograms[w].push_back({symbol, scratch[symbol]});
+            scratch[symbol] = 0;
+        }
+    }
+
+    // best[j]: cheapest split of windows [0, j); from[j]: start of its last block
+    std::vector<double> best(windowCount + 1, INFINITY);
+    std::vector<size_t> from(windowCount + 1, 0);
+    best[0] = 0;
+    SegmentCost cost;
+    for (size_t i = 0; i < windowCount; ++i) {
+        size_t end = std::min(windowCount, i + maxWindows);
+        for (size_t j = i; j < end; ++j) {
+            for (const auto &entry : histograms[j]) cost.add(entry.first, entry.second);
+            double candidate = best[i] + cost.bits() + BLOCK_OVERHEAD_BITS;
+            if (candidate < best[j + 1]) {
+                best[j + 1] = candidate;
+                from[j + 1] = i;
+            }
+        }
+        for (size_t j = i; j < end; ++j) {
+            for (const auto &entry : histograms[j]) cost.add(entry.first, -static_cast<int64_t>(entry.second));
+        }
+    }
+
+    // Blocks as window ranges [start, end), then merged past the horizon
+    std::vector<std::pair<size_t, size_t>> blocks;
+    for (size_t j = windowCount; j > 0; j = from[j]) {
+        blocks.push_back({from[j], j});
+    }
+    std::reverse(blocks.begin(), blocks.end());
+
+    size_t maxMergedWindows = maxBlockSize / SEGMENT_WINDOW;
+    auto rangeBits = [&](size_t start, size_t end) {
+        for (size_t w = start; w < end; ++w) {
+            for (const auto &entry : histograms[w]) cost.add(entry.first, entry.second);
+        }
+        double bits = cost.bits() + BLOCK_OVERHEAD_BITS;
+        for (size_t w = start; w < end; ++w) {
+            for (const auto &entry : histograms[w]) cost.add(entry.first, -static_cast<int64_t>(entry.second));
+        }
+        return bits;
+    };
+    std::vector<std::pair<size_t, size_t>> merged;
+    for (const auto &block : blocks) {
+        if (!merged.empty() && block.second - merged.back().first <= maxMergedWindows &&
+            rangeBits(merged.back().first, block.second) < rangeBits(merged.back().first, merged.back().second) + rangeBits(block.first, block.second)) {
+            merged.back().second = block.second;
+        } else {
+            merged.push_back(block);
+        }
+    }
+
+    std::vector<Segment> segments;
+    for (const auto &block : merged) {
+        size_t first = block.first * SEGMENT_WINDOW;
+        size_t last = std::min(block.second * SEGMENT_WINDOW, sampleCount);
+        segments.push_back({first, last - first});
+    }
+    return segments;
+}
+
+#endif
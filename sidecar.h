@@ -0,0 +1,277 @@
+#ifndef BRAINWIRE_SIDECAR_H
+#define BRAINWIRE_SIDECAR_H
+
+#include <vector>
+#include <string>
+#include <utility>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "common.h"
+
+// Feature sidecar: per-window band power and threshold-crossing counts,
+// computed by the encoder from the samples it already holds, so analytics
+// can read them without decoding the recording.
+//
+// Each band is a second-order Butterworth high-pass at its low edge followed
+// by a low-pass at its high edge (RBJ biquads, transposed direct form II, in
+// double precision); its power is the mean square of the filter output over
+// the window. Bands are filtered two to an SSE2 register. A crossing of
+// threshold T >= 0 is a step from <= T to > T, of T < 0 a step from >= T to
+// < T (spikes are usually negative); they are counted eight samples at a
+// time with SSE2 compares.
+//
+// Sidecar layout (little-endian):
+//
+//   magic "BRWF", version byte
+//   varint sample rate, varint sample count, varint window length
+//   varint band count, per band: varint low Hz, varint high Hz
+//   varint threshold count, per threshold: zigzag varint
+//   per window: per band varint round(256 * log2(1 + power)), then per
+//     threshold varint crossing count
+
+const char FEATURE_MAGIC[4] = {'B', 'R', 'W', 'F'};
+const uint8_t FEATURE_VERSION = 1;
+const size_t DEFAULT_FEATURE_WINDOW = 2048;
+const double POWER_STEPS_PER_OCTAVE = 256.0;
+
+struct FeatureOptions {
+    size_t window = DEFAULT_FEATURE_WINDOW;
+    std::vector<std::pair<uint32_t, uint32_t>> bands = {{300, 3000}}; // low, high in Hz; 0 / >= Nyquist = open
+    std::vector<int16_t> thresholds;
+};
+
+struct FeatureSet {
+    uint32_t sampleRate = 0;
+    uint64_t sampleCount = 0;
+    FeatureOptions options;
+    std::vector<double> power;       // window-major: power[w * bands + b]
+    std::vector<uint32_t> crossings; // crossings[w * thresholds + t]
+
+    size_t windowCount() const {
+        return options.window > 0 ? (sampleCount + options.window - 1) / options.window : 0;
+    }
+};
+
+struct Biquad {
+    double b0 = 1, b1 = 0, b2 = 0, a1 = 0, a2 = 0;
+};
+
+// Butterworth (Q = 1/sqrt(2)) high- or low-pass at `cutoff`; a pass-through
+// when the cutoff is outside (0, Nyquist)
+inline Biquad butterworth(double cutoff, double sampleRate, bool highPass) {
+    Biquad biquad;
+    if (cutoff <= 0 || cutoff >= sampleRate / 2) {
+        return biquad;
+    }
+    double w0 = 2 * M_PI * cutoff / sampleRate;
+    double alpha = std::sin(w0) / (2 * M_SQRT1_2);
+    double c = std::cos(w0);
+    double a0 = 1 + alpha;
+    double edge = highPass ? (1 + c) / 2 : (1 - c) / 2;
+    biquad.b0 = edge / a0;
+    biquad.b1 = (highPass ? -2 * edge : 2 * edge) / a0;
+    biquad.b2 = edge / a0;
+    biquad.a1 = -2 * c / a0;
+    biquad.a2 = (1 - alpha) / a0;
+    return biquad;
+}
+
+// Mean square of each band's filtered signal per window, filtering two
+// bands per pass
+inline void bandPowers(const int16_t *samples, size_t count, uint32_t sampleRate, const FeatureOptions &options, std::vector<double> &power) {
+    size_t bandCount = options.bands.size();
+    size_t windowCount = (count + options.window - 1) / options.window;
+    power.assign(windowCount * bandCount, 0);
+    for (size_t first = 0; first < bandCount; first += 2) {
+        size_t lanes = std::min<size_t>(2, bandCount - first);
+        // Stage s of lane l: coefficients[s][field][l]
+        double coefficients[2][5][2];
+        for (size_t l = 0; l < 2; ++l) {
+            std::pair<uint32_t, uint32_t> band = options.bands[first + std::min(l, lanes - 1)];
+            Biquad stages[2] = {butterworth(band.first, sampleRate, true), butterworth(band.second, sampleRate, false)};
+            for (int s = 0; s < 2; ++s) {
+                const double fields[5] = {stages[s].b0, stages[s].b1, stages[s].b2, stages[s].a1, stages[s].a2};
+                for (int f = 0; f < 5; ++f) coefficients[s][f][l] = fields[f];
+            }
+        }
+#if defined(__SSE2__)
+        __m128d c[2][5];
+        for (int s = 0; s < 2; ++s) {
+            for (int f = 0; f < 5; ++f) c[s][f] = _mm_loadu_pd(coefficients[s][f]);
+        }
+        __m128d z1[2] = {_mm_setzero_pd(), _mm_setzero_pd()}, z2[2] = {_mm_setzero_pd(), _mm_setzero_pd()};
+        for (size_t w = 0; w < windowCount; ++w) {
+            size_t end = std::min(count, (w + 1) * options.window);
+            __m128d sum = _mm_setzero_pd();
+            for (size_t i = w * options.window; i < end; ++i) {
+                __m128d y = _mm_set1_pd(samples[i]);
+                for (int s = 0; s < 2; ++s) {
+                    __m128d x = y;
+                    y = _mm_add_pd(_mm_mul_pd(c[s][0], x), z1[s]);
+                    z1[s] = _mm_add_pd(_mm_sub_pd(_mm_mul_pd(c[s][1], x), _mm_mul_pd(c[s][3], y)), z2[s]);
+                    z2[s] = _mm_sub_pd(_mm_mul_pd(c[s][2], x), _mm_mul_pd(c[s][4], y));
+                }
+                sum = _mm_add_pd(sum, _mm_mul_pd(y, y));
+            }
+            double sums[2];
+            _mm_storeu_pd(sums, sum);
+            for (size_t l = 0; l < lanes; ++l) power[w * bandCount + first + l] = sums[l] / (end - w * options.window);
+        }
+#else
+        double z1[2][2] = {}, z2[2][2] = {};
+        for (size_t w = 0; w < windowCount; ++w) {
+            size_t end = std::min(count, (w + 1) * options.window);
+            double sums[2] = {};
+            for (size_t i = w * options.window; i < end; ++i) {
+                for (size_t l = 0; l < 2; ++l) {
+                    double y = samples[i];
+                    for (int s = 0; s < 2; ++s) {
+                        double x = y;
+                        y = coefficients[s][0][l] * x + z1[s][l];
+                        z1[s][l] = coefficients[s][1][l] * x - coefficients[s][3][l] * y + z2[s][l];
+                        z2[s][l] = coefficients[s][2][l] * x - coefficients[s][4][l] * y;
+                    }
+                    sums[l] += y * y;
+                }
+            }
+            for (size_t l = 0; l < lanes; ++l) power[w * bandCount + first + l] = sums[l] / (end - w * options.window);
+        }
+#endif
+    }
+}
+
+// Crossings of `threshold` at samples [first, end) (each compared with the
+// sample before it), first >= 1
+inline uint32_t countCrossings(const int16_t *samples, size_t first, size_t end, int16_t threshold) {
+    uint32_t crossings = 0;
+    size_t i = first;
+#if defined(__SSE2__)
+    const __m128i t = _mm_set1_epi16(threshold);
+    for (; i + 8 <= end; i += 8) {
+        __m128i current = _mm_loadu_si128(reinterpret_cast<const __m128i*>(samples + i));
+        __m128i previous = _mm_loadu_si128(reinterpret_cast<const __m128i*>(samples + i - 1));
+        __m128i crossed = threshold >= 0 ? _mm_andnot_si128(_mm_cmpgt_epi16(previous, t), _mm_cmpgt_epi16(current, t))
+                                         : _mm_andnot_si128(_mm_cmplt_epi16(previous, t), _mm_cmplt_epi16(current, t));
+        crossings += __builtin_popcount(_mm_movemask_epi8(crossed)) / 2;
+    }
+#endif
+    for (; i < end; ++i) {
+        crossings += threshold >= 0 ? (samples[i - 1] <= threshold && samples[i] > threshold)
+                                    : (samples[i - 1] >= threshold && samples[i] < threshold);
+    }
+    return crossings;
+}
+
+inline FeatureSet extractFeatures(const int16_t *samples, size_t count, uint32_t sampleRate, const FeatureOptions &options) {
+    if (options.window == 0) {
+        fatal("Feature window must be at least one sample");
+    }
+    FeatureSet features;
+    features.sampleRate = sampleRate;
+    features.sampleCount = count;
+    features.options = options;
+    bandPowers(samples, count, sampleRate, options, features.power);
+
+    size_t windowCount = features.windowCount();
+    size_t thresholdCount = options.thresholds.size();
+    features.crossings.assign(windowCount * thresholdCount, 0);
+    for (size_t w = 0; w < windowCount; ++w) {
+        size_t first = std::max<size_t>(1, w * options.window);
+        size_t end = std::min(count, (w + 1) * options.window);
+        for (size_t t = 0; t < thresholdCount && first < end; ++t) {
+            features.crossings[w * thresholdCount + t] = countCrossings(samples, first, end, options.thresholds[t]);
+        }
+    }
+    return features;
+}
+
+inline std::vector<uint8_t> writeFeatureSidecar(const FeatureSet &features) {
+    std::vector<uint8_t> out(FEATURE_MAGIC, FEATURE_MAGIC + sizeof(FEATURE_MAGIC));
+    out.push_back(FEATURE_VERSION);
+    putVarint(out, features.sampleRate);
+    putVarint(out, features.sampleCount);
+    putVarint(out, features.options.window);
+    putVarint(out, features.options.bands.size());
+    for (const auto &band : features.options.bands) {
+        putVarint(out, band.first);
+        putVarint(out, band.second);
+    }
+    putVarint(out, features.options.thresholds.size());
+    for (int16_t threshold : features.options.thresholds) putVarint(out, zigzag(threshold));
+
+    size_t bandCount = features.options.bands.size(), thresholdCount = features.options.thresholds.size();
+    for (size_t w = 0; w < features.windowCount(); ++w) {
+        for (size_t b = 0; b < bandCount; ++b) {
+            putVarint(out, static_cast<uint64_t>(std::lround(POWER_STEPS_PER_OCTAVE * std::log2(1 + features.power[w * bandCount + b]))));
+        }
+        for (size_t t = 0; t < thresholdCount; ++t) putVarint(out, features.crossings[w * thresholdCount + t]);
+    }
+    return out;
+}
+
+inline FeatureSet readFeatureSidecar(const std::vector<uint8_t> &data) {
+    ByteReader in(data.data(), data.size());
+    if (memcmp(in.bytes(sizeof(FEATURE_MAGIC)), FEATURE_MAGIC, sizeof(FEATURE_MAGIC)) != 0) {
+        fatal("Not a feature sidecar");
+    }
+    uint8_t version = in.value<uint8_t>();
+    if (version != FEATURE_VERSION) {
+        fatal("Unsupported feature sidecar version " + std::to_string(version));
+    }
+    FeatureSet features;
+    uint64_t sampleRate = in.varint();
+    features.sampleCount = in.varint();
+    features.options.window = in.varint();
+    uint64_t bandCount = in.varint();
+    if (sampleRate > UINT32_MAX || features.options.window == 0 || bandCount > in.size - in.pos) {
+        fatal("Corrupt feature sidecar header");
+    }
+    features.sampleRate = static_cast<uint32_t>(sampleRate);
+    features.options.bands.clear();
+    for (uint64_t b = 0; b < bandCount; ++b) {
+        uint64_t low = in.varint();
+        uint64_t high = in.varint();
+        if (low > UINT32_MAX || high > UINT32_MAX) {
+            fatal("Corrupt feature sidecar header");
+        }
+        features.options.bands.push_back({static_cast<uint32_t>(low), static_cast<uint32_t>(high)});
+    }
+    uint64_t thresholdCount = in.varint();
+    if (thresholdCount > in.size - in.pos) {
+        fatal("Corrupt feature sidecar header");
+    }
+    for (uint64_t t = 0; t < thresholdCount; ++t) {
+        uint64_t threshold = in.varint();
+        if (threshold > 0xFFFF) {
+            fatal("Corrupt feature sidecar header");
+        }
+        features.options.thresholds.push_back(static_cast<int16_t>(unzigzag(static_cast<uint32_t>(threshold))));
+    }
+
+    size_t windowCount = features.windowCount();
+    if (windowCount > 0 && bandCount + thresholdCount > (in.size - in.pos) / windowCount) {
+        fatal("Corrupt feature sidecar: truncated");
+    }
+    for (size_t w = 0; w < windowCount; ++w) {
+        for (uint64_t b = 0; b < bandCount; ++b) {
+            features.power.push_back(std::exp2(in.varint() / POWER_STEPS_PER_OCTAVE) - 1);
+        }
+        for (uint64_t t = 0; t < thresholdCount; ++t) {
+            uint64_t crossings = in.varint();
+            if (crossings > features.options.window) {
+                fatal("Corrupt feature sidecar: crossing count exceeds window");
+            }
+            features.crossings.push_back(static_cast<uint32_t>(crossings));
+        }
+    }
+    return features;
+}
+
+#endif
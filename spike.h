@@ -0,0 +1,192 @@
+#ifndef BRAINWIRE_SPIKE_H
+#define BRAINWIRE_SPIKE_H
+
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+
+#include "common.h"
+
+// Spike-template matching stage.
+//
+// Action potentials of one neuron repeat almost the same waveform, which
+// sample-by-sample prediction cannot see. The encoder keeps a small
+// dictionary of recent spike snippets; a detected spike that is close to a
+// stored snippet is predicted from it, so only the small difference reaches
+// the entropy coder. Spike events are sent explicitly (start offset and
+// dictionary slot) and both sides update the dictionary from the
+// reconstructed samples in the same order.
+
+const int SNIPPET_LENGTH = 32;
+const int SNIPPET_PRE = 8; // samples kept before the threshold crossing
+const int TEMPLATE_SLOTS = 64;
+const uint8_t TEMPLATE_NEW = 0xFF; // spike not matched, only remembered
+const int DEFAULT_TEMPLATE_BUDGET = 8;
+
+struct SpikeEvent {
+    uint32_t start;
+    uint8_t slot;
+};
+
+struct SpikeStats {
+    size_t spikes = 0;
+    size_t matched = 0;
+    size_t comparisons = 0;
+};
+
+// Coarse waveform key: position and sign of the peak and its bit length.
+// Snippets with the same key are compared first.
+inline int snippetSignature(const int32_t *snippet) {
+    int peak = 0;
+    for (int i = 1; i < SNIPPET_LENGTH; ++i) {
+        if (std::abs(snippet[i]) > std::abs(snippet[peak])) peak = i;
+    }
+    int magnitude = std::abs(snippet[peak]);
+    int bits = 0;
+    while (magnitude >> bits) bits++;
+    return peak << 6 | (snippet[peak] < 0) << 5 | bits;
+}
+
+struct TemplateDictionary {
+    int32_t snippets[TEMPLATE_SLOTS][SNIPPET_LENGTH];
+    int signatures[TEMPLATE_SLOTS];
+    uint32_t lastUse[TEMPLATE_SLOTS];
+    int used = 0;
+    uint32_t clock = 0;
+
+    // Store a spike after it has been coded: a matched spike replaces its
+    // slot (tracking slow drift while staying on the ADC's value grid), a
+    // new one takes a free or the least recently used slot.
+    void remember(uint8_t slot, const int32_t *snippet) {
+        int target = slot;
+        if (slot == TEMPLATE_NEW) {
+            if (used < TEMPLATE_SLOTS) {
+                target = used++;
+            } else {
+                target = static_cast<int>(std::min_element(lastUse, lastUse + TEMPLATE_SLOTS) - lastUse);
+            }
+        } else if (slot >= used) {
+            fatal("Corrupt spike events: unknown template slot");
+        }
+        std::copy(snippet, snippet + SNIPPET_LENGTH, snippets[target]);
+        signatures[target] = snippetSignature(snippet);
+        lastUse[target] = ++clock;
+    }
+
+    // Best slot for a snippet using at most `budget` full comparisons, or
+    // -1 if the dictionary is empty. Candidates with a matching signature
+    // go first, then the most recently used ones.
+    int findNearest(const int32_t *snippet, int budget, uint32_t &bestCost, SpikeStats &stats) const {
+        int order[TEMPLATE_SLOTS];
+        for (int i = 0; i < used; ++i) order[i] = i;
+        int signature = snippetSignature(snippet);
+        std::sort(order, order + used, [&](int a, int b) {
+            bool matchA = signatures[a] == signature;
+            bool matchB = signatures[b] == signature;
+            if (matchA != matchB) return matchA;
+            return lastUse[a] > lastUse[b];
+        });
+
+        int best = -1;
+        bestCost = UINT32_MAX;
+        for (int c = 0; c < used && c < budget; ++c) {
+            const int32_t *candidate = snippets[order[c]];
+            uint32_t cost = 0;
+            for (int i = 0; i < SNIPPET_LENGTH && cost < bestCost; ++i) {
+                cost += std::abs(snippet[i] - candidate[i]);
+            }
+            stats.comparisons++;
+            if (cost < bestCost) {
+                bestCost = cost;
+                best = order[c];
+            }
+        }
+        return best;
+    }
+};
+
+inline int32_t medianOf(std::vector<int32_t> values) {
+    if (values.empty()) return 0;
+    std::nth_element(values.begin(), values.begin() + values.size() / 2, values.end());
+    return values[values.size() / 2];
+}
+
+// Detect spikes (threshold at about four robust standard deviations of the
+// domain signal y), match them against the dictionary and replace the
+// baseline `residuals` of matched spikes by their difference from the
+// template.
+inline std::vector<SpikeEvent> matchSpikeTemplates(const int32_t *y, size_t count, int budget, int16_t *residuals, SpikeStats &stats) {
+    std::vector<SpikeEvent> events;
+    if (count < static_cast<size_t>(SNIPPET_LENGTH)) {
+        return events;
+    }
+
+    int32_t center = medianOf(std::vector<int32_t>(y, y + count));
+    std::vector<int32_t> deviations(count);
+    for (size_t i = 0; i < count; ++i) {
+        deviations[i] = std::abs(y[i] - center);
+    }
+    int32_t threshold = std::max(4 * medianOf(deviations) * 3 / 2, 1);
+
+    TemplateDictionary dictionary;
+    for (size_t i = SNIPPET_PRE; i + SNIPPET_LENGTH - SNIPPET_PRE <= count; ++i) {
+        if (std::abs(y[i] - center) <= threshold) {
+            continue;
+        }
+        size_t start = i - SNIPPET_PRE;
+        const int32_t *snippet = y + start;
+        stats.spikes++;
+
+        uint32_t baseline = 0;
+        for (int j = 0; j < SNIPPET_LENGTH; ++j) {
+            baseline += std::abs(residuals[start + j]);
+        }
+        uint32_t cost;
+        int slot = dictionary.findNearest(snippet, budget, cost, stats);
+
+        SpikeEvent event = {static_cast<uint32_t>(start), TEMPLATE_NEW};
+        if (slot >= 0 && cost * 10 < baseline * 7) {
+            event.slot = static_cast<uint8_t>(slot);
+            for (int j = 0; j < SNIPPET_LENGTH; ++j) {
+                residuals[start + j] = static_cast<int16_t>(snippet[j] - dictionary.snippets[slot][j]);
+            }
+            stats.matched++;
+        }
+        dictionary.remember(event.slot, snippet);
+        events.push_back(event);
+        i = start + SNIPPET_LENGTH + SNIPPET_PRE - 1; // next snippet starts after this one
+    }
+    return events;
+}
+
+inline void writeSpikeEvents(std::vector<uint8_t> &out, const std::vector<SpikeEvent> &events) {
+    putVarint(out, events.size());
+    uint32_t position = 0;
+    for (const SpikeEvent &event : events) {
+        putVarint(out, event.start - position);
+        out.push_back(event.slot);
+        position = event.start + SNIPPET_LENGTH;
+    }
+}
+
+inline std::vector<SpikeEvent> readSpikeEvents(ByteReader &in) {
+    uint64_t count = in.varint();
+    if (count > in.size - in.pos) {
+        fatal("Corrupt spike events: bad event count");
+    }
+    std::vector<SpikeEvent> events(count);
+    uint64_t position = 0;
+    for (SpikeEvent &event : events) {
+        position += in.varint();
+        if (position > UINT32_MAX) {
+            fatal("Corrupt spike events: offset out of range");
+        }
+        event.start = static_cast<uint32_t>(position);
+        event.slot = in.value<uint8_t>();
+        position += SNIPPET_LENGTH;
+    }
+    return events;
+}
+
+#endif
@@ -0,0 +1,93 @@
+#ifndef BRAINWIRE_VALUEMAP_H
+#define BRAINWIRE_VALUEMAP_H
+
+#include <vector>
+#include <cstdint>
+
+#include "common.h"
+
+// Rank remapping for recordings that only use a sparse set of values.
+//
+// ADC samples scaled to microvolts land on a grid (e.g. multiples of ~64),
+// so a linear predictor working on raw values produces residuals off the
+// grid and loses more than it gains. Mapping every sample to its rank among
+// the block's distinct values makes the grid dense again; prediction then
+// runs on ranks and the decoder maps them back.
+
+struct ValueMap {
+    std::vector<int16_t> values; // sorted, distinct
+};
+
+inline ValueMap buildValueMap(const int16_t *samples, size_t count) {
+    std::vector<uint8_t> present(65536, 0);
+    for (size_t i = 0; i < count; ++i) {
+        present[static_cast<uint16_t>(samples[i]) ^ 0x8000] = 1;
+    }
+    ValueMap map;
+    for (int v = 0; v < 65536; ++v) {
+        if (present[v]) map.values.push_back(static_cast<int16_t>(v - 32768));
+    }
+    return map;
+}
+
+// Worth trying only if the values leave gaps in their range
+inline bool valueMapIsSparse(const ValueMap &map) {
+    if (map.values.size() < 2) return false;
+    int range = map.values.back() - map.values.front() + 1;
+    return static_cast<size_t>(range) > 2 * map.values.size();
+}
+
+inline std::vector<int32_t> mapToRanks(const ValueMap &map, const int16_t *samples, size_t count) {
+    std::vector<int32_t> rankOf(65536, 0);
+    for (size_t r = 0; r < map.values.size(); ++r) {
+        rankOf[static_cast<uint16_t>(map.values[r])] = static_cast<int32_t>(r);
+    }
+    std::vector<int32_t> ranks(count);
+    for (size_t i = 0; i < count; ++i) {
+        ranks[i] = rankOf[static_cast<uint16_t>(samples[i])];
+    }
+    return ranks;
+}
+
+inline void mapFromRanks(const ValueMap &map, const int32_t *ranks, size_t count, int16_t *samples) {
+    for (size_t i = 0; i < count; ++i) {
+        if (static_cast<uint32_t>(ranks[i]) >= map.values.size()) {
+            fatal("Corrupt encoded data: rank outside value map");
+        }
+        samples[i] = map.values[ranks[i]];
+    }
+}
+
+// Sorted values as the first value plus gap varints
+inline void writeValueMap(std::vector<uint8_t> &out, const ValueMap &map) {
+    putVarint(out, map.values.size());
+    if (map.values.empty()) return;
+    putVarint(out, zigzag(map.values[0]));
+    for (size_t i = 1; i < map.values.size(); ++i) {
+        putVarint(out, map.values[i] - map.values[i - 1] - 1);
+    }
+}
+
+inline ValueMap readValueMap(ByteReader &in) {
+    ValueMap map;
+    uint64_t count = in.varint();
+    if (count > 65536) {
+        fatal("Corrupt value map: too many values");
+    }
+    map.values.resize(count);
+    int64_t value = 0;
+    for (uint64_t i = 0; i < count; ++i) {
+        uint64_t coded = in.varint();
+        if (coded > 65536) {
+            fatal("Corrupt value map: value out of range");
+        }
+        value = i == 0 ? unzigzag(static_cast<uint32_t>(coded)) : value + 1 + static_cast<int64_t>(coded);
+        if (value < -32768 || value > 32767) {
+            fatal("Corrupt value map: value out of range");
+        }
+        map.values[i] = static_cast<int16_t>(value);
+    }
+    return map;
+}
+
+#endif
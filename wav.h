@@ -0,0 +1,158 @@
+#ifndef BRAINWIRE_WAV_H
+#define BRAINWIRE_WAV_H
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <cstring>
+
+#include "common.h"
+
+// Structure to hold WAV file header
+struct WavHeader {
+    char riff[4];             // "RIFF"
+    uint32_t overall_size;    // overall size of file in bytes
+    char wave[4];             // "WAVE"
+    char fmt_chunk_marker[4]; // "fmt " string with trailing null char
+    uint32_t length_of_fmt;   // length of the format data
+    uint16_t format_type;     // format type
+    uint16_t channels;        // number of channels
+    uint32_t sample_rate;     // sampling rate (blocks per second)
+    uint32_t byterate;        // SampleRate * NumChannels * BitsPerSample/8
+    uint16_t block_align;     // NumChannels * BitsPerSample/8
+    uint16_t bits_per_sample; // bits per sample, 8- 8bits, 16- 16 bits etc
+    char data_chunk_header[4];// "data"
+    uint32_t data_size;       // data size
+};
+
+// Compact header encoding for the .brainwire container. Almost every
+// recording has the canonical 44-byte PCM header, where everything but the
+// sample rate and channel count follows from the sample count, so those are
+// sent as a template id and a few varints. Any other header is stored
+// verbatim, so the original bytes always come back exactly. A recording
+// whose samples are coded as planes (see pcm.h) has its own template, so
+// readers that only know 16-bit words refuse it rather than return planes.
+enum HeaderTemplate : uint8_t {
+    HEADER_VERBATIM = 0,
+    HEADER_PCM16 = 1,  // RIFF/WAVE, 16-byte fmt chunk, PCM, 16 bits per sample
+    HEADER_PLANES = 2, // verbatim header; the samples are sample planes
+};
+
+// The canonical PCM header for the given rate, channels and sizes
+inline WavHeader pcm16Header(uint32_t sampleRate, uint16_t channels, uint32_t dataSize, uint32_t overallSize) {
+    WavHeader header;
+    memcpy(header.riff, "RIFF", 4);
+    header.overall_size = overallSize;
+    memcpy(header.wave, "WAVE", 4);
+    memcpy(header.fmt_chunk_marker, "fmt ", 4);
+    header.length_of_fmt = 16;
+    header.format_type = 1;
+    header.channels = channels;
+    header.sample_rate = sampleRate;
+    header.byterate = sampleRate * channels * 2;
+    header.block_align = static_cast<uint16_t>(channels * 2);
+    header.bits_per_sample = 16;
+    memcpy(header.data_chunk_header, "data", 4);
+    header.data_size = dataSize;
+    return header;
+}
+
+// Template id, then for HEADER_PCM16: varint sample rate, varint channels - 1
+// and zigzag varint deltas of data_size from 2 * sampleCount and of
+// overall_size from data_size + 36
+inline void writeCompactHeader(std::vector<uint8_t> &out, const WavHeader &header, uint64_t sampleCount, bool planes = false) {
+    if (planes) {
+        out.push_back(HEADER_PLANES);
+        putValue(out, header);
+        return;
+    }
+    WavHeader canonical = pcm16Header(header.sample_rate, header.channels, header.data_size, header.overall_size);
+    if (header.channels == 0 || memcmp(&canonical, &header, sizeof(WavHeader)) != 0) {
+        out.push_back(HEADER_VERBATIM);
+        putValue(out, header);
+        return;
+    }
+    out.push_back(HEADER_PCM16);
+    putVarint(out, header.sample_rate);
+    putVarint(out, header.channels - 1u);
+    putVarint(out, zigzag(static_cast<int32_t>(header.data_size - 2 * sampleCount)));
+    putVarint(out, zigzag(static_cast<int32_t>(header.overall_size - (header.data_size + 36))));
+}
+
+// `planes` is set for HEADER_PLANES; without it, such a header is an error
+inline WavHeader readCompactHeader(ByteReader &in, uint64_t sampleCount, bool *planes = nullptr) {
+    uint8_t id = in.value<uint8_t>();
+    if (planes) {
+        *planes = id == HEADER_PLANES;
+    }
+    if (id == HEADER_PLANES) {
+        if (!planes) {
+            fatal("Samples wider than 16 bits can only be decoded whole to a WAV file");
+        }
+        return in.value<WavHeader>();
+    }
+    if (id == HEADER_VERBATIM) {
+        return in.value<WavHeader>();
+    }
+    if (id != HEADER_PCM16) {
+        fatal("Unsupported WAV header template " + std::to_string(id));
+    }
+    uint64_t sampleRate = in.varint();
+    uint64_t channels = in.varint() + 1;
+    uint64_t dataDelta = in.varint();
+    uint64_t overallDelta = in.varint();
+    if (sampleRate > UINT32_MAX || channels > UINT16_MAX || dataDelta > UINT32_MAX || overallDelta > UINT32_MAX) {
+        fatal("Corrupt WAV header fields");
+    }
+    uint32_t dataSize = static_cast<uint32_t>(2 * sampleCount + unzigzag(static_cast<uint32_t>(dataDelta)));
+    uint32_t overallSize = dataSize + 36 + unzigzag(static_cast<uint32_t>(overallDelta));
+    return pcm16Header(static_cast<uint32_t>(sampleRate), static_cast<uint16_t>(channels), dataSize, overallSize);
+}
+
+// Whether samples with header `b` can continue a recording with header `a`
+inline bool sameSampleFormat(const WavHeader &a, const WavHeader &b) {
+    return a.format_type == b.format_type && a.channels == b.channels && a.sample_rate == b.sample_rate &&
+           a.bits_per_sample == b.bits_per_sample;
+}
+
+inline std::vector<int16_t> readWavFile(const std::string &filename, WavHeader &header) {
+    std::ifstream file(filename, std::ios::binary);
+    if (!file) {
+        fatal("Error opening file: " + filename);
+    }
+
+    file.read(reinterpret_cast<char*>(&header), sizeof(WavHeader));
+
+    // Check if it's a valid WAV file
+    if (std::string(header.riff, 4) != "RIFF" || std::string(header.wave, 4) != "WAVE") {
+        fatal("Invalid WAV file: " + filename);
+    }
+
+    // An odd-sized chunk (8- or 24-bit samples) gets a zero pad byte
+    std::vector<int16_t> audioData;
+    resizeBuffer(audioData, (static_cast<size_t>(header.data_size) + 1) / sizeof(int16_t));
+    file.read(reinterpret_cast<char*>(audioData.data()), header.data_size);
+    return audioData;
+}
+
+inline void saveWavFile(const std::string &filename, const WavHeader &header, const std::vector<int16_t> &audioData) {
+    std::ofstream file(filename, std::ios::binary);
+    if (!file) {
+        fatal("Error creating file: " + filename);
+    }
+
+    // Write the WAV header to the file
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    // Write the audio data to the file, without the pad byte of an odd-sized
+    // chunk
+    size_t bytes = audioData.size() * sizeof(int16_t);
+    if (header.data_size % 2 == 1 && bytes == header.data_size + 1u) {
+        bytes--;
+    }
+    file.write(reinterpret_cast<const char*>(audioData.data()), bytes);
+}
+
+#endif
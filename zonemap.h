@@ -0,0 +1,117 @@
+#ifndef BRAINWIRE_ZONEMAP_H
+#define BRAINWIRE_ZONEMAP_H
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "common.h"
+
+// Per-block zone maps: min, max, mean and RMS of each block's samples,
+// stored in the .brainwire index so a search can rule blocks out without
+// reading them. The encoder summarizes a block in prepareBlock, while its
+// samples are in cache. min and max are exact; the mean is rounded and the
+// RMS rounded up, so an RMS bound never skips a block it should not.
+
+struct BlockSummary {
+    int16_t min = 0;
+    int16_t max = 0;
+    int16_t mean = 0;
+    uint16_t rms = 0;
+};
+
+inline BlockSummary summarizeBlock(const int16_t *samples, size_t count) {
+    BlockSummary summary;
+    if (count == 0) {
+        return summary;
+    }
+    int32_t low = samples[0], high = samples[0];
+    int64_t sum = 0;
+    uint64_t squares = 0;
+    size_t i = 0;
+#if defined(__SSE2__)
+    // 8 samples a step; sums of pairs go to 32-bit lanes (flushed before
+    // they can overflow) and squares straight to 64-bit lanes
+    if (count >= 8) {
+        __m128i minimum = _mm_set1_epi16(samples[0]);
+        __m128i maximum = minimum;
+        __m128i squareLow = _mm_setzero_si128(), squareHigh = _mm_setzero_si128();
+        const __m128i ones = _mm_set1_epi16(1);
+        const __m128i zero = _mm_setzero_si128();
+        while (i + 8 <= count) {
+            __m128i sums = _mm_setzero_si128();
+            size_t end = std::min(count - (count - i) % 8, i + 8 * 16384);
+            for (; i < end; i += 8) {
+                __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(samples + i));
+                minimum = _mm_min_epi16(minimum, x);
+                maximum = _mm_max_epi16(maximum, x);
+                sums = _mm_add_epi32(sums, _mm_madd_epi16(x, ones));
+                __m128i squared = _mm_madd_epi16(x, x); // unsigned: at most 2^31
+                squareLow = _mm_add_epi64(squareLow, _mm_unpacklo_epi32(squared, zero));
+                squareHigh = _mm_add_epi64(squareHigh, _mm_unpackhi_epi32(squared, zero));
+            }
+            int32_t lanes[4];
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), sums);
+            sum += static_cast<int64_t>(lanes[0]) + lanes[1] + lanes[2] + lanes[3];
+        }
+        int16_t lows[8], highs[8];
+        uint64_t squareLanes[4];
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(lows), minimum);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(highs), maximum);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(squareLanes), squareLow);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(squareLanes + 2), squareHigh);
+        for (int j = 0; j < 8; ++j) {
+            low = std::min<int32_t>(low, lows[j]);
+            high = std::max<int32_t>(high, highs[j]);
+        }
+        squares = squareLanes[0] + squareLanes[1] + squareLanes[2] + squareLanes[3];
+    }
+#endif
+    for (; i < count; ++i) {
+        int32_t x = samples[i];
+        low = std::min(low, x);
+        high = std::max(high, x);
+        sum += x;
+        squares += static_cast<uint64_t>(x * x);
+    }
+    summary.min = static_cast<int16_t>(low);
+    summary.max = static_cast<int16_t>(high);
+    summary.mean = static_cast<int16_t>(std::lround(static_cast<double>(sum) / count));
+    summary.rms = static_cast<uint16_t>(std::ceil(std::sqrt(static_cast<double>(squares) / count)));
+    return summary;
+}
+
+// zigzag min, varint max - min, zigzag mean, varint RMS
+inline void writeBlockSummary(std::vector<uint8_t> &out, const BlockSummary &summary) {
+    putVarint(out, zigzag(summary.min));
+    putVarint(out, static_cast<uint32_t>(summary.max - summary.min));
+    putVarint(out, zigzag(summary.mean));
+    putVarint(out, summary.rms);
+}
+
+inline BlockSummary readBlockSummary(ByteReader &in) {
+    uint64_t low = in.varint();
+    uint64_t range = in.varint();
+    uint64_t mean = in.varint();
+    uint64_t rms = in.varint();
+    if (low > 0xFFFF || range > 0xFFFF || mean > 0xFFFF || rms > 0xFFFF) {
+        fatal("Corrupt zone map: value out of range");
+    }
+    BlockSummary summary;
+    int32_t min = unzigzag(static_cast<uint32_t>(low));
+    if (min + static_cast<int64_t>(range) > 32767) {
+        fatal("Corrupt zone map: value out of range");
+    }
+    summary.min = static_cast<int16_t>(min);
+    summary.max = static_cast<int16_t>(min + static_cast<int32_t>(range));
+    summary.mean = static_cast<int16_t>(unzigzag(static_cast<uint32_t>(mean)));
+    summary.rms = static_cast<uint16_t>(rms);
+    return summary;
+}
+
+#endif